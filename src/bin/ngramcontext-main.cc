@@ -15,17 +15,40 @@
 //
 // Generates a context set of a given size from an input LM.
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <fst/flags.h>
 #include <fst/mutable-fst.h>
+#include <fst/vector-fst.h>
 #include <ngram/ngram-context.h>
 #include <ngram/ngram-model.h>
+#include <ngram/ngram-split.h>
 
 DECLARE_int64(contexts);
 DECLARE_double(bigram_threshold);
+DECLARE_string(method);
+DECLARE_bool(report_balance);
+
+namespace {
+
+// Logs the largest and mean number of arcs per context and their ratio.
+void LogBalance(const std::string &name, const std::vector<size_t> &counts) {
+  if (counts.empty()) return;
+  size_t max = 0, total = 0;
+  for (const auto count : counts) {
+    max = std::max(max, count);
+    total += count;
+  }
+  const double mean = static_cast<double>(total) / counts.size();
+  LOG(INFO) << name << " arcs per context: max = " << max
+            << ", mean = " << mean
+            << ", imbalance = " << (mean > 0 ? max / mean : 1.0);
+}
+
+}  // namespace
 
 int ngramcontext_main(int argc, char **argv) {
   std::string usage = "Generates a context set from an input LM.\n\n  Usage: ";
@@ -47,10 +70,40 @@ int ngramcontext_main(int argc, char **argv) {
 
   ngram::NGramModel<fst::StdArc> ngram(*in_fst, 0, ngram::kNormEps, true);
   std::vector<std::string> contexts;
-  ngram::NGramContext::FindContexts(ngram, FST_FLAGS_contexts,
-                                    &contexts,
-                                    FST_FLAGS_bigram_threshold);
+  std::vector<size_t> predicted;
+  if (FST_FLAGS_method == "greedy") {
+    ngram::NGramContext::FindContexts(ngram, FST_FLAGS_contexts,
+                                      &contexts,
+                                      FST_FLAGS_bigram_threshold);
+    if (FST_FLAGS_report_balance) {
+      predicted = ngram::NGramContext::ContextArcCounts(ngram, contexts);
+    }
+  } else if (FST_FLAGS_method == "balanced") {
+    ngram::NGramContext::FindBalancedContexts(ngram, FST_FLAGS_contexts,
+                                              &contexts, &predicted);
+  } else {
+    LOG(ERROR) << argv[0] << ": Unknown method: " << FST_FLAGS_method;
+    return 1;
+  }
   bool ret = ngram::NGramWriteContexts(out_name, contexts);
 
+  if (FST_FLAGS_report_balance) {
+    // The splits also hold the states needed for backoff and the unigram
+    // state, so the actual sizes are those of the split models.
+    LogBalance("Predicted", predicted);
+    ngram::NGramSplit<fst::StdArc> split(*in_fst, contexts);
+    std::vector<size_t> actual;
+    while (!split.Done()) {
+      fst::StdVectorFst split_fst;
+      if (!split.NextNGramModel(&split_fst)) return 1;
+      size_t num_arcs = 0;
+      for (fst::StdArc::StateId s = 0; s < split_fst.NumStates(); ++s) {
+        num_arcs += split_fst.NumArcs(s);
+      }
+      actual.push_back(num_arcs);
+    }
+    LogBalance("Actual", actual);
+  }
+
   return !ret;
 }
@@ -18,6 +18,11 @@
 DEFINE_int64(contexts, 1, "Number of desired contexts");
 DEFINE_double(bigram_threshold, 1.1,
               "Bin overfill to force a bigram context split");
+DEFINE_string(method, "greedy",
+              "One of: \"greedy\", \"balanced\" (minimizes the largest "
+              "context by arcs)");
+DEFINE_bool(report_balance, false,
+            "Log the predicted and actual arcs per context");
 
 int ngramcontext_main(int argc, char** argv);
 int main(int argc, char** argv) {
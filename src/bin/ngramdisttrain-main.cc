@@ -0,0 +1,691 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Trains models in a distributed fashion, as ngramdisttrain.sh does, running
+// the ngram binaries for each shard as a pool of local worker processes.
+// Jobs start as soon as the jobs writing their inputs are done, so the
+// stages of different shards overlap rather than waiting on each other.
+
+#include <glob.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fst/flags.h>
+#include <ngram/ngram-context.h>
+
+DECLARE_string(ifile);
+DECLARE_string(ofile);
+DECLARE_string(itype);
+DECLARE_string(otype);
+DECLARE_string(contexts);
+DECLARE_bool(merge_contexts);
+DECLARE_string(symbols);
+DECLARE_string(OOV_symbol);
+DECLARE_int64(order);
+DECLARE_bool(epsilon_as_backoff);
+DECLARE_bool(round_to_int);
+DECLARE_string(smooth_method);
+DECLARE_double(witten_bell_k);
+DECLARE_double(discount_D);
+DECLARE_int64(bins);
+DECLARE_string(shrink_method);
+DECLARE_double(theta);
+DECLARE_int32(workers);
+DECLARE_int32(retries);
+DECLARE_string(bin_dir);
+DECLARE_bool(verbose);
+
+extern char **environ;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kNoJob = std::numeric_limits<size_t>::max();
+
+// Formats a command line flag.
+template <class T>
+std::string Flag(const std::string &name, const T &value) {
+  std::ostringstream strm;
+  strm.precision(std::numeric_limits<double>::max_digits10);
+  strm << std::boolalpha << "--" << name << "=" << value;
+  return strm.str();
+}
+
+// Five-digit shard number, as in the names of split models.
+std::string ShardId(size_t i) {
+  std::ostringstream strm;
+  strm.width(5);
+  strm.fill('0');
+  strm << i;
+  return strm.str();
+}
+
+// Runs commands as worker processes, each once the commands it depends on
+// have succeeded. Failed commands are rerun up to 'retries' times.
+class ProcessPool {
+ public:
+  ProcessPool(int num_workers, int retries)
+      : num_workers_(std::max(num_workers, 1)), retries_(retries) {}
+
+  // Adds a command for the stage, run after the commands with the given
+  // indices (kNoJob entries are ignored); returns its index.
+  size_t Add(const std::string &stage, std::vector<std::string> args,
+             const std::vector<size_t> &deps) {
+    Job job;
+    job.stage = stage;
+    job.args = std::move(args);
+    for (const auto dep : deps) {
+      if (dep != kNoJob) job.deps.push_back(dep);
+    }
+    jobs_.push_back(std::move(job));
+    if (stage_times_.emplace(stage, StageTimes()).second) {
+      stages_.push_back(stage);
+    }
+    return jobs_.size() - 1;
+  }
+
+  size_t NumJobs() const { return jobs_.size(); }
+
+  // Runs all the commands; returns false if any failed after its retries.
+  bool Run();
+
+  // Logs the number of jobs, the elapsed time and the total job time of
+  // each stage.
+  void ReportTimes() const;
+
+ private:
+  struct Job {
+    std::string stage;
+    std::vector<std::string> args;  // Program and arguments.
+    std::vector<size_t> deps;
+    int attempts = 0;
+    Clock::time_point start;
+  };
+
+  struct StageTimes {
+    size_t jobs = 0;
+    double busy = 0.0;  // Total run time of the jobs, in seconds.
+    Clock::time_point begin = Clock::time_point::max();
+    Clock::time_point end = Clock::time_point::min();
+  };
+
+  // Starts the job; returns the process id, or -1 on failure.
+  pid_t Start(size_t j);
+
+  const int num_workers_;
+  const int retries_;
+  std::vector<Job> jobs_;
+  std::vector<std::string> stages_;  // In order of first use.
+  std::map<std::string, StageTimes> stage_times_;
+  Clock::time_point begin_;
+  Clock::time_point end_;
+};
+
+pid_t ProcessPool::Start(size_t j) {
+  Job &job = jobs_[j];
+  std::vector<char *> argv;
+  for (auto &arg : job.args) argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+  if (FST_FLAGS_verbose) {
+    std::string command = job.args[0];
+    for (size_t i = 1; i < job.args.size(); ++i) command += " " + job.args[i];
+    LOG(INFO) << job.stage << ": " << command;
+  }
+  ++job.attempts;
+  job.start = Clock::now();
+  pid_t pid;
+  if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+      0) {
+    LOG(ERROR) << "Could not run " << job.args[0];
+    return -1;
+  }
+  return pid;
+}
+
+bool ProcessPool::Run() {
+  begin_ = Clock::now();
+  std::vector<size_t> num_deps(jobs_.size());
+  std::vector<std::vector<size_t>> dependents(jobs_.size());
+  std::deque<size_t> ready;
+  for (size_t j = 0; j < jobs_.size(); ++j) {
+    num_deps[j] = jobs_[j].deps.size();
+    for (const auto dep : jobs_[j].deps) dependents[dep].push_back(j);
+    if (num_deps[j] == 0) ready.push_back(j);
+  }
+  std::map<pid_t, size_t> running;
+  size_t num_done = 0;
+  bool failed = false;
+  for (;;) {
+    while (!failed && !ready.empty() &&
+           running.size() < static_cast<size_t>(num_workers_)) {
+      const size_t j = ready.front();
+      ready.pop_front();
+      const pid_t pid = Start(j);
+      if (pid >= 0) {
+        running[pid] = j;
+      } else {
+        failed = true;
+      }
+    }
+    if (running.empty()) break;
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, 0)) < 0 && errno == EINTR) continue;
+    if (pid < 0) {
+      LOG(ERROR) << "Lost track of the worker processes";
+      return false;
+    }
+    const auto it = running.find(pid);
+    if (it == running.end()) continue;
+    const size_t j = it->second;
+    running.erase(it);
+    Job &job = jobs_[j];
+    const auto end = Clock::now();
+    auto &times = stage_times_[job.stage];
+    times.busy += std::chrono::duration<double>(end - job.start).count();
+    times.begin = std::min(times.begin, job.start);
+    times.end = std::max(times.end, end);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      ++times.jobs;
+      ++num_done;
+      for (const auto dependent : dependents[j]) {
+        if (--num_deps[dependent] == 0) ready.push_back(dependent);
+      }
+    } else if (job.attempts <= retries_) {
+      LOG(WARNING) << job.stage << ": " << job.args[0]
+                   << " failed; retrying (attempt " << job.attempts + 1
+                   << ")";
+      ready.push_front(j);
+    } else {
+      LOG(ERROR) << job.stage << ": " << job.args[0] << " failed after "
+                 << job.attempts << " attempt(s)";
+      failed = true;
+    }
+  }
+  end_ = Clock::now();
+  return !failed && num_done == jobs_.size();
+}
+
+void ProcessPool::ReportTimes() const {
+  for (const auto &stage : stages_) {
+    const auto &times = stage_times_.find(stage)->second;
+    if (times.end < times.begin) continue;  // Never run.
+    LOG(INFO) << stage << ": " << times.jobs << " job(s), "
+              << std::chrono::duration<double>(times.end - times.begin).count()
+              << "s elapsed, " << times.busy << "s in jobs";
+  }
+  LOG(INFO) << "Total: " << jobs_.size() << " job(s), "
+            << std::chrono::duration<double>(end_ - begin_).count()
+            << "s elapsed with " << num_workers_ << " worker(s)";
+}
+
+// A model or data file and the job writing it (kNoJob for input files).
+struct Shard {
+  std::string name;  // As in the output file names, e.g., "c00001".
+  std::string file;
+  size_t job;
+};
+
+// Builds the jobs of the training pipeline over the shards.
+class DistTrainer {
+ public:
+  DistTrainer(const std::string &bin_dir, const std::string &work_dir,
+              ProcessPool *pool)
+      : bin_dir_(bin_dir), work_dir_(work_dir), pool_(pool) {}
+
+  // Reads the context patterns, if any; returns false on error.
+  bool ReadContexts(const std::string &contexts_file) {
+    contexts_file_ = contexts_file;
+    if (contexts_file.empty()) return true;
+    return ngram::NGramReadContexts(contexts_file, &contexts_) &&
+           !contexts_.empty();
+  }
+
+  // Adds the jobs taking the input shards from 'itype' to 'otype'; returns
+  // false if there is no such pipeline or it is empty.
+  bool AddPipeline(std::vector<Shard> shards, const std::string &itype,
+                   const std::string &otype);
+
+  // Adds the job merging the context shards into a single model.
+  void MergeContexts(const std::string &otype);
+
+  const std::vector<Shard> &Shards() const { return shards_; }
+
+  size_t NumContexts() const { return contexts_.size(); }
+
+ private:
+  bool HasContexts() const { return !contexts_.empty(); }
+
+  std::string Program(const std::string &name) const {
+    return bin_dir_.empty() ? name : bin_dir_ + "/" + name;
+  }
+
+  std::string File(const std::string &stage, const std::string &name) const {
+    return work_dir_ + "/" + stage + "." + name;
+  }
+
+  // Jobs writing the shards.
+  static std::vector<size_t> Jobs(const std::vector<Shard> &shards) {
+    std::vector<size_t> jobs;
+    for (const auto &shard : shards) jobs.push_back(shard.job);
+    return jobs;
+  }
+
+  static std::vector<std::string> Files(const std::vector<Shard> &shards) {
+    std::vector<std::string> files;
+    for (const auto &shard : shards) files.push_back(shard.file);
+    return files;
+  }
+
+  // Splits each shard by context; returns the split of each shard.
+  std::vector<std::vector<Shard>> Split(const std::string &stage,
+                                        const std::vector<Shard> &shards,
+                                        bool complete);
+
+  void CompileSentences();
+  void Count();
+  void MergeCounts();
+  // Completes each context shard with the n-grams in other contexts.
+  void Complete(const std::string &stage,
+                const std::vector<std::string> &transfer_args);
+  Shard CountOfCounts();
+  void Make();
+  void Shrink();
+
+  const std::string bin_dir_;
+  const std::string work_dir_;
+  ProcessPool *pool_;
+  std::string contexts_file_;
+  std::vector<std::string> contexts_;
+  std::vector<Shard> shards_;  // Data shards, then context shards.
+};
+
+bool DistTrainer::AddPipeline(std::vector<Shard> shards,
+                              const std::string &itype,
+                              const std::string &otype) {
+  shards_ = std::move(shards);
+  const size_t num_jobs = pool_->NumJobs();
+  std::string type = itype;
+  if (type == "text_sents") {
+    CompileSentences();
+    type = "far";
+  }
+  if (otype == "far") return type == otype && pool_->NumJobs() > num_jobs;
+  if (type == "far") {
+    Count();
+    type = "counts";
+  }
+  if (otype == "counts") return type == otype && pool_->NumJobs() > num_jobs;
+  if (type == "counts") {
+    Make();
+    type = "lm";
+  }
+  if (otype == "lm") return type == otype && pool_->NumJobs() > num_jobs;
+  if (type == "lm") {
+    Shrink();
+    type = "pruned_lm";
+  }
+  return type == otype && pool_->NumJobs() > num_jobs;
+}
+
+std::vector<std::vector<Shard>> DistTrainer::Split(
+    const std::string &stage, const std::vector<Shard> &shards,
+    bool complete) {
+  std::vector<std::vector<Shard>> splits;
+  for (const auto &shard : shards) {
+    const std::string prefix = File(stage, shard.name + ".c");
+    const size_t job = pool_->Add(
+        stage,
+        {Program("ngramsplit"), Flag("complete", complete),
+         Flag("contexts", contexts_file_), shard.file, prefix},
+        {shard.job});
+    splits.emplace_back();
+    for (size_t c = 0; c < contexts_.size(); ++c) {
+      splits.back().push_back(
+          {shard.name + ".c" + ShardId(c), prefix + ShardId(c), job});
+    }
+  }
+  return splits;
+}
+
+void DistTrainer::CompileSentences() {
+  for (auto &shard : shards_) {
+    const std::string file = File("compile", shard.name);
+    shard.job = pool_->Add(
+        "compile",
+        {"farcompilestrings", "--fst_type=compact",
+         Flag("symbols", FST_FLAGS_symbols),
+         Flag("unknown_symbol", FST_FLAGS_OOV_symbol), "--keep_symbols",
+         shard.file, file},
+        {shard.job});
+    shard.file = file;
+  }
+}
+
+void DistTrainer::Count() {
+  for (auto &shard : shards_) {
+    const std::string file = File("count", shard.name);
+    shard.job = pool_->Add(
+        "count",
+        {Program("ngramcount"), Flag("order", FST_FLAGS_order),
+         Flag("epsilon_as_backoff", FST_FLAGS_epsilon_as_backoff),
+         Flag("round_to_int", FST_FLAGS_round_to_int), shard.file, file},
+        {shard.job});
+    shard.file = file;
+  }
+  if (HasContexts()) {
+    MergeCounts();
+    Complete("complete_counts", {});
+  }
+}
+
+// Splits each data shard by context and merges the splits of each context,
+// giving the context shards.
+void DistTrainer::MergeCounts() {
+  const auto splits = Split("split", shards_, false);
+  std::vector<Shard> context_shards;
+  for (size_t c = 0; c < contexts_.size(); ++c) {
+    std::vector<Shard> context_splits;
+    for (const auto &split : splits) context_splits.push_back(split[c]);
+    Shard shard{"c" + ShardId(c), File("merge_counts", "c" + ShardId(c)),
+                kNoJob};
+    std::vector<std::string> args = {
+        Program("ngrammerge"), "--check_consistency", "--complete",
+        Flag("round_to_int", FST_FLAGS_round_to_int), "--method=count_merge",
+        Flag("ofile", shard.file)};
+    for (const auto &file : Files(context_splits)) args.push_back(file);
+    shard.job = pool_->Add("merge_counts", args, Jobs(context_splits));
+    context_shards.push_back(shard);
+  }
+  shards_ = context_shards;
+}
+
+// Splits each context shard by context, transfers the n-grams of each
+// context to the splits of all other shards, and transfers these back into
+// the context shards. A context shard stands for its own split.
+void DistTrainer::Complete(const std::string &stage,
+                           const std::vector<std::string> &transfer_args) {
+  const size_t num_contexts = contexts_.size();
+  auto sub_splits = Split(stage + "_split", shards_, true);
+  for (size_t c = 0; c < num_contexts; ++c) sub_splits[c][c] = shards_[c];
+
+  std::vector<std::vector<Shard>> transferred(num_contexts);
+  for (size_t s = 0; s < num_contexts; ++s) {
+    std::vector<Shard> sources;
+    for (size_t c = 0; c < num_contexts; ++c) {
+      sources.push_back(sub_splits[c][s]);
+    }
+    const std::string prefix = File(stage + "_to", "s" + ShardId(s) + ".c");
+    std::vector<std::string> args = {
+        Program("ngramtransfer"), Flag("contexts", contexts_file_),
+        "--transfer_from=false", Flag("index", s), "--complete",
+        Flag("ofile", prefix)};
+    for (const auto &file : Files(sources)) args.push_back(file);
+    const size_t job = pool_->Add(stage + "_to", args, Jobs(sources));
+    for (size_t c = 0; c < num_contexts; ++c) {
+      transferred[s].push_back(c == s ? shards_[s]
+                                      : Shard{"", prefix + ShardId(c), job});
+    }
+  }
+
+  std::vector<Shard> context_shards;
+  for (size_t c = 0; c < num_contexts; ++c) {
+    std::vector<Shard> sources;
+    for (size_t s = 0; s < num_contexts; ++s) {
+      sources.push_back(transferred[s][c]);
+    }
+    Shard shard{shards_[c].name, File(stage + "_from", shards_[c].name),
+                kNoJob};
+    std::vector<std::string> args = {Program("ngramtransfer")};
+    args.insert(args.end(), transfer_args.begin(), transfer_args.end());
+    args.insert(args.end(),
+                {Flag("contexts", contexts_file_), "--transfer_from=true",
+                 Flag("index", c), "--complete", Flag("ofile", shard.file)});
+    for (const auto &file : Files(sources)) args.push_back(file);
+    shard.job = pool_->Add(stage + "_from", args, Jobs(sources));
+    context_shards.push_back(shard);
+  }
+  shards_ = context_shards;
+}
+
+// Computes the count of counts of each context shard and merges them.
+Shard DistTrainer::CountOfCounts() {
+  std::vector<Shard> counts;
+  for (size_t c = 0; c < contexts_.size(); ++c) {
+    const Shard &shard = shards_[c];
+    const std::string file = File("count_of_counts", shard.name);
+    counts.push_back(
+        {shard.name, file,
+         pool_->Add("count_of_counts",
+                    {Program("ngramcount"), "--method=count_of_counts",
+                     Flag("context_pattern", contexts_[c]), shard.file,
+                     file},
+                    {shard.job})});
+  }
+  Shard merged{"", File("count_of_counts", "merged"), kNoJob};
+  std::vector<std::string> args = {
+      Program("ngrammerge"), "--check_consistency",
+      Flag("ofile", merged.file), "--method=count_merge",
+      Flag("contexts", contexts_file_)};
+  for (const auto &file : Files(counts)) args.push_back(file);
+  merged.job = pool_->Add("count_of_counts", args, Jobs(counts));
+  return merged;
+}
+
+void DistTrainer::Make() {
+  Shard count_of_counts{"", "", kNoJob};
+  if (HasContexts()) count_of_counts = CountOfCounts();
+  for (auto &shard : shards_) {
+    const std::string file = File("make", shard.name);
+    std::vector<std::string> args = {Program("ngrammake")};
+    if (HasContexts()) {
+      args.push_back(Flag("count_of_counts", count_of_counts.file));
+    }
+    args.insert(args.end(),
+                {"--check_consistency",
+                 Flag("method", FST_FLAGS_smooth_method),
+                 Flag("witten_bell_k", FST_FLAGS_witten_bell_k),
+                 Flag("discount_D", FST_FLAGS_discount_D),
+                 Flag("bins", FST_FLAGS_bins), shard.file, file});
+    shard.job = pool_->Add("make", args, {shard.job, count_of_counts.job});
+    shard.file = file;
+  }
+  if (HasContexts() && FST_FLAGS_smooth_method == "witten_bell") {
+    Complete("complete_lm", {"--normalize"});
+  }
+}
+
+void DistTrainer::Shrink() {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Shard &shard = shards_[i];
+    const std::string file = File("shrink", shard.name);
+    std::vector<std::string> args = {
+        Program("ngramshrink"), "--check_consistency",
+        Flag("method", FST_FLAGS_shrink_method)};
+    if (HasContexts()) args.push_back(Flag("context_pattern", contexts_[i]));
+    args.insert(args.end(),
+                {Flag("theta", FST_FLAGS_theta), shard.file, file});
+    shard.job = pool_->Add("shrink", args, {shard.job});
+    shard.file = file;
+  }
+}
+
+void DistTrainer::MergeContexts(const std::string &otype) {
+  Shard merged{"merged", File("merge_contexts", "merged"), kNoJob};
+  std::vector<std::string> args = {Program("ngrammerge")};
+  if (otype != "counts") args.push_back("--normalize");
+  args.insert(args.end(),
+              {"--check_consistency", "--method=context_merge",
+               Flag("contexts", contexts_file_), Flag("ofile", merged.file)});
+  for (const auto &file : Files(shards_)) args.push_back(file);
+  merged.job = pool_->Add("merge_contexts", args, Jobs(shards_));
+  shards_ = {merged};
+}
+
+// Input files matching the pattern, in order.
+bool GlobFiles(const std::string &pattern, std::vector<std::string> *files) {
+  glob_t matches;
+  if (glob(pattern.c_str(), 0, nullptr, &matches) != 0) return false;
+  for (size_t i = 0; i < matches.gl_pathc; ++i) {
+    files->push_back(matches.gl_pathv[i]);
+  }
+  globfree(&matches);
+  return true;
+}
+
+// Moves (or copies) a result to its destination.
+bool MoveFile(const std::string &from, const std::string &to) {
+  std::error_code error;
+  std::filesystem::rename(from, to, error);
+  if (!error) return true;
+  std::filesystem::copy_file(
+      from, to, std::filesystem::copy_options::overwrite_existing, error);
+  if (!error) return true;
+  LOG(ERROR) << "Could not write " << to << ": " << error.message();
+  return false;
+}
+
+bool ValidType(const std::string &type, std::vector<std::string> types) {
+  return std::find(types.begin(), types.end(), type) != types.end();
+}
+
+}  // namespace
+
+int ngramdisttrain_main(int argc, char **argv) {
+  std::string usage = "Trains models in a distributed fashion.\n\n  Usage: ";
+  usage += argv[0];
+  usage += " [--options] --ifile=in_pattern --ofile=out --itype=type"
+           " --otype=type\n";
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+
+  if (argc > 1 || FST_FLAGS_ifile.empty() || FST_FLAGS_ofile.empty() ||
+      FST_FLAGS_itype.empty() || FST_FLAGS_otype.empty()) {
+    ShowUsage();
+    return 1;
+  }
+  if (!ValidType(FST_FLAGS_itype, {"text_sents", "far", "counts", "lm"})) {
+    LOG(ERROR) << "Bad input type: " << FST_FLAGS_itype;
+    return 1;
+  }
+  if (!ValidType(FST_FLAGS_otype, {"far", "counts", "lm", "pruned_lm"})) {
+    LOG(ERROR) << "Bad output type: " << FST_FLAGS_otype;
+    return 1;
+  }
+  if (FST_FLAGS_itype == "text_sents" && FST_FLAGS_symbols.empty()) {
+    LOG(ERROR) << "Symbol table must be provided to compile sentences";
+    return 1;
+  }
+  const bool has_contexts = !FST_FLAGS_contexts.empty();
+  if (has_contexts && FST_FLAGS_smooth_method == "kneser_ney") {
+    LOG(ERROR) << FST_FLAGS_smooth_method
+               << " not supported in distributed mode";
+    return 1;
+  }
+  if (FST_FLAGS_merge_contexts && FST_FLAGS_otype == "far") {
+    LOG(ERROR) << "Bad output type (" << FST_FLAGS_otype
+               << ") for merging contexts";
+    return 1;
+  }
+
+  std::vector<std::string> files;
+  if (!GlobFiles(FST_FLAGS_ifile, &files) || files.empty()) {
+    LOG(ERROR) << "No input files match " << FST_FLAGS_ifile;
+    return 1;
+  }
+  if (!has_contexts && files.size() > 1) {
+    LOG(ERROR) << "Contexts must be specified with multiple input files";
+    return 1;
+  }
+
+  std::string bin_dir = FST_FLAGS_bin_dir;
+  if (bin_dir.empty() && strchr(argv[0], '/') != nullptr) {
+    bin_dir = std::filesystem::path(argv[0]).parent_path().string();
+  }
+  const char *tmp_dir = getenv("TMPDIR");
+  std::string work_dir = std::string(tmp_dir ? tmp_dir : "/tmp") +
+                         "/ngramdisttrain.XXXXXX";
+  if (!mkdtemp(&work_dir[0])) {
+    LOG(ERROR) << "Could not create a working directory in "
+               << (tmp_dir ? tmp_dir : "/tmp");
+    return 1;
+  }
+
+  const int workers = FST_FLAGS_workers > 0
+                          ? FST_FLAGS_workers
+                          : std::thread::hardware_concurrency();
+  ProcessPool pool(workers, FST_FLAGS_retries);
+  DistTrainer trainer(bin_dir, work_dir, &pool);
+  bool ok = trainer.ReadContexts(FST_FLAGS_contexts);
+  if (!ok) LOG(ERROR) << "Could not read contexts: " << FST_FLAGS_contexts;
+
+  // Data shards, or context shards when starting from counts or models.
+  const bool data_shards =
+      !has_contexts || ValidType(FST_FLAGS_itype, {"text_sents", "far"});
+  if (ok && !data_shards && files.size() != trainer.NumContexts()) {
+    LOG(ERROR) << "Expected one input file per context, got "
+               << files.size();
+    ok = false;
+  }
+  std::vector<Shard> shards;
+  for (size_t i = 0; i < files.size(); ++i) {
+    shards.push_back({(data_shards ? "d" : "c") + ShardId(i), files[i],
+                      kNoJob});
+  }
+  if (ok && !trainer.AddPipeline(shards, FST_FLAGS_itype, FST_FLAGS_otype)) {
+    LOG(ERROR) << "Bad input type (" << FST_FLAGS_itype
+               << ") for output type (" << FST_FLAGS_otype << ")";
+    ok = false;
+  }
+  if (ok && has_contexts && FST_FLAGS_merge_contexts) {
+    trainer.MergeContexts(FST_FLAGS_otype);
+  }
+
+  if (ok) {
+    ok = pool.Run();
+    pool.ReportTimes();
+  }
+  if (ok) {
+    const auto &results = trainer.Shards();
+    if (results.size() == 1 && (!has_contexts || FST_FLAGS_merge_contexts)) {
+      ok = MoveFile(results[0].file, FST_FLAGS_ofile);
+    } else {
+      for (const auto &result : results) {
+        ok = MoveFile(result.file, FST_FLAGS_ofile + "." + result.name) && ok;
+      }
+    }
+  }
+  std::error_code error;
+  std::filesystem::remove_all(work_dir, error);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include <fst/flags.h>
+
+DEFINE_string(ifile, "", "Input file pattern");
+DEFINE_string(ofile, "", "Output file (prefix)");
+DEFINE_string(itype, "",
+              "Input type, one of: \"text_sents\", \"far\", \"counts\", "
+              "\"lm\"");
+DEFINE_string(otype, "",
+              "Output type, one of: \"far\", \"counts\", \"lm\", "
+              "\"pruned_lm\"");
+DEFINE_string(contexts, "", "Context patterns file");
+DEFINE_bool(merge_contexts, false, "Merge the context shards of the result");
+DEFINE_string(symbols, "", "Symbol table, to compile text sentences");
+DEFINE_string(OOV_symbol, "", "Out-of-vocabulary symbol");
+DEFINE_int64(order, 3, "Set maximal order of ngrams to be counted");
+DEFINE_bool(epsilon_as_backoff, false,
+            "Treat epsilon in the input FSTs as backoff");
+DEFINE_bool(round_to_int, false, "Round all counts to integers");
+DEFINE_string(smooth_method, "katz",
+              "One of: \"absolute\", \"katz\", \"kneser_ney\", "
+              "\"presmoothed\", \"unsmoothed\", \"witten_bell\"");
+DEFINE_double(witten_bell_k, 1, "Witten-Bell hyperparameter K");
+DEFINE_double(discount_D, -1, "Absolute discount value D to use");
+DEFINE_int64(bins, -1, "Number of bins for katz or absolute discounting");
+DEFINE_string(shrink_method, "seymore",
+              "One of: \"context_prune\", \"count_prune\", "
+              "\"relative_entropy\", \"seymore\"");
+DEFINE_double(theta, 0.0, "Pruning threshold theta");
+DEFINE_int32(workers, 0,
+             "Number of concurrent worker processes (0: number of cores)");
+DEFINE_int32(retries, 1, "Number of times a failed job is rerun");
+DEFINE_string(bin_dir, "",
+              "Directory of the ngram binaries (default: that of this one)");
+DEFINE_bool(verbose, false, "Show progress");
+
+int ngramdisttrain_main(int argc, char** argv);
+int main(int argc, char** argv) {
+  return ngramdisttrain_main(argc, argv);
+}
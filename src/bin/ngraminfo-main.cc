@@ -29,6 +29,7 @@
 
 DECLARE_bool(check_consistency);
 DECLARE_double(norm_eps);
+DECLARE_string(metadata);
 
 namespace ngram {
 
@@ -119,7 +120,7 @@ int ngraminfo_main(int argc, char **argv) {
   std::ostream &ostrm = ofstrm.is_open() ? ofstrm : std::cout;
   ngram::NGramModel<fst::StdArc> ngram(
       *fst, 0, FST_FLAGS_norm_eps,
-      FST_FLAGS_check_consistency);
+      FST_FLAGS_check_consistency, FST_FLAGS_metadata);
   if (FST_FLAGS_check_consistency && !ngram.CheckTopology()) {
     NGRAMERROR() << "Bad ngram model topology";
     return 1;
@@ -18,6 +18,9 @@
 
 DEFINE_bool(check_consistency, true, "Check model consistency");
 DEFINE_double(norm_eps, ngram::kNormEps, "Normalization check epsilon");
+DEFINE_string(metadata, "",
+              "State metadata file written by ngramsort --metadata, adopted "
+              "if it matches the model instead of recomputing it");
 
 int ngraminfo_main(int argc, char** argv);
 int main(int argc, char** argv) {
@@ -0,0 +1,129 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Writes an n-gram LM as a read-only model file for memory mapping, or checks
+// such a file against the model.
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fst/flags.h>
+#include <fst/equal.h>
+#include <fst/fst.h>
+#include <ngram/ngram-mapped-model.h>
+#include <ngram/ngram-model.h>
+
+DECLARE_int64(backoff_label);
+DECLARE_bool(check);
+
+namespace {
+
+using fst::StdArc;
+
+// Compares the mapped model with the model, querying each state for the
+// labels leaving its backoff state so that backoff paths are followed.
+bool CheckMappedModel(const ngram::NGramModel<StdArc> &model,
+                      const ngram::NGramMappedModel<StdArc> &mapped) {
+  if (mapped.NumStates() != model.NumStates() ||
+      mapped.HiOrder() != model.HiOrder() ||
+      mapped.UnigramState() != model.UnigramState() ||
+      mapped.BackoffLabel() != model.BackoffLabel()) {
+    LOG(ERROR) << "CheckMappedModel: Model parameters differ";
+    return false;
+  }
+  if (!fst::Equal(model.GetFst(), mapped.GetFst())) {
+    LOG(ERROR) << "CheckMappedModel: Model FSTs differ";
+    return false;
+  }
+  for (StdArc::StateId st = 0; st < model.NumStates(); ++st) {
+    StdArc::Weight bocost = StdArc::Weight::Zero();
+    StdArc::Weight mapped_bocost = StdArc::Weight::Zero();
+    const StdArc::StateId bo = model.GetBackoff(st, &bocost);
+    if (mapped.StateOrder(st) != model.StateOrder(st) ||
+        mapped.GetBackoff(st, &mapped_bocost) != bo ||
+        mapped_bocost != bocost) {
+      LOG(ERROR) << "CheckMappedModel: State data differ: " << st;
+      return false;
+    }
+    int order = 0;
+    int mapped_order = 0;
+    if (mapped.FinalCostInModel(st, &mapped_order) !=
+            model.FinalCostInModel(st, &order) ||
+        mapped_order != order) {
+      LOG(ERROR) << "CheckMappedModel: Final costs differ: " << st;
+      return false;
+    }
+    if (bo < 0) continue;
+    for (fst::ArcIterator<fst::StdFst> aiter(model.GetFst(), bo);
+         !aiter.Done(); aiter.Next()) {
+      const StdArc::Label label = aiter.Value().ilabel;
+      StdArc::StateId mst = st;
+      StdArc::StateId mapped_mst = st;
+      double cost = 0.0;
+      double mapped_cost = 0.0;
+      const bool found = model.FindNGramInModel(&mst, &order, label, &cost);
+      if (mapped.FindNGramInModel(&mapped_mst, &mapped_order, label,
+                                  &mapped_cost) != found ||
+          mapped_mst != mst || (found && (mapped_order != order ||
+                                          mapped_cost != cost))) {
+        LOG(ERROR) << "CheckMappedModel: Lookups differ: state " << st
+                   << ", label " << label;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int ngrammap_main(int argc, char **argv) {
+  std::string usage =
+      "Writes an ngram LM as a read-only model file for memory mapping.\n\n"
+      "  Usage: ";
+  usage += argv[0];
+  usage += " [--options] [in.fst [out.map]]\n";
+  usage += "         --check in.fst in.map\n";
+  std::set_new_handler(FailedNewHandler);
+  SET_FLAGS(usage.c_str(), &argc, &argv, true);
+
+  if (argc > 3 || (FST_FLAGS_check && argc != 3)) {
+    ShowUsage();
+    return 1;
+  }
+
+  std::string in_name =
+      (argc > 1 && (strcmp(argv[1], "-") != 0)) ? argv[1] : "";
+  std::string out_name = argc > 2 ? argv[2] : "";
+  if (!FST_FLAGS_check && out_name.empty()) {
+    LOG(ERROR) << argv[0] << ": Mapped model must be written to a file";
+    return 1;
+  }
+
+  std::unique_ptr<fst::StdFst> fst(fst::StdFst::Read(in_name));
+  if (!fst) return 1;
+
+  ngram::NGramModel<StdArc> ngramlm(*fst, FST_FLAGS_backoff_label);
+  if (ngramlm.Error()) return 1;
+
+  if (!FST_FLAGS_check) {
+    return ngram::NGramMappedModel<StdArc>::Write(ngramlm, out_name) ? 0 : 1;
+  }
+  std::unique_ptr<ngram::NGramMappedModel<StdArc>> mapped(
+      ngram::NGramMappedModel<StdArc>::Read(out_name));
+  if (!mapped) return 1;
+  return CheckMappedModel(ngramlm, *mapped) ? 0 : 1;
+}
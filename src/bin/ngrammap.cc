@@ -0,0 +1,26 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include <fst/flags.h>
+
+DEFINE_int64(backoff_label, 0, "Backoff label");
+DEFINE_bool(check, false,
+            "Verify that the mapped model (second argument) matches the model "
+            "FST (first argument) instead of writing it");
+
+int ngrammap_main(int argc, char** argv);
+int main(int argc, char** argv) {
+  return ngrammap_main(argc, argv);
+}
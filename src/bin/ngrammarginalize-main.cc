@@ -28,6 +28,7 @@ DECLARE_int64(backoff_label);
 DECLARE_int32(max_bo_updates);
 DECLARE_double(norm_eps);
 DECLARE_bool(check_consistency);
+DECLARE_int32(threads);
 
 int ngrammarginalize_main(int argc, char **argv) {
   std::string usage =
@@ -54,6 +55,7 @@ int ngrammarginalize_main(int argc, char **argv) {
                                 FST_FLAGS_norm_eps,
                                 FST_FLAGS_max_bo_updates,
                                 FST_FLAGS_check_consistency);
+  ngramarg.SetNumThreads(FST_FLAGS_threads);
 
   ngramarg.MarginalizeNGramModel();
   if (ngramarg.Error()) return 1;
@@ -20,6 +20,7 @@ DEFINE_int64(backoff_label, 0, "Backoff label");
 DEFINE_int32(max_bo_updates, 10, "Max iterations of backoff re-calculation");
 DEFINE_double(norm_eps, ngram::kNormEps, "Normalization check epsilon");
 DEFINE_bool(check_consistency, false, "Check model consistency");
+DEFINE_int32(threads, 1, "Number of threads used to marginalize states");
 
 int ngrammarginalize_main(int argc, char** argv);
 int main(int argc, char** argv) {
@@ -27,6 +27,7 @@
 #include <ngram/ngram-count-merge.h>
 #include <ngram/ngram-hist-merge.h>
 #include <ngram/ngram-model-merge.h>
+#include <ngram/ngram-multi-merge.h>
 #include <ngram/ngram-replace-merge.h>
 
 DECLARE_double(alpha);
@@ -42,6 +43,8 @@ DECLARE_double(norm_eps);
 DECLARE_bool(check_consistency);
 DECLARE_bool(complete);
 DECLARE_bool(round_to_int);
+DECLARE_bool(single_pass);
+DECLARE_int32(threads);
 
 namespace {
 
@@ -104,6 +107,34 @@ void RoundCountsToInt(fst::StdMutableFst *fst) {
   }
 }
 
+// Merges all count or smoothed models at once rather than pairwise.
+bool SinglePassMerge(int in_count, char **argv, const std::string &out_name) {
+  std::vector<std::unique_ptr<fst::StdVectorFst>> in_fsts(in_count);
+  std::vector<const fst::StdFst *> fsts;
+  for (int i = 0; i < in_count; ++i) {
+    if (!ReadFst<fst::StdArc>(argv[i + 1], &in_fsts[i])) return false;
+    fsts.push_back(in_fsts[i].get());
+  }
+  fst::StdVectorFst merged;
+  if (FST_FLAGS_method == "count_merge") {
+    ngram::NGramMultiCountMerge ngramrg(fsts, FST_FLAGS_backoff_label,
+                                        FST_FLAGS_norm_eps,
+                                        FST_FLAGS_check_consistency);
+    ngramrg.MergeNGramModels(&merged, FST_FLAGS_alpha, FST_FLAGS_beta,
+                             FST_FLAGS_normalize);
+    if (ngramrg.Error()) return false;
+    if (FST_FLAGS_round_to_int) RoundCountsToInt(&merged);
+  } else {
+    ngram::NGramMultiModelMerge ngramrg(fsts, FST_FLAGS_backoff_label,
+                                        FST_FLAGS_norm_eps,
+                                        FST_FLAGS_check_consistency);
+    ngramrg.MergeNGramModels(&merged, FST_FLAGS_alpha, FST_FLAGS_beta,
+                             FST_FLAGS_normalize);
+    if (ngramrg.Error()) return false;
+  }
+  return merged.Write(out_name);
+}
+
 }  // namespace
 
 int ngrammerge_main(int argc, char **argv) {
@@ -135,6 +166,16 @@ int ngrammerge_main(int argc, char **argv) {
     return 1;
   }
 
+  if (FST_FLAGS_single_pass) {
+    if (FST_FLAGS_method != "count_merge" &&
+        FST_FLAGS_method != "model_merge") {
+      LOG(ERROR) << argv[0] << ": --single_pass requires \"count_merge\" or "
+                 << "\"model_merge\"";
+      return 1;
+    }
+    return SinglePassMerge(in_count, argv, out_name) ? 0 : 1;
+  }
+
   if (FST_FLAGS_method != "histogram_merge") {
     std::unique_ptr<fst::StdVectorFst> fst1;
     if (!ReadFst<fst::StdArc>(argv[1], &fst1)) return 1;
@@ -144,6 +185,7 @@ int ngrammerge_main(int argc, char **argv) {
                                      FST_FLAGS_backoff_label,
                                      FST_FLAGS_norm_eps,
                                      FST_FLAGS_check_consistency);
+      ngramrg.SetNumThreads(FST_FLAGS_threads);
       for (int i = 2; i <= in_count; ++i) {
         if (!ReadFst<fst::StdArc>(argv[i], &fst2)) return 1;
         bool norm = FST_FLAGS_normalize && i == in_count;
@@ -159,6 +201,7 @@ int ngrammerge_main(int argc, char **argv) {
                                      FST_FLAGS_backoff_label,
                                      FST_FLAGS_norm_eps,
                                      FST_FLAGS_check_consistency);
+      ngramrg.SetNumThreads(FST_FLAGS_threads);
       for (int i = 2; i <= in_count; ++i) {
         if (!ReadFst<fst::StdArc>(argv[i], &fst2)) return 1;
         ngramrg.MergeNGramModels(*fst2, FST_FLAGS_alpha,
@@ -171,6 +214,7 @@ int ngrammerge_main(int argc, char **argv) {
       ngram::NGramBayesModelMerge ngramrg(fst1.get(),
                                           FST_FLAGS_backoff_label,
                                           FST_FLAGS_norm_eps);
+      ngramrg.SetNumThreads(FST_FLAGS_threads);
       for (int i = 2; i <= in_count; ++i) {
         if (!ReadFst<fst::StdArc>(argv[i], &fst2)) return 1;
         ngramrg.MergeNGramModels(*fst2, FST_FLAGS_alpha,
@@ -186,6 +230,7 @@ int ngrammerge_main(int argc, char **argv) {
       ngram::NGramReplaceMerge ngramrg(fst1.get(),
                                        FST_FLAGS_backoff_label,
                                        FST_FLAGS_norm_eps);
+      ngramrg.SetNumThreads(FST_FLAGS_threads);
       if (!ReadFst<fst::StdArc>(argv[2], &fst2)) return 1;
       ngramrg.MergeNGramModels(*fst2, FST_FLAGS_max_replace_order,
                                FST_FLAGS_normalize);
@@ -196,6 +241,7 @@ int ngrammerge_main(int argc, char **argv) {
                                        FST_FLAGS_backoff_label,
                                        FST_FLAGS_norm_eps,
                                        FST_FLAGS_check_consistency);
+      ngramrg.SetNumThreads(FST_FLAGS_threads);
       std::vector<std::string> contexts;
       if (!GetContexts(in_count, &contexts)) return 1;
       for (int i = 2; i <= in_count; ++i) {
@@ -212,6 +258,7 @@ int ngrammerge_main(int argc, char **argv) {
     ngram::NGramHistMerge ngramrg(
         hist_fst1.get(), FST_FLAGS_backoff_label,
         FST_FLAGS_norm_eps, FST_FLAGS_check_consistency);
+    ngramrg.SetNumThreads(FST_FLAGS_threads);
     for (int i = 2; i <= in_count; ++i) {
       std::unique_ptr<fst::VectorFst<ngram::HistogramArc>> hist_fst2;
       if (!ReadFst<ngram::HistogramArc>(argv[i], &hist_fst2)) return 1;
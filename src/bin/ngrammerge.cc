@@ -32,6 +32,11 @@ DEFINE_double(norm_eps, ngram::kNormEps, "Normalization check epsilon");
 DEFINE_bool(check_consistency, false, "Check model consistency");
 DEFINE_bool(complete, false, "Complete partial models");
 DEFINE_bool(round_to_int, false, "Round all merged counts to integers");
+DEFINE_bool(single_pass, false,
+            "Merge all models at once (count_merge and model_merge only); "
+            "model_merge and --normalize mix the first model by alpha and "
+            "each other model by beta, normalizing once");
+DEFINE_int32(threads, 1, "Number of threads used for pairwise merging");
 
 int ngrammerge_main(int argc, char** argv);
 int main(int argc, char** argv) {
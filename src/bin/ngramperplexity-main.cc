@@ -30,6 +30,7 @@ DECLARE_string(OOV_symbol);
 DECLARE_double(OOV_class_size);
 DECLARE_double(OOV_probability);
 DECLARE_string(context_pattern);
+DECLARE_string(metadata);
 
 int ngramperplexity_main(int argc, char **argv) {
   std::string usage = "Apply n-gram model to input FST archive.\n\n  Usage: ";
@@ -65,7 +66,8 @@ int ngramperplexity_main(int argc, char **argv) {
   std::ostream &ostrm = ofstrm.is_open() ? ofstrm : std::cout;
 
   ngram::NGramOutput ngram(fst.get(), ostrm, 0, false,
-                           FST_FLAGS_context_pattern);
+                           FST_FLAGS_context_pattern,
+                           /*include_all_suffixes=*/false, FST_FLAGS_metadata);
 
   if (in2_name.empty()) {
     if (in1_name.empty()) {
@@ -22,6 +22,9 @@ DEFINE_double(OOV_probability, 0, "Unigram probability for OOVs");
 DEFINE_string(context_pattern, "",
               "Restrict perplexity computation to contexts defined by"
               " pattern (default: no restriction)");
+DEFINE_string(metadata, "",
+              "State metadata file written by ngramsort --metadata, adopted "
+              "if it matches the model instead of recomputing it");
 
 int ngramperplexity_main(int argc, char** argv);
 int main(int argc, char** argv) {
@@ -21,6 +21,7 @@
 #include <string>
 
 #include <fst/flags.h>
+#include <ngram/compressed-stream.h>
 #include <ngram/ngram-output.h>
 
 DECLARE_bool(ARPA);
@@ -32,6 +33,8 @@ DECLARE_int64(backoff_label);
 DECLARE_bool(check_consistency);
 DECLARE_string(context_pattern);
 DECLARE_bool(include_all_suffixes);
+DECLARE_string(metadata);
+DECLARE_int32(threads);
 DECLARE_string(symbols);
 
 int ngramprint_main(int argc, char **argv) {
@@ -63,20 +66,22 @@ int ngramprint_main(int argc, char **argv) {
     fst->SetOutputSymbols(syms.get());
   }
 
-  std::ofstream ofstrm;
+  ngram::CompressedOfstream ofstrm;
   if (argc > 2 && (strcmp(argv[2], "-") != 0)) {
-    ofstrm.open(argv[2]);
+    ofstrm.Open(argv[2]);
     if (!ofstrm) {
       LOG(ERROR) << argv[0] << ": Open failed, file = " << argv[2];
       return 1;
     }
   }
-  std::ostream &ostrm = ofstrm.is_open() ? ofstrm : std::cout;
+  std::ostream &ostrm = ofstrm.IsOpen() ? ofstrm : std::cout;
 
   ngram::NGramOutput ngram(fst.get(), ostrm, FST_FLAGS_backoff_label,
                            FST_FLAGS_check_consistency,
                            FST_FLAGS_context_pattern,
-                           FST_FLAGS_include_all_suffixes);
+                           FST_FLAGS_include_all_suffixes,
+                           FST_FLAGS_metadata);
+  ngram.SetNumThreads(FST_FLAGS_threads);
 
   // Parse --backoff and --backoff_inline flags, where --backoff takes precedent
   ngram::NGramOutput::ShowBackoff show_backoff =
@@ -90,5 +95,9 @@ int ngramprint_main(int argc, char **argv) {
   ngram.ShowNGramModel(show_backoff, FST_FLAGS_negativelogs,
                        FST_FLAGS_integers,
                        FST_FLAGS_ARPA);
+  if (!ofstrm.Close()) {
+    LOG(ERROR) << argv[0] << ": Write failed, file = " << argv[2];
+    return 1;
+  }
   return 0;
 }
@@ -27,6 +27,10 @@ DEFINE_int64(backoff_label, 0, "Backoff label");
 DEFINE_bool(check_consistency, false, "Check model consistency");
 DEFINE_string(context_pattern, "", "Pattern of contexts to print");
 DEFINE_bool(include_all_suffixes, false, "Include suffixes of contexts");
+DEFINE_string(metadata, "",
+              "State metadata file written by ngramsort --metadata, adopted "
+              "if it matches the model instead of recomputing it");
+DEFINE_int32(threads, 1, "Number of threads used to format n-grams");
 DEFINE_string(symbols, "",
               "Symbol table file. If not empty, causes it to be loaded from the"
               " specified file instead of using the one inside the input FST.");
@@ -18,6 +18,8 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
 #include <string>
@@ -30,7 +32,9 @@
 #include <fst/rmepsilon.h>
 #include <fst/shortest-path.h>
 #include <fst/vector-fst.h>
+#include <ngram/compressed-stream.h>
 #include <ngram/ngram-randgen.h>
+#include <ngram/util.h>
 
 DECLARE_int32(max_length);
 DECLARE_int64(max_sents);
@@ -38,6 +42,9 @@ DECLARE_int32(seed);
 DECLARE_bool(remove_epsilon);
 DECLARE_bool(weighted);
 DECLARE_bool(remove_total_weight);
+DECLARE_bool(stream);
+DECLARE_bool(text);
+DECLARE_int32(threads);
 
 namespace {
 
@@ -102,6 +109,46 @@ int WritePathsToFar(fst::StdFst *fst, fst::StdArc::StateId st,
   return far_cnt;
 }
 
+// Samples sentences in rounds in which each thread samples a batch from its
+// own random stream, passing each round's sentences to write() in thread
+// order. Memory does not depend on the number of sentences.
+template <class Write>
+void StreamSentences(const fst::StdFst &fst, int seed, int64_t num_sents,
+                     int max_length, int num_threads, Write write) {
+  constexpr int64_t kBatchSize = 1024;
+  std::vector<ngram::NGramArcSelector<fst::StdArc>> selectors;
+  selectors.reserve(num_threads);
+  for (int t = 0; t < num_threads; ++t) selectors.emplace_back(seed, t);
+  std::vector<ngram::NGramSentenceSampler<fst::StdArc>> samplers;
+  samplers.reserve(num_threads);
+  std::vector<int64_t> remaining;
+  for (int t = 0; t < num_threads; ++t) {
+    samplers.emplace_back(fst, selectors[t], max_length);
+    remaining.push_back(num_sents / num_threads +
+                        (t < num_sents % num_threads));
+  }
+  std::vector<std::vector<std::vector<int>>> batches(num_threads);
+  std::vector<std::vector<char>> finished(num_threads);
+  for (bool done = false; !done;) {
+    ngram::ParallelFor(num_threads, num_threads, [&](size_t t) {
+      const int64_t size = std::min(kBatchSize, remaining[t]);
+      batches[t].resize(size);
+      finished[t].resize(size);
+      remaining[t] -= size;
+      for (int64_t i = 0; i < size; ++i) {
+        finished[t][i] = samplers[t].Sample(&batches[t][i]);
+      }
+    });
+    done = true;
+    for (int t = 0; t < num_threads; ++t) {
+      for (size_t i = 0; i < batches[t].size(); ++i) {
+        if (finished[t][i]) write(batches[t][i]);
+      }
+      if (remaining[t] > 0) done = false;
+    }
+  }
+}
+
 }  // namespace
 
 int ngramrandgen_main(int argc, char **argv) {
@@ -124,6 +171,52 @@ int ngramrandgen_main(int argc, char **argv) {
   std::unique_ptr<fst::StdFst> ifst(fst::StdFst::Read(ifile));
   if (!ifst) return 1;
 
+  // Each thread generates its share of the sentences from its own random
+  // stream, so the output depends only on the seed and number of threads.
+  const int seed = FST_FLAGS_seed ? FST_FLAGS_seed : time(nullptr);
+  const int64_t num_threads = std::max<int64_t>(
+      1, std::min<int64_t>(FST_FLAGS_threads, FST_FLAGS_max_sents));
+  ifst->Properties(fst::kILabelSorted, true);  // Computed before sharing.
+
+  if (FST_FLAGS_text) {
+    if (FST_FLAGS_weighted) {
+      LOG(ERROR) << argv[0] << ": --weighted requires the sentence tree and "
+                 << "can't be used with --text";
+      return 1;
+    }
+    const fst::SymbolTable *syms = ifst->InputSymbols();
+    if (!syms) {
+      LOG(ERROR) << argv[0] << ": Text output requires model symbols";
+      return 1;
+    }
+    ngram::CompressedOfstream ofstrm;
+    if (!ofile.empty()) {
+      ofstrm.Open(ofile);
+      if (!ofstrm) {
+        LOG(ERROR) << argv[0] << ": Open failed, file = " << ofile;
+        return 1;
+      }
+    }
+    std::ostream &ostrm = ofstrm.IsOpen() ? ofstrm : std::cout;
+    StreamSentences(*ifst, seed, FST_FLAGS_max_sents,
+                    FST_FLAGS_max_length, num_threads,
+                    [&ostrm, syms](const std::vector<int> &labels) {
+                      bool first = true;
+                      for (const auto label : labels) {
+                        if (label == 0) continue;  // Backoff epsilons.
+                        if (!first) ostrm << ' ';
+                        ostrm << syms->Find(label);
+                        first = false;
+                      }
+                      ostrm << '\n';
+                    });
+    if (!ofstrm.Close()) {
+      LOG(ERROR) << argv[0] << ": Write failed, file = " << ofile;
+      return 1;
+    }
+    return 0;
+  }
+
   std::unique_ptr<fst::FarWriter<fst::StdArc>> far_writer(
       fst::FarWriter<fst::StdArc>::Create(
           ofile, fst::FarType::STLIST));  // type change for fst
@@ -132,26 +225,63 @@ int ngramrandgen_main(int argc, char **argv) {
                << " for writing";
     return 1;
   }
-  fst::StdVectorFst ofst;
-
-  ngram::NGramArcSelector<fst::StdArc> selector(
-      FST_FLAGS_seed ? FST_FLAGS_seed : time(nullptr));
-  fst::RandGenOptions<ngram::NGramArcSelector<fst::StdArc>> opts(
-      selector, FST_FLAGS_max_length, FST_FLAGS_max_sents,
-      FST_FLAGS_weighted, FST_FLAGS_remove_total_weight);
-  fst::RandGen(*ifst, &ofst, opts);
-  ofst.SetInputSymbols(ifst->InputSymbols());  // takes model symbol tables
-  ofst.SetOutputSymbols(ifst->OutputSymbols());
-  if (FST_FLAGS_weighted) {
+  if (FST_FLAGS_stream) {
+    if (FST_FLAGS_weighted) {
+      LOG(ERROR) << argv[0] << ": --weighted requires the sentence tree and "
+                 << "can't be used with --stream";
+      return 1;
+    }
+    int far_cnt = 1;
+    int far_len = CalcExtLen(FST_FLAGS_max_sents, nullptr, 0);
+    StreamSentences(*ifst, seed, FST_FLAGS_max_sents,
+                    FST_FLAGS_max_length, num_threads,
+                    [&](const std::vector<int> &labels) {
+                      std::vector<int> path;
+                      for (const auto label : labels) {
+                        if (!FST_FLAGS_remove_epsilon || label != 0) {
+                          path.push_back(label);
+                        }
+                      }
+                      fst::StdVectorFst nfst;
+                      if (far_cnt == 1) {  // First FST gets the symbols.
+                        nfst.SetInputSymbols(ifst->InputSymbols());
+                        nfst.SetOutputSymbols(ifst->OutputSymbols());
+                      }
+                      CreateStringFstFromPath(&path, &nfst);
+                      FarWriteFst(far_writer.get(), &nfst, &far_cnt,
+                                  far_len);
+                    });
+    return 0;
+  }
+
+  std::vector<fst::StdVectorFst> ofsts(num_threads);
+  ngram::ParallelFor(num_threads, num_threads, [&](size_t t) {
+    const int64_t num_sents = FST_FLAGS_max_sents / num_threads +
+                              (t < FST_FLAGS_max_sents % num_threads);
+    ngram::NGramArcSelector<fst::StdArc> selector(seed, t);
+    fst::RandGenOptions<ngram::NGramArcSelector<fst::StdArc>> opts(
+        selector, FST_FLAGS_max_length, num_sents, FST_FLAGS_weighted,
+        FST_FLAGS_remove_total_weight);
+    fst::RandGen(*ifst, &ofsts[t], opts);
+    ofsts[t].SetInputSymbols(ifst->InputSymbols());  // model symbol tables
+    ofsts[t].SetOutputSymbols(ifst->OutputSymbols());
+  });
+  if (FST_FLAGS_weighted) {  // Writes one tree per thread.
     int far_incr = 1;
-    int far_len = 1;
-    FarWriteFst(far_writer.get(), &ofst, &far_incr, far_len);
-  } else {
+    int far_len = CalcExtLen(num_threads, nullptr, 0);
+    for (auto &ofst : ofsts) {
+      FarWriteFst(far_writer.get(), &ofst, &far_incr, far_len);
+    }
+  } else {  // Numbers the sentences of all threads in order.
     int far_cnt = 1;
     int far_len = CalcExtLen(FST_FLAGS_max_sents, nullptr, 0);
     std::vector<int> labels;
-    WritePathsToFar(&ofst, ofst.Start(), &labels, far_writer.get(), far_cnt,
-                    far_len, FST_FLAGS_remove_epsilon);
+    for (auto &ofst : ofsts) {
+      if (ofst.Start() == fst::kNoStateId) continue;
+      far_cnt = WritePathsToFar(&ofst, ofst.Start(), &labels,
+                                far_writer.get(), far_cnt, far_len,
+                                FST_FLAGS_remove_epsilon);
+    }
   }
 
   return 0;
@@ -27,6 +27,14 @@ DEFINE_bool(weighted, false,
             "Output tree weighted by sentence count vs. unweighted sentences");
 DEFINE_bool(remove_total_weight, false,
             "Remove total weight when output weighted");
+DEFINE_bool(stream, false,
+            "Sample and write one sentence at a time, in constant memory");
+DEFINE_bool(text, false,
+            "Write sentences as lines of text rather than a FAR; implies "
+            "--stream");
+DEFINE_int32(threads, 1,
+             "Number of threads, each generating its share of the sentences "
+             "from its own random stream");
 
 int ngramrandgen_main(int argc, char** argv);
 int main(int argc, char** argv) {
@@ -20,6 +20,7 @@
 #include <string>
 
 #include <fst/flags.h>
+#include <ngram/compressed-stream.h>
 #include <ngram/ngram-input.h>
 
 DECLARE_bool(ARPA);
@@ -27,6 +28,7 @@ DECLARE_bool(renormalize_arpa);
 DECLARE_string(symbols);
 DECLARE_string(epsilon_symbol);
 DECLARE_string(OOV_symbol);
+DECLARE_int32(threads);
 DECLARE_string(start_symbol);  // defined in ngram-output.cc
 DECLARE_string(end_symbol);    // defined in ngram-output.cc
 
@@ -42,15 +44,15 @@ int ngramread_main(int argc, char **argv) {
     return 1;
   }
 
-  std::ifstream ifstrm;
+  ngram::CompressedIfstream ifstrm;
   if (argc > 1 && (strcmp(argv[1], "-") != 0)) {
-    ifstrm.open(argv[1]);
+    ifstrm.Open(argv[1]);
     if (!ifstrm) {
       LOG(ERROR) << argv[0] << ": Open failed: " << argv[1];
       return 1;
     }
   }
-  std::istream &istrm = ifstrm.is_open() ? ifstrm : std::cin;
+  std::istream &istrm = ifstrm.IsOpen() ? ifstrm : std::cin;
 
   std::ofstream ofstrm;
   if (argc > 2 && (strcmp(argv[2], "-") != 0)) {
@@ -66,7 +68,22 @@ int ngramread_main(int argc, char **argv) {
       istrm, ostrm, FST_FLAGS_symbols,
       FST_FLAGS_epsilon_symbol, FST_FLAGS_OOV_symbol,
       FST_FLAGS_start_symbol, FST_FLAGS_end_symbol);
-  return !input.ReadInput(FST_FLAGS_ARPA, /*symbols=*/false,
-                          /*output=*/true,
-                          FST_FLAGS_renormalize_arpa);
+  input.SetNumThreads(FST_FLAGS_threads);
+  // ARPA models in uncompressed named files are memory-mapped rather than
+  // streamed.
+  if (FST_FLAGS_ARPA && ifstrm.IsOpen() &&
+      ifstrm.GetCompression() == ngram::Compression::NONE) {
+    return !input.ReadMappedARPA(argv[1], /*output=*/true,
+                                 FST_FLAGS_renormalize_arpa);
+  }
+  if (!input.ReadInput(FST_FLAGS_ARPA, /*symbols=*/false,
+                       /*output=*/true,
+                       FST_FLAGS_renormalize_arpa)) {
+    return 1;
+  }
+  if (!ifstrm.Close()) {
+    LOG(ERROR) << argv[0] << ": Decompression failed: " << argv[1];
+    return 1;
+  }
+  return 0;
 }
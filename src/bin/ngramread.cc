@@ -23,6 +23,7 @@ DEFINE_bool(renormalize_arpa, false,
 DEFINE_string(symbols, "", "Label symbol table");
 DEFINE_string(epsilon_symbol, "<epsilon>", "Label for epsilon transitions");
 DEFINE_string(OOV_symbol, "<UNK>", "Class label for OOV symbols");
+DEFINE_int32(threads, 1, "Number of threads used to read ARPA models");
 DECLARE_string(start_symbol);  // defined in ngram-output.cc
 DECLARE_string(end_symbol);    // defined in ngram-output.cc
 
@@ -13,17 +13,28 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
-// Sorts an ngram LM in lexicographic state context order.
+// Sorts an ngram LM in lexicographic state context order, or in an order
+// suited to scoring.
 
+#include <fstream>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <fst/flags.h>
+#include <fst/extensions/far/far.h>
 #include <ngram/ngram-mutable-model.h>
 
 DECLARE_bool(check_consistency);
 DECLARE_int64(backoff_label);
+DECLARE_string(metadata);
+DECLARE_bool(metadata_state_ngrams);
 DECLARE_double(norm_eps);
+DECLARE_bool(relabel);
+DECLARE_string(relabel_pairs);
+DECLARE_string(state_order);
+DECLARE_string(visit_profile);
 
 int ngramsort_main(int argc, char **argv) {
   std::string usage =
@@ -50,9 +61,51 @@ int ngramsort_main(int argc, char **argv) {
       fst.get(), FST_FLAGS_backoff_label,
       FST_FLAGS_norm_eps,
       /* state_ngrams= */ true, /* infinite_backoff= */ false);
-  ngramlm.SortStates();
+  if (FST_FLAGS_relabel) {
+    std::vector<std::pair<fst::StdArc::Label, fst::StdArc::Label>> pairs;
+    ngramlm.RelabelByFrequency(&pairs);
+    if (!FST_FLAGS_relabel_pairs.empty()) {
+      std::ofstream ostrm(FST_FLAGS_relabel_pairs);
+      if (!ostrm) {
+        LOG(ERROR) << argv[0] << ": Open failed, file = "
+                   << FST_FLAGS_relabel_pairs;
+        return 1;
+      }
+      for (const auto &pair : pairs) {
+        ostrm << pair.first << "\t" << pair.second << "\n";
+      }
+    }
+    ngramlm.InitModel();  // Recomputes the state n-grams for sorting.
+  }
+  if (FST_FLAGS_state_order == "lexicographic") {
+    ngramlm.SortStates();
+  } else if (FST_FLAGS_state_order == "breadth_first") {
+    ngramlm.SortStatesBreadthFirst();
+  } else if (FST_FLAGS_state_order == "visits") {
+    std::unique_ptr<fst::FarReader<fst::StdArc>> far_reader(
+        fst::FarReader<fst::StdArc>::Open(FST_FLAGS_visit_profile));
+    if (!far_reader) {
+      LOG(ERROR) << argv[0] << ": Unable to open fst archive "
+                 << FST_FLAGS_visit_profile;
+      return 1;
+    }
+    std::vector<double> visits(ngramlm.NumStates(), 0.0);
+    for (; !far_reader->Done(); far_reader->Next()) {
+      ngramlm.CountStateVisits(*far_reader->GetFst(), &visits);
+    }
+    ngramlm.SortStatesByVisits(visits);
+  } else {
+    LOG(ERROR) << argv[0]
+               << ": Unknown state order: " << FST_FLAGS_state_order;
+    return 1;
+  }
   ngramlm.InitModel();
   ngramlm.GetFst().Write(out_name);
+  if (!FST_FLAGS_metadata.empty() &&
+      !ngramlm.WriteMetadata(FST_FLAGS_metadata,
+                             FST_FLAGS_metadata_state_ngrams)) {
+    return 1;
+  }
 
   return 0;
 }
@@ -18,7 +18,22 @@
 
 DEFINE_bool(check_consistency, false, "Check model consistency");
 DEFINE_int64(backoff_label, 0, "Backoff label");
+DEFINE_string(metadata, "",
+              "File to write the state metadata of the sorted model to, for "
+              "adoption with --metadata by ngraminfo, ngramprint and "
+              "ngramperplexity");
+DEFINE_bool(metadata_state_ngrams, false,
+            "Also write the state n-grams to --metadata, for consumers that "
+            "need them, e.g., ngramprint --context");
 DEFINE_double(norm_eps, ngram::kNormEps, "Normalization check epsilon");
+DEFINE_bool(relabel, false, "Renumber words by decreasing unigram frequency");
+DEFINE_string(relabel_pairs, "",
+              "File to write (old, new) label pairs of --relabel");
+DEFINE_string(state_order, "lexicographic",
+              "One of: \"lexicographic\", \"breadth_first\", \"visits\"");
+DEFINE_string(visit_profile, "",
+              "FST archive of sample text whose state visits order states "
+              "for --state_order=visits");
 
 int ngramsort_main(int argc, char** argv);
 int main(int argc, char** argv) {
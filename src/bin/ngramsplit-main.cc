@@ -32,9 +32,13 @@ DECLARE_string(method);
 DECLARE_double(norm_eps);
 DECLARE_bool(complete);
 DECLARE_string(far_type);
+DECLARE_int32(threads);
 
 namespace {
 
+// Number of splits built and held in memory at once per thread.
+constexpr size_t kSplitsPerThread = 2;
+
 template <class Arc>
 bool SplitToFsts(fst::VectorFst<Arc> *fst,
                  const std::vector<std::string> &context_patterns,
@@ -42,17 +46,17 @@ bool SplitToFsts(fst::VectorFst<Arc> *fst,
   ngram::NGramSplit<Arc> split(*fst, context_patterns,
                                FST_FLAGS_backoff_label,
                                FST_FLAGS_norm_eps);
-  for (int i = 0; !split.Done(); ++i) {
-    fst::VectorFst<Arc> ofst;
-    if (!split.NextNGramModel(&ofst)) return true;
-    std::ostringstream suffix;
-    suffix.width(5);
-    suffix.fill('0');
-    suffix << i;
-    const auto out_name = out_name_prefix + suffix.str();
-    if (!ofst.Write(out_name)) return true;
-  }
-  return false;
+  int i = 0;
+  return !split.NextNGramModels(
+      FST_FLAGS_threads, kSplitsPerThread * FST_FLAGS_threads,
+      [&](const fst::VectorFst<Arc> &ofst) {
+        std::ostringstream suffix;
+        suffix.width(5);
+        suffix.fill('0');
+        suffix << i++;
+        const auto out_name = out_name_prefix + suffix.str();
+        return ofst.Write(out_name);
+      });
 }
 
 void GetSortedPatterns(const std::vector<std::string> &context_patterns,
@@ -91,13 +95,14 @@ bool SplitToFar(fst::VectorFst<Arc> *fst,
                  << "split_fsts.far for writing";
     return true;
   }
-  for (size_t i = 0; !split.Done(); ++i) {
-    fst::VectorFst<Arc> ofst;
-    if (!split.NextNGramModel(&ofst)) return true;
-    CHECK_LT(i, context_patterns.size());
-    far_writer->Add(sorted_full_patterns[i], ofst);
-  }
-  return false;
+  size_t i = 0;
+  return !split.NextNGramModels(
+      FST_FLAGS_threads, kSplitsPerThread * FST_FLAGS_threads,
+      [&](const fst::VectorFst<Arc> &ofst) {
+        CHECK_LT(i, context_patterns.size());
+        far_writer->Add(sorted_full_patterns[i++], ofst);
+        return true;
+      });
 }
 
 template <class Arc>
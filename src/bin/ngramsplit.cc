@@ -23,6 +23,7 @@ DEFINE_string(method, "count_split",
               "\"histogram_split\"");
 DEFINE_double(norm_eps, ngram::kNormEps, "Normalization check epsilon");
 DEFINE_bool(complete, false, "Complete partial models");
+DEFINE_int32(threads, 1, "Number of threads used to build the splits");
 // TODO(wolfsonkin): Change the default `far_type` from this rather strange
 // empty string implying to create a bunch of FSTs to the literal `"default"`.
 // Note that the disttests depend on this default implicitly, so they will have
@@ -20,10 +20,12 @@
 #include <string>
 
 #include <fst/flags.h>
+#include <ngram/compressed-stream.h>
 #include <ngram/ngram-input.h>
 
 DECLARE_string(epsilon_symbol);
 DECLARE_string(OOV_symbol);
+DECLARE_int32(threads);
 
 int ngramsymbols_main(int argc, char **argv) {
   std::string usage = "Derives a symbol table from a corpus.\n\n  Usage: ";
@@ -37,29 +39,39 @@ int ngramsymbols_main(int argc, char **argv) {
     return 1;
   }
 
-  std::ifstream ifstrm;
+  ngram::CompressedIfstream ifstrm;
   if (argc > 1 && (strcmp(argv[1], "-") != 0)) {
-    ifstrm.open(argv[1]);
+    ifstrm.Open(argv[1]);
     if (!ifstrm) {
       LOG(ERROR) << argv[0] << ": Open failed: " << argv[1];
       return 1;
     }
   }
-  std::istream &istrm = ifstrm.is_open() ? ifstrm : std::cin;
+  std::istream &istrm = ifstrm.IsOpen() ? ifstrm : std::cin;
 
-  std::ofstream ofstrm;
+  ngram::CompressedOfstream ofstrm;
   if (argc > 2 && (strcmp(argv[2], "-") != 0)) {
-    ofstrm.open(argv[2]);
+    ofstrm.Open(argv[2]);
     if (!ofstrm) {
       LOG(ERROR) << argv[0] << ": Open failed: " << argv[2];
       return 1;
     }
   }
-  std::ostream &ostrm = ofstrm.is_open() ? ofstrm : std::cout;
+  std::ostream &ostrm = ofstrm.IsOpen() ? ofstrm : std::cout;
 
   ngram::NGramInput input(istrm, ostrm, /*symbols=*/"",
                           FST_FLAGS_epsilon_symbol,
                           FST_FLAGS_OOV_symbol,
                           /*start_symbol=*/"", /*end_symbol=*/"");
-  return !input.ReadInput(/*ARPA=*/false, /*symbols=*/true);
+  input.SetNumThreads(FST_FLAGS_threads);
+  if (!input.ReadInput(/*ARPA=*/false, /*symbols=*/true)) return 1;
+  if (!ifstrm.Close()) {
+    LOG(ERROR) << argv[0] << ": Decompression failed: " << argv[1];
+    return 1;
+  }
+  if (!ofstrm.Close()) {
+    LOG(ERROR) << argv[0] << ": Write failed: " << argv[2];
+    return 1;
+  }
+  return 0;
 }
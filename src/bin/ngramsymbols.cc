@@ -17,6 +17,7 @@
 
 DEFINE_string(epsilon_symbol, "<epsilon>", "Label for epsilon");
 DEFINE_string(OOV_symbol, "<UNK>", "Class label for OOV symbols");
+DEFINE_int32(threads, 1, "Number of threads used to collect symbols");
 
 int ngramsymbols_main(int argc, char** argv);
 int main(int argc, char** argv) {
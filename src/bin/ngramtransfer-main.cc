@@ -15,6 +15,7 @@
 //
 // Transfers n-grams from a source model(s) to a destination model.
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
@@ -34,6 +35,7 @@ DECLARE_int32(index);
 DECLARE_bool(transfer_from);
 DECLARE_bool(normalize);
 DECLARE_bool(complete);
+DECLARE_int32(threads);
 
 namespace {
 
@@ -99,20 +101,34 @@ bool Transfer(std::string out_name_prefix, int in_count, char **argv) {
     ngram::NGramTransfer<Arc> transfer(*index_fst,
                                        contexts[FST_FLAGS_index],
                                        FST_FLAGS_backoff_label);
+    // Destinations are transferred to a batch at a time, one per thread, so
+    // that only a batch of them is held in memory.
+    const int batch_size = std::max(FST_FLAGS_threads, 1);
+    std::vector<int> dests;
     for (int dest = 0; dest < in_count; ++dest) {
-      if (dest == FST_FLAGS_index) continue;
-
-      std::unique_ptr<fst::VectorFst<Arc>> fst_dest;
-      if (!ReadFst<Arc>(argv[dest + 1], &fst_dest) ||
-          !transfer.TransferNGramsTo(fst_dest.get(), contexts[dest])) {
+      if (dest != FST_FLAGS_index) dests.push_back(dest);
+    }
+    for (size_t begin = 0; begin < dests.size(); begin += batch_size) {
+      const size_t end = std::min(dests.size(), begin + batch_size);
+      std::vector<std::unique_ptr<fst::VectorFst<Arc>>> fst_dests(end - begin);
+      std::vector<fst::MutableFst<Arc> *> fsts;
+      std::vector<std::string> dest_contexts;
+      for (size_t i = begin; i < end; ++i) {
+        if (!ReadFst<Arc>(argv[dests[i] + 1], &fst_dests[i - begin]))
+          return false;
+        fsts.push_back(fst_dests[i - begin].get());
+        dest_contexts.push_back(contexts[dests[i]]);
+      }
+      if (!transfer.TransferNGramsTo(fsts, dest_contexts, FST_FLAGS_threads))
         return false;
+      for (size_t i = begin; i < end; ++i) {
+        std::ostringstream suffix;
+        suffix.width(5);
+        suffix.fill('0');
+        suffix << dests[i];
+        std::string out_name = out_name_prefix + suffix.str();
+        fst_dests[i - begin]->Write(out_name);
       }
-      std::ostringstream suffix;
-      suffix.width(5);
-      suffix.fill('0');
-      suffix << dest;
-      std::string out_name = out_name_prefix + suffix.str();
-      fst_dest->Write(out_name);
     }
   }
   return true;
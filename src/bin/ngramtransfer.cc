@@ -28,6 +28,8 @@ DEFINE_bool(transfer_from, false,
             "Transfer from (to) other FSTS to indexed FST");
 DEFINE_bool(normalize, false, "Recompute backoff weights after transfer");
 DEFINE_bool(complete, false, "Complete partial models");
+DEFINE_int32(threads, 1,
+             "Number of destination FSTs transferred to concurrently");
 
 int ngramtransfer_main(int argc, char** argv);
 int main(int argc, char** argv) {
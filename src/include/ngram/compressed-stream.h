@@ -0,0 +1,148 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// File streams that transparently (de)compress gzip and zstd text files.
+// Compression uses zlib and libzstd in process; each is optional at build
+// time (HAVE_ZLIB, HAVE_ZSTD), and opening a file whose compression was not
+// built in fails with an error. Uncompressed files need neither.
+
+#ifndef NGRAM_COMPRESSED_STREAM_H_
+#define NGRAM_COMPRESSED_STREAM_H_
+
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace ngram {
+
+enum class Compression {
+  NONE,
+  GZIP,
+  ZSTD,
+};
+
+// Compression of a file, given its leading bytes.
+Compression CompressionFromMagic(const std::string &magic);
+
+// Compression implied by the extension of a file name (.gz, .zst).
+Compression CompressionFromExtension(const std::string &name);
+
+// (De)compressor of a gzip or zstd stream, defined in compressed-stream.cc.
+class StreamCodec;
+
+// Stream buffer reading and decompressing, or compressing and writing, a
+// compressed file.
+class CodecStreamBuf : public std::streambuf {
+ public:
+  CodecStreamBuf();
+
+  ~CodecStreamBuf() override;
+
+  // Opens the file to decompress it when reading or to compress when
+  // writing. Returns false on failure, including if the compression was not
+  // built in.
+  bool Open(Compression compression, bool decompress, const std::string &name);
+
+  // Flushes and finishes any output and closes the file. Returns false if
+  // reading, writing or (de)compression failed.
+  bool Close();
+
+  bool IsOpen() const { return file_ != nullptr; }
+
+ protected:
+  int_type underflow() override;
+  int_type overflow(int_type c) override;
+  int sync() override;
+
+ private:
+  // Compresses and writes the buffered output; if 'finish', also ends the
+  // compressed stream.
+  bool WriteBuffer(bool finish);
+
+  std::FILE *file_ = nullptr;
+  std::unique_ptr<StreamCodec> codec_;
+  bool output_ = false;
+  bool eof_ = false;    // Read the whole file.
+  bool ended_ = false;  // Decompressed a whole gzip member or zstd frame.
+  bool error_ = false;
+  std::vector<char> buf_;  // Uncompressed data.
+  std::vector<char> raw_;  // Compressed data.
+  const char *raw_begin_ = nullptr;  // Compressed data left to decompress.
+  const char *raw_end_ = nullptr;
+};
+
+// Input file stream that decompresses files whose leading bytes show gzip or
+// zstd compression, and reads other files as std::ifstream would.
+class CompressedIfstream : public std::istream {
+ public:
+  CompressedIfstream() : std::istream(nullptr) { init(&file_); }
+
+  explicit CompressedIfstream(const std::string &source)
+      : CompressedIfstream() {
+    Open(source);
+  }
+
+  void Open(const std::string &source);
+
+  // Closes the file; returns false if decompression failed.
+  bool Close();
+
+  bool IsOpen() const { return file_.is_open() || codec_.IsOpen(); }
+
+  Compression GetCompression() const { return compression_; }
+
+ private:
+  std::filebuf file_;
+  CodecStreamBuf codec_;
+  Compression compression_ = Compression::NONE;
+};
+
+// Output file stream that compresses files named with a .gz or .zst
+// extension, and writes other files as std::ofstream would.
+class CompressedOfstream : public std::ostream {
+ public:
+  CompressedOfstream() : std::ostream(nullptr) { init(&file_); }
+
+  explicit CompressedOfstream(const std::string &dest)
+      : CompressedOfstream() {
+    Open(dest);
+  }
+
+  ~CompressedOfstream() override { Close(); }
+
+  void Open(const std::string &dest);
+
+  // Flushes and closes the file; returns false if writing or compression
+  // failed.
+  bool Close();
+
+  bool IsOpen() const { return file_.is_open() || codec_.IsOpen(); }
+
+  Compression GetCompression() const { return compression_; }
+
+ private:
+  std::filebuf file_;
+  CodecStreamBuf codec_;
+  Compression compression_ = Compression::NONE;
+};
+
+}  // namespace ngram
+
+#endif  // NGRAM_COMPRESSED_STREAM_H_
@@ -80,6 +80,9 @@ class NGramBayesModelMerge : public NGramMerge<fst::StdArc> {
     }
   }
 
+  // StateAlpha() caches values lazily, so states are merged serially.
+  bool ConcurrentMergeWeights() const override { return false; }
+
  private:
   // normalized state weight to scale model ngram1
   double StateAlpha(StateId st) const {
@@ -18,6 +18,8 @@
 #ifndef NGRAM_NGRAM_CONTEXT_MERGE_H_
 #define NGRAM_NGRAM_CONTEXT_MERGE_H_
 
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include <ngram/ngram-context.h>
@@ -49,6 +51,7 @@ class NGramContextMerge : public NGramMerge<fst::StdArc> {
                         const std::string &context_pattern, bool norm = false) {
     context_ =
         std::make_unique<NGramExtendedContext>(context_pattern, HiOrder());
+    state_contexts_once_ = std::make_unique<std::once_flag>();
     if (!NGramMerge<fst::StdArc>::MergeNGramModels(infst2, norm)) {
       NGRAMERROR() << "Context merge failed";
       NGramModel<fst::StdArc>::SetError();
@@ -66,6 +69,7 @@ class NGramContextMerge : public NGramMerge<fst::StdArc> {
                         bool norm = false) {
     context_ = std::make_unique<NGramExtendedContext>(context_begin,
                                                        context_end, HiOrder());
+    state_contexts_once_ = std::make_unique<std::once_flag>();
     if (!NGramMerge<fst::StdArc>::MergeNGramModels(infst2, norm)) {
       NGRAMERROR() << "Context merge failed";
       NGramModel<fst::StdArc>::SetError();
@@ -78,8 +82,12 @@ class NGramContextMerge : public NGramMerge<fst::StdArc> {
                       bool in_fst1, bool in_fst2) const override {
     if (in_fst1 && in_fst2) {
       // Takes weight from w2 if in both and ngram is strictly in context.
-      const std::vector<Label> &ngram = NGram2().StateNGram(s2);
-      return context_->HasContext(ngram, false) ? w2.Value() : w1.Value();
+      // Weights may be merged concurrently, so the first call computes
+      // the membership of all states while the others wait.
+      std::call_once(*state_contexts_once_, [this]() {
+        state_contexts_ = NGramStateContexts(NGram2(), *context_, false);
+      });
+      return state_contexts_.HasContext(s2) ? w2.Value() : w1.Value();
     } else if (in_fst1) {
       return w1.Value();
     } else {
@@ -97,6 +105,10 @@ class NGramContextMerge : public NGramMerge<fst::StdArc> {
 
  private:
   std::unique_ptr<NGramExtendedContext> context_;
+  // Strict context membership of the states of the second model, computed
+  // on first use.
+  mutable NGramStateContexts state_contexts_;
+  std::unique_ptr<std::once_flag> state_contexts_once_;
 };
 
 }  // namespace ngram
@@ -46,7 +46,8 @@ class NGramContextPrune : public NGramShrink<fst::StdArc> {
       // shrink_opt must be less than 2 for context pruning
       : NGramShrink<fst::StdArc>(infst, shrink_opt < 2 ? shrink_opt : 0,
                                      tot_uni, backoff_label, norm_eps, true),
-        context_(context_pattern, HiOrder()) {}
+        context_(context_pattern, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   // Constructs an NGramShrink object, including an NGramModel and
   // parameters.  This version is given begin and end context
@@ -62,7 +63,8 @@ class NGramContextPrune : public NGramShrink<fst::StdArc> {
       // shrink_opt must be less than 2 for context pruning
       : NGramShrink(infst, shrink_opt < 2 ? shrink_opt : 0, tot_uni,
                     backoff_label, norm_eps, true),
-        context_(context_begin, context_end, HiOrder()) {}
+        context_(context_begin, context_end, HiOrder()),
+        state_contexts_(*this, context_, true) {}
   ~NGramContextPrune() override {}
 
   // Shrinks n-gram model, based on initialized parameters
@@ -77,12 +79,12 @@ class NGramContextPrune : public NGramShrink<fst::StdArc> {
 
   double ShrinkScore(const ShrinkStateStats &state,
                      const ShrinkArcStats &arc) const override {
-    const std::vector<Label> &ngram = StateNGram(state.state);
-    return context_.HasContext(ngram) ? 1.0 : -1.0;
+    return state_contexts_.HasContext(state.state) ? 1.0 : -1.0;
   }
 
  private:
   NGramContext context_;  // context specification
+  NGramStateContexts state_contexts_;  // context membership of the states
 };
 
 // Joint context-restricting and count pruning.
@@ -97,7 +99,8 @@ class NGramContextCountPrune : public NGramCountPrune {
       // shrink_opt must be less than 2 for context pruning
       : NGramCountPrune(infst, count_pattern, shrink_opt < 2 ? shrink_opt : 0,
                         tot_uni, backoff_label, norm_eps, true),
-        context_(context_pattern, HiOrder()) {}
+        context_(context_pattern, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   NGramContextCountPrune(fst::StdMutableFst *infst,
                          const std::vector<double> &count_minimums,
@@ -109,7 +112,8 @@ class NGramContextCountPrune : public NGramCountPrune {
       // shrink_opt must be less than 2 for context pruning
       : NGramCountPrune(infst, count_minimums, shrink_opt < 2 ? shrink_opt : 0,
                         tot_uni, backoff_label, norm_eps, true),
-        context_(context_begin, context_end, HiOrder()) {}
+        context_(context_begin, context_end, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   ~NGramContextCountPrune() override {}
 
@@ -121,8 +125,7 @@ class NGramContextCountPrune : public NGramCountPrune {
  protected:
   double ShrinkScore(const ShrinkStateStats &state,
                      const ShrinkArcStats &arc) const override {
-    const std::vector<Label> &ngram = StateNGram(state.state);
-    if (context_.HasContext(ngram)) {
+    if (state_contexts_.HasContext(state.state)) {
       return NGramCountPrune::ShrinkScore(state, arc);
     } else {
       return GetTheta(state.state) - 1.0;
@@ -131,6 +134,7 @@ class NGramContextCountPrune : public NGramCountPrune {
 
  private:
   NGramContext context_;  // context specification
+  NGramStateContexts state_contexts_;  // context membership of the states
 
   NGramContextCountPrune(const NGramContextCountPrune &) = delete;
 };
@@ -146,7 +150,8 @@ class NGramContextRelEntropy : public NGramRelEntropy {
       // shrink_opt must be less than 2 for context pruning
       : NGramRelEntropy(infst, theta, shrink_opt < 2 ? shrink_opt : 0, tot_uni,
                         backoff_label, norm_eps, true),
-        context_(context_pattern, HiOrder()) {}
+        context_(context_pattern, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   NGramContextRelEntropy(fst::StdMutableFst *infst, double theta,
                          const std::vector<Label> &context_begin,
@@ -157,7 +162,8 @@ class NGramContextRelEntropy : public NGramRelEntropy {
       // shrink_opt must be less than 2 for context pruning
       : NGramRelEntropy(infst, theta, shrink_opt < 2 ? shrink_opt : 0, tot_uni,
                         backoff_label, norm_eps, true),
-        context_(context_begin, context_end, HiOrder()) {}
+        context_(context_begin, context_end, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   ~NGramContextRelEntropy() override {}
 
@@ -169,8 +175,7 @@ class NGramContextRelEntropy : public NGramRelEntropy {
  protected:
   double ShrinkScore(const ShrinkStateStats &state,
                      const ShrinkArcStats &arc) const override {
-    const std::vector<Label> &ngram = StateNGram(state.state);
-    if (context_.HasContext(ngram)) {
+    if (state_contexts_.HasContext(state.state)) {
       return NGramRelEntropy::ShrinkScore(state, arc);
     } else {
       return GetTheta(state.state) - 1.0;
@@ -179,6 +184,7 @@ class NGramContextRelEntropy : public NGramRelEntropy {
 
  private:
   NGramContext context_;  // context specification
+  NGramStateContexts state_contexts_;  // context membership of the states
 
   NGramContextRelEntropy(const NGramContextRelEntropy &) = delete;
   NGramContextRelEntropy &operator=(const NGramContextRelEntropy &) = delete;
@@ -195,7 +201,8 @@ class NGramContextSeymoreShrink : public NGramSeymoreShrink {
       // shrink_opt must be less than 2 for context pruning
       : NGramSeymoreShrink(infst, theta, shrink_opt < 2 ? shrink_opt : 0,
                            tot_uni, backoff_label, norm_eps, true),
-        context_(context_pattern, HiOrder()) {}
+        context_(context_pattern, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   NGramContextSeymoreShrink(fst::StdMutableFst *infst, double theta,
                             const std::vector<Label> &context_begin,
@@ -206,7 +213,8 @@ class NGramContextSeymoreShrink : public NGramSeymoreShrink {
       // shrink_opt must be less than 2 for context pruning
       : NGramSeymoreShrink(infst, theta, shrink_opt < 2 ? shrink_opt : 0,
                            tot_uni, backoff_label, norm_eps, true),
-        context_(context_begin, context_end, HiOrder()) {}
+        context_(context_begin, context_end, HiOrder()),
+        state_contexts_(*this, context_, true) {}
 
   ~NGramContextSeymoreShrink() override {}
 
@@ -218,8 +226,7 @@ class NGramContextSeymoreShrink : public NGramSeymoreShrink {
  protected:
   double ShrinkScore(const ShrinkStateStats &state,
                      const ShrinkArcStats &arc) const override {
-    const std::vector<Label> &ngram = StateNGram(state.state);
-    if (context_.HasContext(ngram)) {
+    if (state_contexts_.HasContext(state.state)) {
       return NGramSeymoreShrink::ShrinkScore(state, arc);
     } else {
       return GetTheta(state.state) - 1.0;
@@ -228,6 +235,7 @@ class NGramContextSeymoreShrink : public NGramSeymoreShrink {
 
  private:
   NGramContext context_;  // context specification
+  NGramStateContexts state_contexts_;  // context membership of the states
 
   NGramContextSeymoreShrink(const NGramContextSeymoreShrink &) = delete;
   NGramContextSeymoreShrink
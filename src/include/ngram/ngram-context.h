@@ -19,13 +19,16 @@
 #define NGRAM_NGRAM_CONTEXT_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <fst/fst.h>
 #include <ngram/ngram-model.h>
+#include <ngram/util.h>
 #include <unordered_map>
 
 namespace ngram {
@@ -132,6 +135,53 @@ class NGramContext {
       std::vector<std::vector<typename Arc::Label>> *end_contexts,
       float bigram_thresh = 1.1);
 
+  // Given a n-gram model, returns at most 'ncontexts' contexts that minimize
+  // the largest number of arcs of the states strictly in a context. Contexts
+  // split at unigram or bigram state suffixes, as with FindContexts(). If
+  // requested, returns the number of arcs in each context. The model must
+  // have state n-grams enabled.
+  template <class Arc>
+  static void FindBalancedContexts(const NGramModel<Arc> &model, int ncontexts,
+                                   std::vector<std::string> *contexts,
+                                   std::vector<size_t> *arc_counts = nullptr) {
+    std::vector<std::vector<typename Arc::Label>> begin_contexts;
+    std::vector<std::vector<typename Arc::Label>> end_contexts;
+    FindBalancedContexts(model, ncontexts, &begin_contexts, &end_contexts,
+                         arc_counts);
+    for (int i = 0; i < begin_contexts.size(); ++i)
+      contexts->push_back(GetContextString(begin_contexts[i], end_contexts[i]));
+  }
+
+  template <class Arc>
+  static void FindBalancedContexts(
+      const NGramModel<Arc> &model, int ncontexts,
+      std::vector<std::vector<typename Arc::Label>> *begin_contexts,
+      std::vector<std::vector<typename Arc::Label>> *end_contexts,
+      std::vector<size_t> *arc_counts = nullptr);
+
+  // Returns the number of arcs of the model states strictly in each context,
+  // other than the unigram state, i.e., the estimated size of the model
+  // split for each context.
+  template <class Arc>
+  static std::vector<size_t> ContextArcCounts(
+      const NGramModel<Arc> &model, const std::vector<std::string> &contexts) {
+    std::vector<NGramContext> ngram_contexts;
+    for (const auto &context : contexts) {
+      ngram_contexts.emplace_back(context, model.HiOrder());
+    }
+    std::vector<size_t> arc_counts(contexts.size(), 0);
+    for (StateId s = 0; s < model.NumStates(); ++s) {
+      const auto &ngram = model.StateNGram(s);
+      if (ngram.empty()) continue;  // The unigram state is in every split.
+      for (size_t i = 0; i < ngram_contexts.size(); ++i) {
+        if (ngram_contexts[i].HasContext(ngram, false)) {
+          arc_counts[i] += model.GetFst().NumArcs(s);
+        }
+      }
+    }
+    return arc_counts;
+  }
+
   // Begin context as could be passed to class constructor
   std::vector<Label> GetContextBegin() const {
     std::vector<Label> ngram(context_begin_);
@@ -281,6 +331,87 @@ class NGramExtendedContext {
   std::vector<NGramContext> contexts_;
 };
 
+// Membership of the states of a model in one or more contexts, computed once
+// so that each query is a bit test rather than a comparison of label
+// vectors. It must be recomputed if the model states change.
+class NGramStateContexts {
+ public:
+  typedef NGramContext::StateId StateId;
+
+  NGramStateContexts() : num_states_(0), num_contexts_(0), num_words_(0) {}
+
+  // Computes the membership of the model states in each context, as given
+  // by NGramContext::HasContext(). The model must have state n-grams
+  // enabled.
+  template <class Arc>
+  NGramStateContexts(const NGramModel<Arc> &model,
+                     const std::vector<const NGramContext *> &contexts,
+                     bool include_all_suffixes, int num_threads = 1) {
+    Init(model, contexts.size(), num_threads,
+         [&](size_t c, const std::vector<NGramContext::Label> &ngram) {
+           return contexts[c]->HasContext(ngram, include_all_suffixes);
+         });
+  }
+
+  // Computes the membership of the model states in a single context.
+  template <class Arc>
+  NGramStateContexts(const NGramModel<Arc> &model, const NGramContext &context,
+                     bool include_all_suffixes, int num_threads = 1)
+      : NGramStateContexts(model, std::vector<const NGramContext *>{&context},
+                           include_all_suffixes, num_threads) {}
+
+  // Computes the membership of the model states in any of the contexts of
+  // an extended context.
+  template <class Arc>
+  NGramStateContexts(const NGramModel<Arc> &model,
+                     const NGramExtendedContext &context,
+                     bool include_all_suffixes, int num_threads = 1) {
+    Init(model, 1, num_threads,
+         [&](size_t c, const std::vector<NGramContext::Label> &ngram) {
+           return context.HasContext(ngram, include_all_suffixes);
+         });
+  }
+
+  // Is the state in the context with the given index?
+  bool HasContext(StateId s, size_t c = 0) const {
+    return (bits_[c * num_words_ + s / 64] >> (s % 64)) & 1;
+  }
+
+  // Number of states whose membership was computed.
+  StateId NumStates() const { return num_states_; }
+
+  size_t NumContexts() const { return num_contexts_; }
+
+ private:
+  // Sets the bits of each context from has_context(c, ngram). The bitmaps
+  // are filled one 64-state word at a time, so threads never share a word.
+  template <class Arc, class HasContextFn>
+  void Init(const NGramModel<Arc> &model, size_t num_contexts,
+            int num_threads, HasContextFn has_context) {
+    num_states_ = model.NumStates();
+    num_contexts_ = num_contexts;
+    num_words_ = (num_states_ + 63) / 64;
+    bits_.assign(num_contexts_ * num_words_, 0);
+    ParallelFor(num_words_, num_threads, [&](size_t w) {
+      const StateId begin = w * 64;
+      const StateId end = std::min<StateId>(num_states_, begin + 64);
+      for (size_t c = 0; c < num_contexts_; ++c) {
+        uint64_t word = 0;
+        for (StateId s = begin; s < end; ++s) {
+          if (has_context(c, model.StateNGram(s)))
+            word |= uint64_t{1} << (s - begin);
+        }
+        bits_[c * num_words_ + w] = word;
+      }
+    });
+  }
+
+  StateId num_states_;
+  size_t num_contexts_;
+  size_t num_words_;            // Bitmap words per context.
+  std::vector<uint64_t> bits_;  // Bitmap of each context, in turn.
+};
+
 // Reads (possibly extended) context specifications form a file into a vector.
 bool NGramReadContexts(const std::string &file,
                        std::vector<std::string> *contexts);
@@ -406,6 +537,96 @@ void NGramContext::FindContexts(
   }
 }
 
+template <class Arc>
+void NGramContext::FindBalancedContexts(
+    const NGramModel<Arc> &model, int ncontexts,
+    std::vector<std::vector<typename Arc::Label>> *begin_contexts,
+    std::vector<std::vector<typename Arc::Label>> *end_contexts,
+    std::vector<size_t> *arc_counts) {
+  using fst::kNoLabel;
+  typedef typename Arc::Label Label;
+  // State n-gram arc counts by (reversed) bigram suffix, where the bigram
+  // state itself has second label kNoLabel.
+  std::map<std::pair<Label, Label>, size_t> suffix_counts;
+  Label max_label = kNoLabel;
+  for (StateId s = 0; s < model.NumStates(); ++s) {
+    for (fst::ArcIterator<fst::Fst<Arc>> aiter(model.GetFst(), s);
+         !aiter.Done(); aiter.Next()) {
+      max_label = std::max(max_label, aiter.Value().ilabel);
+    }
+    const auto &ngram = model.StateNGram(s);
+    Label l1 = !ngram.empty() ? ngram[ngram.size() - 1] : kNoLabel;
+    Label l2 = ngram.size() > 1 ? ngram[ngram.size() - 2] : kNoLabel;
+    if (l1 == kNoLabel) continue;
+    suffix_counts[std::make_pair(l1, l2)] += model.GetFst().NumArcs(s);
+  }
+
+  // Blocks of states between possible context boundaries: before each
+  // unigram suffix, and before each bigram suffix other than the one with
+  // the initial word, which sorts with the unigram suffix.
+  std::vector<std::vector<Label>> block_begins;
+  std::vector<size_t> block_counts;
+  Label last_l1 = kNoLabel;
+  for (const auto &suffix_count : suffix_counts) {
+    const Label l1 = suffix_count.first.first;
+    const Label l2 = suffix_count.first.second;
+    if (l1 != last_l1) {
+      block_begins.push_back({l1});
+      block_counts.push_back(0);
+    } else if (l2 > 0) {
+      block_begins.push_back({l2, l1});
+      block_counts.push_back(0);
+    }
+    block_counts.back() += suffix_count.second;
+    last_l1 = l1;
+  }
+
+  // Finds the least bin capacity that packs the blocks, in order, into at
+  // most 'ncontexts' bins.
+  size_t lo = 0, hi = 0;
+  for (const auto count : block_counts) {
+    lo = std::max(lo, count);
+    hi += count;
+  }
+  auto num_bins = [&block_counts](size_t capacity) {
+    size_t bins = 1, bin_count = 0;
+    for (const auto count : block_counts) {
+      if (bin_count + count > capacity) {
+        ++bins;
+        bin_count = 0;
+      }
+      bin_count += count;
+    }
+    return bins;
+  };
+  ncontexts = std::max(ncontexts, 1);
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (num_bins(mid) <= ncontexts) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  begin_contexts->clear();
+  end_contexts->clear();
+  if (arc_counts) arc_counts->clear();
+  begin_contexts->push_back({0});
+  size_t bin_count = 0;
+  for (size_t i = 0; i < block_counts.size(); ++i) {
+    if (bin_count > 0 && bin_count + block_counts[i] > lo) {
+      end_contexts->push_back(block_begins[i]);
+      begin_contexts->push_back(block_begins[i]);
+      if (arc_counts) arc_counts->push_back(bin_count);
+      bin_count = 0;
+    }
+    bin_count += block_counts[i];
+  }
+  end_contexts->push_back({max_label + 1});
+  if (arc_counts) arc_counts->push_back(bin_count);
+}
+
 }  // namespace ngram
 
 #endif  // NGRAM_NGRAM_CONTEXT_H_
@@ -22,6 +22,8 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <fst/fst.h>
@@ -53,8 +55,18 @@ class NGramInput {
   bool ReadInput(bool ARPA, bool symbols, bool output = true,
                  bool renormalize_arpa = false);
 
+  // Reads an ARPA model from the named file, memory-mapping it rather than
+  // reading it through the input stream. Produces the same model FST as
+  // ReadInput(/*ARPA=*/true, ...).
+  bool ReadMappedARPA(const std::string &source, bool output = true,
+                      bool renormalize_arpa = false);
+
   const fst::MutableFst<Arc> *GetFst() const { return fst_.get(); }
 
+  // Sets the number of threads used to parse mapped ARPA files, to complete
+  // ARPA models and to collect corpus symbols.
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
   // Returns true if input setup is in a bad state.
   bool Error() const { return error_; }
 
@@ -136,6 +148,64 @@ class NGramInput {
       std::vector<int> *orders, int order, std::vector<double> *boweights,
       NGramCounter<fst::LogWeightTpl<double>> *ngram_counter);
 
+  // Adds an ARPA n-gram with the given history state and (neglog) prob to the
+  // counter, returning the state it leads to (if any).
+  StateId AddARPANGram(ssize_t st, Label label, bool stsym, bool endsym,
+                       double nlprob, Counter *ngram_counter);
+
+  // Words of a mapped ARPA file, keyed by their text in the mapping.
+  using LabelMap = std::unordered_map<std::string_view, Label>;
+
+  // Gets the label of an ARPA word from a mapped file, caching it by text;
+  // otherwise as GetNGramLabel() with no duplicates.
+  Label GetMappedNGramLabel(std::string_view word, bool add, bool *stsym,
+                            bool *endsym, LabelMap *labels);
+
+  // Reads the header at the top of a mapped ARPA file, collecting n-gram
+  // orders. Advances 'text' past it.
+  int ReadMappedARPATopHeader(std::string_view *text, std::vector<int> *orders);
+
+  // N-grams of one order parsed from a mapped ARPA file.
+  struct ARPANGrams {
+    std::vector<Label> labels;     // order + 1 labels per n-gram
+    std::vector<std::string_view> words;  // unigram words, labeled serially
+    std::vector<double> probs;     // neglog prob per n-gram
+    std::vector<double> backoffs;  // neglog backoff cost per n-gram
+    std::vector<char> has_backoff;  // whether a backoff cost was given
+  };
+
+  // Parses n-gram 'idx' of the given order from its line; words of higher
+  // orders are labeled from 'labels', setting 'resolved' to false if any is
+  // missing. Returns false if the line is malformed. Safe to call
+  // concurrently for distinct n-grams.
+  static bool ParseMappedARPALine(std::string_view line, int order,
+                                  const LabelMap &labels, size_t idx,
+                                  ARPANGrams *ngrams, bool *resolved);
+
+  // Splits the n-grams of the particular order off a mapped ARPA file,
+  // checking the order header, the number of n-grams and the blank line
+  // following them.
+  bool SplitMappedARPAOrder(std::string_view *text, int order, int count,
+                            std::string_view *body);
+
+  // Reads in n-grams for the particular order from a mapped ARPA file,
+  // parsing ranges of lines concurrently, then adds them to the counter in
+  // file order.
+  void ReadMappedARPAOrder(std::string_view *text,
+                           const std::vector<int> &orders, int order,
+                           std::vector<double> *boweights,
+                           Counter *ngram_counter, LabelMap *labels);
+
+  // Reads in headers and n-grams from a mapped ARPA model text.
+  bool CompileMappedARPAModel(std::string_view text, bool output,
+                              bool renormalize);
+
+  // Builds the model FST from n-grams and backoff weights read from an ARPA
+  // model, and dumps it.
+  bool CompileARPANGrams(Counter *ngram_counter,
+                         std::vector<double> *boweights, bool output,
+                         bool renormalize);
+
   StateId FindNewDest(StateId st);
 
   void SetARPANGramDests();
@@ -143,13 +213,21 @@ class NGramInput {
   // Puts stored backoff weights on backoff arcs.
   void SetARPABackoffWeights(std::vector<double> *boweights);
 
-  double GetLowerOrderProb(StateId st, Label label);
+  // Finds the cost of label at state, following backoff arcs as needed.
+  // Returns false if neither the label nor a backoff arc is found. Does not
+  // set the error, as holes are found concurrently.
+  bool GetLowerOrderProb(StateId st, Label label, double *prob);
 
   // Descends backoff arcs to find backoff final cost and sets it.
   double GetFinalBackoff(StateId st);
 
   void FillARPAHoles();
 
+  // Finds the arcs of the state that are missing from the ARPA model, with
+  // the weights they get by backing off, as (arc position, weight) pairs.
+  // Returns false if some hole has no lower order probability.
+  bool FindARPAHoles(StateId st, std::vector<std::pair<size_t, double>> *holes);
+
   // Reads in headers and n-grams from an ARPA model text file and dumps
   // resulting FST.
   bool CompileARPAModel(bool output, bool renormalize);
@@ -202,6 +280,10 @@ class NGramInput {
   // Converts text corpus to symbol table.
   bool CompileSymbolTable(bool output);
 
+  // Adds the words of the text corpus to the symbol table in order of first
+  // occurrence, deduplicating chunks of the corpus in parallel.
+  void CollectSymbols();
+
   // Writes resulting FST to output stream.
   void DumpFst(bool incl_symbols, bool output);
 
@@ -213,6 +295,7 @@ class NGramInput {
   std::string end_symbol_;
   std::istream &istrm_;
   std::ostream &ostrm_;
+  int num_threads_;
   bool error_;
 };
 
@@ -0,0 +1,282 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Read-only n-gram model stored in a single memory-mapped file. The file
+// holds the per-state orders and backoff arcs that NGramModel::InitModel
+// computes, followed by the model as an aligned ConstFst. Everything is
+// mapped rather than copied, so processes serving the same model file share
+// its physical pages and start up without a pass over the model.
+
+#ifndef NGRAM_NGRAM_MAPPED_MODEL_H_
+#define NGRAM_NGRAM_MAPPED_MODEL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fst/const-fst.h>
+#include <fst/fst.h>
+#include <fst/mapped-file.h>
+#include <fst/util.h>
+#include <ngram/ngram-model.h>
+#include <ngram/util.h>
+
+namespace ngram {
+
+template <class Arc>
+class NGramMappedModel {
+ public:
+  using StateId = typename Arc::StateId;
+  using Label = typename Arc::Label;
+  using Weight = typename Arc::Weight;
+
+  // Backoff weights are mapped directly from the file.
+  static_assert(std::is_trivially_copyable<Weight>::value,
+                "NGramMappedModel requires a trivially copyable weight");
+
+  // Writes the model FST and its state orders and backoffs to the named
+  // file. Returns false on error.
+  static bool Write(const NGramModel<Arc> &model, const std::string &dest) {
+    const StateId nstates = model.NumStates();
+    if (nstates <= 0) {
+      NGRAMERROR() << "NGramMappedModel: Empty model";
+      return false;
+    }
+    std::vector<int32_t> orders(nstates);
+    std::vector<StateId> backoffs(nstates);
+    std::vector<Weight> backoff_weights(nstates, Weight::Zero());
+    for (StateId st = 0; st < nstates; ++st) {
+      orders[st] = model.StateOrder(st);
+      backoffs[st] = model.GetBackoff(st, &backoff_weights[st]);
+      if (backoffs[st] < 0) backoff_weights[st] = Weight::Zero();
+    }
+    std::ofstream strm(dest, std::ios_base::out | std::ios_base::binary);
+    if (!strm) {
+      NGRAMERROR() << "NGramMappedModel: Could not open file: " << dest;
+      return false;
+    }
+    fst::WriteType(strm, kMagicNumber);
+    fst::WriteType(strm, kFileVersion);
+    fst::WriteType(strm, Arc::Type());
+    fst::WriteType(strm, static_cast<int64_t>(nstates));
+    fst::WriteType(strm, static_cast<int32_t>(model.HiOrder()));
+    fst::WriteType(strm, static_cast<int64_t>(model.UnigramState()));
+    fst::WriteType(strm, static_cast<int64_t>(model.BackoffLabel()));
+    WriteArray(strm, orders);
+    WriteArray(strm, backoffs);
+    WriteArray(strm, backoff_weights);
+    const fst::ConstFst<Arc> const_fst(model.GetFst());
+    const fst::FstWriteOptions opts(dest, /*write_header=*/true,
+                                    /*write_isymbols=*/true,
+                                    /*write_osymbols=*/true, /*align=*/true);
+    if (!const_fst.Write(strm, opts) || !strm.flush()) {
+      NGRAMERROR() << "NGramMappedModel: Write failed: " << dest;
+      return false;
+    }
+    return true;
+  }
+
+  // Maps the named file written by Write(). Returns nullptr on error.
+  static NGramMappedModel *Read(const std::string &source) {
+    std::ifstream strm(source, std::ios_base::in | std::ios_base::binary);
+    if (!strm) {
+      NGRAMERROR() << "NGramMappedModel: Could not open file: " << source;
+      return nullptr;
+    }
+    int32_t magic_number = 0;
+    int32_t file_version = 0;
+    std::string arc_type;
+    int64_t nstates = 0;
+    int32_t hi_order = 0;
+    int64_t unigram = 0;
+    int64_t backoff_label = 0;
+    fst::ReadType(strm, &magic_number);
+    fst::ReadType(strm, &file_version);
+    if (!strm || magic_number != kMagicNumber) {
+      NGRAMERROR() << "NGramMappedModel: Not a mapped model file: " << source;
+      return nullptr;
+    }
+    if (file_version != kFileVersion) {
+      NGRAMERROR() << "NGramMappedModel: Unsupported file version "
+                   << file_version << ": " << source;
+      return nullptr;
+    }
+    fst::ReadType(strm, &arc_type);
+    fst::ReadType(strm, &nstates);
+    fst::ReadType(strm, &hi_order);
+    fst::ReadType(strm, &unigram);
+    fst::ReadType(strm, &backoff_label);
+    if (!strm || arc_type != Arc::Type() || nstates <= 0) {
+      NGRAMERROR() << "NGramMappedModel: Bad header: " << source;
+      return nullptr;
+    }
+    std::unique_ptr<NGramMappedModel> model(new NGramMappedModel());
+    model->nstates_ = nstates;
+    model->hi_order_ = hi_order;
+    model->unigram_ = unigram;
+    model->backoff_label_ = backoff_label;
+    model->orders_region_.reset(
+        MapArray(strm, source, nstates * sizeof(int32_t)));
+    model->backoffs_region_.reset(
+        MapArray(strm, source, nstates * sizeof(StateId)));
+    model->backoff_weights_region_.reset(
+        MapArray(strm, source, nstates * sizeof(Weight)));
+    if (!model->orders_region_ || !model->backoffs_region_ ||
+        !model->backoff_weights_region_) {
+      NGRAMERROR() << "NGramMappedModel: Could not map state data: "
+                   << source;
+      return nullptr;
+    }
+    model->state_orders_ =
+        static_cast<const int32_t *>(model->orders_region_->data());
+    model->backoffs_ =
+        static_cast<const StateId *>(model->backoffs_region_->data());
+    model->backoff_weights_ =
+        static_cast<const Weight *>(model->backoff_weights_region_->data());
+    fst::FstReadOptions opts(source);
+    opts.mode = fst::FstReadOptions::MAP;
+    model->fst_.reset(fst::ConstFst<Arc>::Read(strm, opts));
+    if (!model->fst_ || model->fst_->NumStates() != nstates) {
+      NGRAMERROR() << "NGramMappedModel: Could not map model FST: " << source;
+      return nullptr;
+    }
+    return model.release();
+  }
+
+  // Model FST, e.g., for constructing an NGramModel over the mapped arcs.
+  const fst::Fst<Arc> &GetFst() const { return *fst_; }
+
+  // Number of states in the LM fst
+  StateId NumStates() const { return nstates_; }
+
+  // Returns highest order
+  int HiOrder() const { return hi_order_; }
+
+  // Returns order of a given state, as NGramModel::StateOrder.
+  int StateOrder(StateId state) const {
+    if (state >= 0 && state < nstates_)
+      return state_orders_[state];
+    else
+      return -1;
+  }
+
+  // Unigram state
+  StateId UnigramState() const { return unigram_; }
+
+  // Label of backoff transitions
+  Label BackoffLabel() const { return backoff_label_; }
+
+  // Returns the backoff state of st, or -1 if none, and provides bocost if
+  // req'd. Constant time.
+  StateId GetBackoff(StateId st, Weight *bocost) const {
+    const StateId backoff = backoffs_[st];
+    if (backoff >= 0 && bocost != nullptr) *bocost = backoff_weights_[st];
+    return backoff;
+  }
+
+  // Mimic a phi matcher: follow backoff arcs until label found or no
+  // backoff. Same as NGramModel::FindNGramInModel.
+  bool FindNGramInModel(StateId *mst, int *order, Label label,
+                        double *cost) const {
+    if (label < 0) return false;
+    StateId currstate = *mst;
+    *cost = 0;
+    *mst = -1;
+    while (*mst < 0) {
+      const Arc *arc = FindArc(currstate, label);
+      if (arc) {  // arc found out of current state
+        *order = state_orders_[currstate];
+        *mst = arc->nextstate;  // assign destination as new model state
+        // add cost to total
+        *cost += NGramModel<Arc>::ScalarValue(arc->weight);
+      } else if (backoffs_[currstate] >= 0) {  // follow backoff arc
+        *cost += NGramModel<Arc>::ScalarValue(backoff_weights_[currstate]);
+        currstate = backoffs_[currstate];
+      } else {
+        return false;  // Found label in symbol list, but not in model
+      }
+    }
+    return true;
+  }
+
+  // Mimic a phi matcher: follow backoff links until final state found. Same
+  // as NGramModel::FinalCostInModel.
+  Weight FinalCostInModel(StateId mst, int *order) const {
+    Weight cost = Weight::One();
+    while (fst_->Final(mst) == Weight::Zero()) {
+      if (backoffs_[mst] < 0) {
+        NGRAMERROR() << "NGramMappedModel: No final cost in model: " << mst;
+        return Weight::Zero();
+      }
+      cost = Times(cost, backoff_weights_[mst]);  // add in backoff cost
+      mst = backoffs_[mst];  // make current state backoff state
+    }
+    *order = state_orders_[mst];
+    return Times(cost, fst_->Final(mst));
+  }
+
+ private:
+  static constexpr int32_t kMagicNumber = 0x4e474d4d;  // "NGMM"
+  static constexpr int32_t kFileVersion = 1;
+
+  NGramMappedModel() = default;
+
+  // Writes the array contents at the next aligned position.
+  template <class T>
+  static void WriteArray(std::ostream &strm, const std::vector<T> &array) {
+    fst::AlignOutput(strm);
+    strm.write(reinterpret_cast<const char *>(array.data()),
+               array.size() * sizeof(T));
+  }
+
+  // Maps size bytes from the next aligned position; nullptr on error.
+  static fst::MappedFile *MapArray(std::istream &strm,
+                                   const std::string &source, size_t size) {
+    if (!fst::AlignInput(strm)) return nullptr;
+    return fst::MappedFile::Map(strm, /*memorymap=*/true, source, size);
+  }
+
+  // Binary search of the (input label sorted) arcs leaving st.
+  const Arc *FindArc(StateId st, Label label) const {
+    fst::ArcIteratorData<Arc> data;
+    fst_->InitArcIterator(st, &data);
+    const Arc *end = data.arcs + data.narcs;
+    const Arc *arc = std::lower_bound(
+        data.arcs, end, label,
+        [](const Arc &value, Label key) { return value.ilabel < key; });
+    return arc != end && arc->ilabel == label ? arc : nullptr;
+  }
+
+  std::unique_ptr<fst::ConstFst<Arc>> fst_;
+  std::unique_ptr<fst::MappedFile> orders_region_;
+  std::unique_ptr<fst::MappedFile> backoffs_region_;
+  std::unique_ptr<fst::MappedFile> backoff_weights_region_;
+  const int32_t *state_orders_ = nullptr;
+  const StateId *backoffs_ = nullptr;
+  const Weight *backoff_weights_ = nullptr;
+  StateId nstates_ = 0;
+  int hi_order_ = 0;
+  StateId unigram_ = -1;
+  Label backoff_label_ = 0;
+};
+
+}  // namespace ngram
+
+#endif  // NGRAM_NGRAM_MAPPED_MODEL_H_
@@ -18,6 +18,9 @@
 #ifndef NGRAM_NGRAM_MARGINALIZE_H_
 #define NGRAM_NGRAM_MARGINALIZE_H_
 
+#include <utility>
+#include <vector>
+
 #include <ngram/ngram-mutable-model.h>
 #include <ngram/util.h>
 
@@ -37,12 +40,16 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
             infst, backoff_label, norm_eps,
             /* state_ngrams= */ check_consistency,
             /* infinite_backoff= */ false),
-        max_bo_updates_(max_bo_updates) {
+        max_bo_updates_(max_bo_updates),
+        num_threads_(1) {
     ns_ = infst->NumStates();
-    for (StateId st = 0; st < ns_; ++st)
-      marginal_stats_.push_back(MarginalStateStats());
+    marginal_stats_.resize(ns_);
   }
 
+  // Sets the number of threads used to marginalize the states of each order.
+  // Results do not depend on the number of threads.
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
   // Marginalize n-gram model, based on initialized parameters.  Returns
   // true on success.
   bool MarginalizeNGramModel() {
@@ -68,13 +75,12 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
   }
 
  private:
+  // Per-state statistics; the states backing off to a state and its arc
+  // sums are kept in flat arrays (see below) rather than per-state vectors.
   struct MarginalStateStats {
     double log_prob;         // log probability of history represented by state
     double sum_ho_log_prob;  // log sum prob of hi-order states backing off
     double sum_ho_log_prob_w_bo;  // log sum prob including backoff weights
-    std::vector<StateId> hi_states;    // vector of states backing off to this
-    std::vector<double> arc_found;     // arc sums from states with arc
-    std::vector<double> arc_notfound;  // arc sums from states without arc
 
     MarginalStateStats()
         : log_prob(0),
@@ -88,6 +94,31 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
 
   void DiffProbs(std::vector<double> *weights) const;
 
+  // Number of states backing off to state
+  size_t NumHiStates(StateId st) const {
+    return hi_begin_[st + 1] - hi_begin_[st];
+  }
+
+  // i-th state backing off to state
+  StateId HiState(StateId st, size_t i) const {
+    return hi_states_[hi_begin_[st] + i];
+  }
+
+  // Number of arc sums at state (arcs plus </s>; 0 if not backed off to)
+  size_t NumArcStats(StateId st) const {
+    return arc_begin_[st + 1] - arc_begin_[st];
+  }
+
+  // Arc sum from states with arc; idx = 0 is </s>
+  double &ArcFound(StateId st, size_t idx) {
+    return arc_found_[arc_begin_[st] + idx];
+  }
+
+  // Arc sum from states without arc; idx = 0 is </s>
+  double &ArcNotFound(StateId st, size_t idx) {
+    return arc_notfound_[arc_begin_[st] + idx];
+  }
+
   // Establish re-calculated denominator value (log_prob is minimum)
   double SaneDenominator(double total_wbo, double found_sum, double log_prob) {
     double minval = fmax(-33, log_prob),
@@ -98,20 +129,18 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
 
   // Add value to vector of probabilities of arcs found at higher states
   void AddToArcFound(StateId st, size_t idx, double val) {
-    marginal_stats_[st].arc_found[idx] =
-        -NegLogSum(-marginal_stats_[st].arc_found[idx], val);
+    ArcFound(st, idx) = -NegLogSum(-ArcFound(st, idx), val);
   }
 
   // Add value to vector of probabilities of arcs not found at higher states
   void AddToArcNotFound(StateId st, size_t idx, double val) {
-    marginal_stats_[st].arc_notfound[idx] =
-        -NegLogSum(-marginal_stats_[st].arc_notfound[idx], val);
+    ArcNotFound(st, idx) = -NegLogSum(-ArcNotFound(st, idx), val);
   }
 
   // Subt value from vector of probabilities of arcs not found at higher states
   void SubtFromArcNotFound(StateId st, size_t idx, double val) {
-    marginal_stats_[st].arc_notfound[idx] =
-        SaneDenominator(-marginal_stats_[st].arc_notfound[idx], val,
+    ArcNotFound(st, idx) =
+        SaneDenominator(-ArcNotFound(st, idx), val,
                         marginal_stats_[st].log_prob);
   }
 
@@ -132,11 +161,11 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
   }
 
 
-  // Initialize every arc 'not there' value with total; or reset index to -1
-  void SetArcIndices(StateId st, bool initialize);
+  // Initialize every arc 'not there' value with total
+  void InitArcNotFound(StateId st);
 
-  // Get idx from current state
-  int GetCurrentArcIndex(int label);
+  // Get idx of arc with label from state, or -1 if not found
+  int FindArcIndex(StateId st, Label label) const;
 
   // Function to set accumulators based on whether arc was found or not
   // arc_found accumulates the second term in numerator of formula
@@ -144,8 +173,9 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
   void UpdateAccum(StateId st, StateId bst, size_t idx, size_t hidx,
                    bool update_found, double arcvalue, double bo_weight);
 
-  // Scan through arcs in a state and collect higher order statistics
-  void HigherOrderArcSum(StateId st, bool sum_found);
+  // Scan through arcs in a state and collect higher order statistics;
+  // returns false if a lower order arc is missing
+  bool HigherOrderArcSum(StateId st, bool sum_found);
 
   // Scan through states backing off to state and collect statistics
   void HigherOrderStateSum(StateId st);
@@ -164,25 +194,55 @@ class NGramMarginal : public NGramMutableModel<fst::StdArc> {
   double UpdSaneArcWeights(StateId st, std::vector<double> *wts,
                            std::vector<double> *hold_notfound);
 
-  // Recalculate backoff weights of all higher order states; indicate if changed
-  bool StateHigherOrderBackoffRecalc(StateId st);
+  // Calculate (old, new) backoff weights of all higher order states, without
+  // modifying the model
+  void CalcHigherOrderBackoffs(
+      StateId st, std::vector<std::pair<double, double>> *bo_weights);
 
-  // Recalculate backoff weights of higher order states;
-  // if updated, recalculate arcs based on this.
-  bool HigherOrderBackoffRecalc(StateId st, std::vector<double> *wts,
-                                double *norm);
+  // Assign new backoff weights of all higher order states
+  void SetHigherOrderBackoffs(
+      StateId st, const std::vector<std::pair<double, double>> &bo_weights);
 
-  // Calculate new weights enforcing marginalization constraints
-  // P(w, h') - sum_of_found gamma(w | h) p(h) / sum_of_not alpha_h p(h)
-  void CalculateNewStateWeights(StateId st);
+  // Given recalculated backoff weights of higher order states,
+  // if updated, recalculate arcs based on this. Sets 'failed' rather than
+  // the model error, as states are recalculated concurrently.
+  bool HigherOrderBackoffRecalc(
+      StateId st, const std::vector<std::pair<double, double>> &bo_weights,
+      std::vector<double> *wts, double *norm, bool *failed);
 
-  // Calculate state weights from highest order to lowest order
+  // Reports an error for the first state marked failed; returns false if any
+  bool CheckArcSums(const std::vector<StateId> &states,
+                    const std::vector<char> &failed);
+
+  // Calculate state weights from highest order to lowest order, enforcing
+  // marginalization constraints
+  // P(w, h') - sum_of_found gamma(w | h) p(h) / sum_of_not alpha_h p(h)
+  // States of the same order only depend on their own statistics and those
+  // of the higher order states backing off to them, so are computed in
+  // parallel; the model is only modified between those parallel steps.
   void CalculateNewWeights();
 
+  // Calls fn(i) for each i in [0, size) on num_threads_ threads. fn must not
+  // modify the model, nor set its error; failures are recorded per state.
+  template <class Fn>
+  void ForEachState(size_t size, Fn fn) {
+    // Matchers compute missing FST properties; does so before threading.
+    if (num_threads_ > 1) GetFst().Properties(fst::kILabelSorted, true);
+    ParallelFor(size, num_threads_, fn);
+  }
+
   StateId ns_;
   std::vector<MarginalStateStats> marginal_stats_;
-  std::vector<int> indices_;
+  // States backing off to state st are hi_states_[hi_begin_[st]] up to
+  // hi_states_[hi_begin_[st + 1]], in increasing order.
+  std::vector<size_t> hi_begin_;
+  std::vector<StateId> hi_states_;
+  // Arc sums of state st start at offset arc_begin_[st].
+  std::vector<size_t> arc_begin_;
+  std::vector<double> arc_found_;     // arc sums from states with arc
+  std::vector<double> arc_notfound_;  // arc sums from states without arc
   int max_bo_updates_;
+  int num_threads_;
 };
 
 }  // namespace ngram
@@ -18,10 +18,13 @@
 #ifndef NGRAM_NGRAM_MERGE_H_
 #define NGRAM_NGRAM_MERGE_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <fst/arcsort.h>
 #include <fst/vector-fst.h>
@@ -66,11 +69,16 @@ class NGramMerge : public NGramMutableModel<Arc> {
       : NGramMutableModel<Arc>(infst1, backoff_label, norm_eps,
                                /* state_ngrams= */ check_consistency,
                                /* infinite_backoff= */ false),
-        check_consistency_(check_consistency) {
+        check_consistency_(check_consistency),
+        num_threads_(1) {
     // set switch if inf backoff costs
     NGramMutableModel<Arc>::SetAllowInfiniteBO();
   }
 
+  // Sets the number of threads used to merge the states of each order.
+  // Results do not depend on the number of threads.
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
  protected:
   // Some terminology used in the merge class:
   //  'shared arc': this is an arc that is found in both input FSTs leaving
@@ -135,6 +143,10 @@ class NGramMerge : public NGramMutableModel<Arc> {
   // comes from the first FST, then 'in_fst1' is true.
   virtual bool MergeUnshared(bool in_fst1) const { return true; }
 
+  // Specifies if MergeWeights() may be called concurrently for distinct
+  // states of the same order; if false, merging is single-threaded.
+  virtual bool ConcurrentMergeWeights() const { return true; }
+
   // model to be mixed in into ngram1
   const NGramModel<Arc> &NGram2() const { return *ngram2_; }
 
@@ -364,8 +376,10 @@ class NGramMerge : public NGramMutableModel<Arc> {
       if (Error()) return;
     }
 
-    // Merges arcs from shared and unshared states
-    std::set<Label> shared;  // shared arcs between st and ist
+    // Merges arcs from shared and unshared states. States of the same order
+    // only read their own arcs and those of lower-order states, so each pass
+    // below computes the new arcs of a chunk of states of an order (possibly
+    // in parallel), then applies them serially.
     int order = max_order < 1 || max_order > HiOrder() ? HiOrder() : max_order;
     if (!MaxOrderOkay(order)) {
       NGRAMERROR() << "max order other than the highest order not supported "
@@ -373,76 +387,180 @@ class NGramMerge : public NGramMutableModel<Arc> {
       SetError();
       return;
     }
+    const int num_threads = ConcurrentMergeWeights() ? num_threads_ : 1;
+    if (num_threads > 1) {
+      // Makes sure no matcher computes (and stores) properties concurrently.
+      GetFst().Properties(fst::kILabelSorted, true);
+      ngram2_->GetFst().Properties(fst::kILabelSorted, true);
+    }
+    std::vector<StateId> ists;  // ngram2 states of the current order
+    std::vector<StateId> sts;   // ngram1-only states of the current order
+    std::vector<std::set<Label>> shared;  // shared arcs between st and ist
+    std::set<Label> none;
     for (; order > 0; --order) {
+      ists.clear();
       for (StateId ist = 0; ist < ngram2_ns_; ++ist) {
-        if (ngram2_->StateOrder(ist) == order) {
-          StateId st = exact_map_2to1_[ist];
-          shared.clear();
-          if (st < ngram1_ns_) {                // shared state
-            MergeSharedArcs(st, ist, &shared);  // n-grams in both ngram1,2
-            if (Error()) return;
-            if (merge_unshared1) {
-              MergeUnsharedArcs1(st, ist, shared);  // n-grams just in ngram1
-              if (Error()) return;
-            }
-          }
-          MergeUnsharedArcs2(st, ist, shared);  // n-grams just in ngram2
-          if (Error()) return;
-        }
+        if (ngram2_->StateOrder(ist) == order) ists.push_back(ist);
       }
+      sts.clear();
       if (merge_unshared1) {
-        shared.clear();
         for (StateId st = 0; st < ngram1_ns_; ++st) {
-          if (StateOrder(st) == order && exact_map_1to2_[st] < 0) {
-            MergeUnsharedArcs1(st, -1, shared);
-            if (Error()) return;
-          }
+          if (StateOrder(st) == order && exact_map_1to2_[st] < 0)
+            sts.push_back(st);
         }
       }
+      shared.assign(ists.size(), std::set<Label>());
+      // n-grams in both ngram1,2
+      MergeStates(ists.size(), num_threads, [&](size_t i, MergedState *ms) {
+        StateId st = exact_map_2to1_[ists[i]];
+        if (st >= ngram1_ns_) return false;
+        MergeSharedArcs(st, ists[i], &shared[i], ms);
+        return true;
+      });
+      if (Error()) return;
+      // n-grams just in ngram1
+      if (merge_unshared1) {
+        MergeStates(ists.size(), num_threads,
+                    [&](size_t i, MergedState *ms) {
+                      StateId st = exact_map_2to1_[ists[i]];
+                      if (st >= ngram1_ns_) return false;
+                      MergeUnsharedArcs1(st, ists[i], shared[i], ms);
+                      return true;
+                    });
+        if (Error()) return;
+        MergeStates(sts.size(), num_threads, [&](size_t i, MergedState *ms) {
+          MergeUnsharedArcs1(sts[i], -1, none, ms);
+          return true;
+        });
+        if (Error()) return;
+      }
+      // n-grams just in ngram2
+      MergeStates(ists.size(), num_threads, [&](size_t i, MergedState *ms) {
+        MergeUnsharedArcs2(exact_map_2to1_[ists[i]], ists[i], shared[i], ms);
+        return true;
+      });
+      if (Error()) return;
     }
   }
 
+  // New arcs and final weight of a state being merged, together with the
+  // updates to other states that they imply.
+  struct MergedState {
+    StateId st;
+    std::vector<Arc> arcs;
+    Weight final;
+    // MergeDests1() calls from 'st': label, old and new destination.
+    std::vector<std::pair<Label, std::pair<StateId, StateId>>> dests;
+    // backed_off_to_ entries for 'st': backoff state and label.
+    std::vector<std::pair<StateId, Label>> backed_off;
+    // Set if 'st' has no backoff state to merge unshared arcs from.
+    bool no_backoff = false;
+  };
+
+  // Calls 'merge(i, &merged)' for each i in [0, size) using 'num_threads'
+  // threads, and applies the merged states in index order. 'merge' returns
+  // false if there is nothing to update. States are merged and applied in
+  // chunks, so that only the arcs of a chunk are copied at a time; applying
+  // a state only changes it and higher order states, so this is the same as
+  // applying each state as it is merged. Workers don't call SetError(), but
+  // record errors in their MergedState, which are reported after the join.
+  template <class MergeFn>
+  void MergeStates(size_t size, int num_threads, MergeFn merge) {
+    const size_t chunk_size = num_threads < 2 ? 1 : 1024 * num_threads;
+    std::vector<MergedState> merged(std::min(size, chunk_size));
+    for (size_t begin = 0; begin < size; begin += chunk_size) {
+      const size_t end = std::min(size, begin + chunk_size);
+      ParallelFor(end - begin, num_threads, [&](size_t i) {
+        merged[i].no_backoff = false;
+        if (!merge(begin + i, &merged[i])) merged[i].st = fst::kNoStateId;
+      });
+      for (size_t i = 0; i < end - begin; ++i) {
+        if (merged[i].no_backoff) {
+          NGRAMERROR() << "MergeBackoffDest: no backoff state for state: "
+                       << merged[i].st;
+          SetError();
+          return;
+        }
+        if (merged[i].st != fst::kNoStateId) ApplyMergedState(merged[i]);
+        if (Error()) return;
+      }
+    }
+  }
+
+  // Initializes 'merged' with the current arcs and final weight of 'st'.
+  void InitMergedState(StateId st, MergedState *merged) {
+    merged->st = st;
+    merged->arcs.clear();
+    for (fst::ArcIterator<fst::Fst<Arc>> aiter(GetFst(), st); !aiter.Done();
+         aiter.Next()) {
+      merged->arcs.push_back(aiter.Value());
+    }
+    merged->final = GetFst().Final(st);
+    merged->dests.clear();
+    merged->backed_off.clear();
+  }
+
+  // Replaces the arcs and final weight of the merged state and updates the
+  // states backing off to it.
+  void ApplyMergedState(const MergedState &merged) {
+    StateId st = merged.st;
+    if (GetFst().NumArcs(st) == merged.arcs.size()) {
+      size_t a = 0;
+      for (fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(
+               GetMutableFst(), st);
+           !aiter.Done(); aiter.Next()) {
+        aiter.SetValue(merged.arcs[a++]);
+      }
+    } else {
+      GetMutableFst()->DeleteArcs(st);
+      GetMutableFst()->ReserveArcs(st, merged.arcs.size());
+      for (const Arc &arc : merged.arcs) GetMutableFst()->AddArc(st, arc);
+    }
+    GetMutableFst()->SetFinal(st, merged.final);
+    for (const auto &dest : merged.dests) {
+      MergeDests1(st, dest.first, dest.second.first, dest.second.second);
+      if (Error()) return;
+    }
+    for (const auto &pr : merged.backed_off)
+      backed_off_to_.insert(std::make_pair(pr, st));
+  }
+
   // For n-gram arcs shared in common, combines weight,
   // sets correct destination
-  void MergeSharedArcs(StateId st, StateId ist,
-                       std::set<Label> *shared) {
-    fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(GetMutableFst(),
-                                                                st);
-    if (!aiter.Done()) {
-      Arc arc = aiter.Value();
-      for (fst::ArcIterator<fst::Fst<Arc>> biter(ngram2_->GetFst(),
-                                                         ist);
-           !biter.Done(); biter.Next()) {
-        const Arc &barc = biter.Value();
-        // Can't use matcher for Mutable fst (full copy made), use iterator
-        if (FindMutableArc(&aiter, barc.ilabel)) {  // found in ngram1
-          arc = aiter.Value();
-          if (barc.ilabel != BackoffLabel() &&
-              StateOrder(arc.nextstate) < ngram2_->StateOrder(barc.nextstate)) {
-            // needs new destination
-            if (!MergeUnshared(true)) {
-              MergeDests1(st, arc.ilabel, arc.nextstate,
-                          exact_map_2to1_[barc.nextstate]);
-              if (Error()) return;
-            }
-            arc.nextstate = exact_map_2to1_[barc.nextstate];
+  void MergeSharedArcs(StateId st, StateId ist, std::set<Label> *shared,
+                       MergedState *merged) {
+    InitMergedState(st, merged);
+    std::vector<Arc> &arcs = merged->arcs;
+    size_t a = 0;
+    for (fst::ArcIterator<fst::Fst<Arc>> biter(ngram2_->GetFst(), ist);
+         !biter.Done() && a < arcs.size(); biter.Next()) {
+      const Arc &barc = biter.Value();
+      while (a < arcs.size() && arcs[a].ilabel < barc.ilabel) ++a;
+      if (a < arcs.size() && arcs[a].ilabel == barc.ilabel) {  // in ngram1
+        Arc &arc = arcs[a];
+        if (barc.ilabel != BackoffLabel() &&
+            StateOrder(arc.nextstate) < ngram2_->StateOrder(barc.nextstate)) {
+          // needs new destination
+          if (!MergeUnshared(true)) {
+            merged->dests.emplace_back(
+                arc.ilabel, std::make_pair(arc.nextstate,
+                                           exact_map_2to1_[barc.nextstate]));
           }
-          shared->insert(arc.ilabel);  // marks word shared
-          arc.weight = MergeWeights(st, ist, arc.ilabel, arc.weight,
-                                    barc.weight, true, true);
-          aiter.SetValue(arc);
+          arc.nextstate = exact_map_2to1_[barc.nextstate];
         }
+        shared->insert(arc.ilabel);  // marks word shared
+        arc.weight = MergeWeights(st, ist, arc.ilabel, arc.weight,
+                                  barc.weight, true, true);
       }
     }
 
     // Superfinal arc
-    Weight final1 = GetFst().Final(st);
+    Weight final1 = merged->final;
     Weight final2 = ngram2_->GetFst().Final(ist);
     if (ScalarValue(final1) != ScalarValue(Weight::Zero()) &&
         ScalarValue(final2) != ScalarValue(Weight::Zero())) {
-      Weight merge_final =
+      merged->final =
           MergeWeights(st, ist, fst::kNoLabel, final1, final2, true, true);
-      GetMutableFst()->SetFinal(st, merge_final);
       shared->insert(fst::kNoLabel);  // marks superfinal word shared
     }
   }
@@ -450,42 +568,44 @@ class NGramMerge : public NGramMutableModel<Arc> {
   // Merges n-gram arcs not found in the new model
   // Applies when MergeUnshared(true) is true.
   void MergeUnsharedArcs1(StateId st, StateId ist,
-                          const std::set<Label> &shared) {
+                          const std::set<Label> &shared,
+                          MergedState *merged) {
+    InitMergedState(st, merged);
     StateId bst = backoff_map_1to2_[st];
-    for (fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(
-             GetMutableFst(), st);
-         !aiter.Done(); aiter.Next()) {
-      Arc arc = aiter.Value();
+    for (Arc &arc : merged->arcs) {
       Weight cost = Weight::Zero();
       if (shared.count(arc.ilabel) == 0) {  // not found
         if (arc.ilabel != BackoffLabel()) {
-          StateId dest = MergeBackoffDest(bst, arc.ilabel, true, &cost);
-          if (Error()) return;
+          if (bst < 0) {
+            merged->no_backoff = true;
+            return;
+          }
+          StateId dest = FindBackoffDest(bst, arc.ilabel, true, &cost);
           if (ngram2_->StateOrder(dest) > StateOrder(arc.nextstate))
             arc.nextstate = exact_map_2to1_[dest];  // needs a new destination
         }
         arc.weight =
             MergeWeights(st, bst, arc.ilabel, arc.weight, cost, true, false);
-        aiter.SetValue(arc);
       }
     }
 
     // Superfinal arc
     if (shared.count(fst::kNoLabel) == 0) {  // not found
-      Weight final1 = GetFst().Final(st);
+      Weight final1 = merged->final;
       if (ScalarValue(final1) != ScalarValue(Weight::Zero())) {
         int order;
         Weight cost = ngram2_->FinalCostInModel(bst, &order);
-        Weight merge_final =
+        merged->final =
             MergeWeights(st, bst, fst::kNoLabel, final1, cost, true, false);
-        GetMutableFst()->SetFinal(st, merge_final);
       }
     }
   }
 
   // Merges n-gram arcs not found in the original model
   void MergeUnsharedArcs2(StateId st, StateId ist,
-                          const std::set<Label> &shared) {
+                          const std::set<Label> &shared,
+                          MergedState *merged) {
+    InitMergedState(st, merged);
     StateId bst = backoff_map_2to1_[ist];
     StateId ibo = ngram2_->GetBackoff(ist, nullptr);
     StateId bo = ibo >= 0 ? exact_map_2to1_[ibo] : -1;
@@ -498,33 +618,37 @@ class NGramMerge : public NGramMutableModel<Arc> {
         Arc arc = barc;
         arc.nextstate = exact_map_2to1_[barc.nextstate];
         if (barc.ilabel != BackoffLabel()) {
-          StateId dest = MergeBackoffDest(bst, barc.ilabel, false, &cost);
-          if (Error()) return;
+          if (bst < 0) {
+            merged->no_backoff = true;
+            return;
+          }
+          StateId dest = FindBackoffDest(bst, barc.ilabel, false, &cost);
           if (StateOrder(dest) > ngram2_->StateOrder(barc.nextstate))
             arc.nextstate = dest;  // needs a new destination state
           if (!MergeUnshared(true) && bo >= 0 &&
               StateOrder(st) > StateOrder(arc.nextstate)) {
-            std::pair<StateId, Label> pr(bo, arc.ilabel);
-            backed_off_to_.insert(std::make_pair(pr, st));
+            merged->backed_off.emplace_back(bo, arc.ilabel);
           }
         }
         arc.weight =
             MergeWeights(bst, ist, arc.ilabel, cost, arc.weight, false, true);
-        GetMutableFst()->AddArc(st, arc);
+        merged->arcs.push_back(arc);
         arcsort = true;
       }
     }
 
-    if (arcsort) SortArcs(st);
+    if (arcsort) {
+      std::sort(merged->arcs.begin(), merged->arcs.end(),
+                fst::ILabelCompare<Arc>());
+    }
 
     if (shared.count(fst::kNoLabel) == 0) {  // not found
       Weight final2 = ngram2_->GetFst().Final(ist);
       if (ScalarValue(final2) != ScalarValue(Weight::Zero())) {
         int order;
         Weight cost = FinalCostInModel(bst, &order);
-        Weight merge_final = MergeWeights(bst, ist, fst::kNoLabel, cost,
-                                          final2, false, true);
-        GetMutableFst()->SetFinal(st, merge_final);
+        merged->final = MergeWeights(bst, ist, fst::kNoLabel, cost,
+                                     final2, false, true);
       }
     }
   }
@@ -573,13 +697,20 @@ class NGramMerge : public NGramMutableModel<Arc> {
   // Finds the destination state with label
   // from a backed-off model (assign cost)
   StateId MergeBackoffDest(StateId st, Label label, bool from1, Weight *cost) {
-    // ngram1 or ngram2
-    const NGramModel<Arc> *ngram = from1 ? ngram2_.get() : this;
     if (st < 0) {
       NGRAMERROR() << "MergeBackoffDest: bad state: " << st;
       SetError();
       return st;
     }
+    return FindBackoffDest(st, label, from1, cost);
+  }
+
+  // Same as above for a valid state 'st', without touching the error state,
+  // so that it may be called concurrently.
+  StateId FindBackoffDest(StateId st, Label label, bool from1,
+                          Weight *cost) const {
+    // ngram1 or ngram2
+    const NGramModel<Arc> *ngram = from1 ? ngram2_.get() : this;
     if (cost) *cost = Arc::Weight::One();
     fst::Matcher<fst::Fst<Arc>> matcher(ngram->GetFst(),
                                                 fst::MATCH_INPUT);
@@ -664,6 +795,7 @@ class NGramMerge : public NGramMutableModel<Arc> {
   // NB: ngram1 is *this
   std::unique_ptr<const NGramModel<Arc>> ngram2_;  // model to mix into ngram1
   bool check_consistency_;
+  int num_threads_;  // threads used to merge states of the same order
   // Maps from a state to its exact same context in the other model
   // These include states that have been added to NGram1.
   std::vector<StateId>
@@ -18,9 +18,14 @@
 #ifndef NGRAM_NGRAM_MODEL_H_
 #define NGRAM_NGRAM_MODEL_H_
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <deque>
+#include <fstream>
+#include <string>
 #include <vector>
 
 #include <fst/flags.h>
@@ -28,6 +33,7 @@
 #include <fst/compose.h>
 #include <fst/fst.h>
 #include <fst/matcher.h>
+#include <fst/util.h>
 #include <fst/vector-fst.h>
 #include <ngram/hist-arc.h>
 #include <ngram/util.h>
@@ -105,6 +111,20 @@ class NGramModel {
     InitModel();
   }
 
+  // Same as above, but first tries to adopt the state metadata written by
+  // WriteMetadata() to the file 'metadata_source' (if non-empty) rather than
+  // recomputing it. For callers that explicitly opt in to a sidecar file.
+  NGramModel(const fst::Fst<Arc> &infst, Label backoff_label,
+             double norm_eps, bool state_ngrams,
+             const std::string &metadata_source)
+      : fst_(infst),
+        backoff_label_(backoff_label),
+        norm_eps_(norm_eps),
+        have_state_ngrams_(state_ngrams),
+        error_(false) {
+    InitModel(metadata_source);
+  }
+
   // Same as above, but requires the FST and the backoff label.
   NGramModel(const fst::Fst<Arc> &infst, Label backoff_label)
       : fst_(infst),
@@ -304,7 +324,13 @@ class NGramModel {
 
   // Called at construction. If the model topology is mutated, this should
   // be re-called prior to any member function that depends on it.
-  void InitModel() {
+  void InitModel() { InitModel(std::string()); }
+
+  // Same as above, but if 'metadata_source' is non-empty, first tries to
+  // adopt the state metadata written there by WriteMetadata() instead of
+  // recomputing it and rechecking the topology. Metadata written for a
+  // different model is ignored with a warning.
+  void InitModel(const std::string &metadata_source) {
     using fst::kAcceptor;
     using fst::kIDeterministic;
     using fst::kILabelSorted;
@@ -342,6 +368,7 @@ class NGramModel {
     }
 
     nstates_ = CountStates(fst_);
+    if (!metadata_source.empty() && ReadMetadata(metadata_source)) return;
     unigram_ = GetBackoff(fst_.Start(), nullptr);  // set the unigram state
     ComputeStateOrders();
     if (!CheckTopology()) {
@@ -351,6 +378,37 @@ class NGramModel {
     }
   }
 
+  // Writes the state metadata computed by InitModel(), i.e., the unigram
+  // state and the state orders, to a sidecar file that InitModel() can adopt
+  // for this model. The state n-grams, which are far larger, are only
+  // written if 'state_ngrams' is true and the model has them. Returns false
+  // on error.
+  bool WriteMetadata(const std::string &dest, bool state_ngrams = false) const {
+    if (Error()) return false;
+    std::ofstream strm(dest, std::ios_base::out | std::ios_base::binary);
+    if (!strm) {
+      NGRAMERROR() << "NGramModel: Could not open metadata file: " << dest;
+      return false;
+    }
+    fst::WriteType(strm, kMetadataMagicNumber);
+    fst::WriteType(strm, kMetadataVersion);
+    fst::WriteType(strm, static_cast<int64_t>(nstates_));
+    fst::WriteType(strm, static_cast<int64_t>(fst_.Start()));
+    fst::WriteType(strm, static_cast<int64_t>(backoff_label_));
+    fst::WriteType(strm, TopologyFingerprint());
+    fst::WriteType(strm, static_cast<int64_t>(unigram_));
+    fst::WriteType(strm, static_cast<int32_t>(hi_order_));
+    fst::WriteType(strm, state_orders_);
+    const bool write_ngrams = state_ngrams && have_state_ngrams_;
+    fst::WriteType(strm, write_ngrams);
+    if (write_ngrams) fst::WriteType(strm, state_ngrams_);
+    if (!strm.flush()) {
+      NGRAMERROR() << "NGramModel: Could not write metadata file: " << dest;
+      return false;
+    }
+    return true;
+  }
+
   // Accessor function for the norm_eps_ parameter
   double NormEps() const { return norm_eps_; }
 
@@ -475,6 +533,44 @@ class NGramModel {
     if (unigram_state) unigram_ = nstates_;
   }
 
+  // Removes the data computed by InitModel for states that have been deleted
+  // from the FST, where 'deleted' flags the removed states and the remaining
+  // states have kept their relative order (as with MutableFst::DeleteStates).
+  // This avoids recomputing the state orders and n-grams from scratch when
+  // states have only been removed, e.g., after pruning. The topology is
+  // re-checked only if state n-grams are kept (i.e., consistency checking).
+  void DeleteStateInfo(const std::vector<bool> &deleted) {
+    StateId unigram = fst::kNoStateId;
+    StateId nstates = 0;
+    hi_order_ = 1;
+    for (StateId st = 0; st < nstates_; ++st) {
+      if (static_cast<size_t>(st) < deleted.size() && deleted[st]) continue;
+      if (st == unigram_) unigram = nstates;
+      state_orders_[nstates] = state_orders_[st];
+      if (state_orders_[st] > hi_order_) hi_order_ = state_orders_[st];
+      if (have_state_ngrams_) state_ngrams_[nstates].swap(state_ngrams_[st]);
+      ++nstates;
+    }
+    if (unigram_ != fst::kNoStateId && unigram == fst::kNoStateId) {
+      NGRAMERROR() << "NGramModel::DeleteStateInfo: unigram state deleted";
+      SetError();
+      return;
+    }
+    unigram_ = unigram;
+    nstates_ = nstates;
+    state_orders_.resize(nstates_);
+    if (have_state_ngrams_) {
+      state_ngrams_.resize(nstates_);
+      // State n-grams are kept under consistency checking, and only then is
+      // the topology re-checked: a matcher lookup per arc would cost as much
+      // as the InitModel() this replaces.
+      if (!CheckTopology()) {
+        NGRAMERROR() << "NGramModel: bad ngram model topology";
+        SetError();
+      }
+    }
+  }
+
   // Returns a scalar value associated with a weight
   static double ScalarValue(Weight w);
 
@@ -738,6 +834,100 @@ class NGramModel {
     return NegLogDiff(0.0, low_sum);
   }
 
+  static constexpr int32_t kMetadataMagicNumber = 0x4e474d44;  // "NGMD"
+  static constexpr int32_t kMetadataVersion = 2;
+  static constexpr StateId kMetadataSampleStates = 1024;
+
+  // Fingerprint of the model topology identifying the model a metadata file
+  // was written for: hashes the total number of arcs and the finality, label
+  // and destination of the arcs of about kMetadataSampleStates states evenly
+  // spread over the model. Only the sampled states' arcs are read, so this
+  // is much cheaper than recomputing the metadata; it catches models of
+  // another shape or labeling, not arbitrary edits of a few arcs.
+  uint64_t TopologyFingerprint() const {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a over 64-bit values
+    auto add = [&hash](uint64_t value) {
+      hash = (hash ^ value) * 1099511628211ULL;
+    };
+    uint64_t narcs = 0;
+    for (StateId st = 0; st < nstates_; ++st) narcs += fst_.NumArcs(st);
+    add(narcs);
+    const StateId stride =
+        std::max<StateId>(1, nstates_ / kMetadataSampleStates);
+    for (StateId st = 0; st < nstates_; st += stride) {
+      add(fst_.Final(st) != Arc::Weight::Zero());
+      for (fst::ArcIterator<fst::Fst<Arc>> aiter(fst_, st); !aiter.Done();
+           aiter.Next()) {
+        const Arc &arc = aiter.Value();
+        add((static_cast<uint64_t>(static_cast<uint32_t>(arc.ilabel)) << 32) |
+            static_cast<uint32_t>(arc.nextstate));
+      }
+    }
+    return hash;
+  }
+
+  // Adopts the state metadata in the named file written by WriteMetadata()
+  // if it matches the model; otherwise returns false, leaving InitModel() to
+  // recompute it.
+  bool ReadMetadata(const std::string &source) {
+    std::ifstream strm(source, std::ios_base::in | std::ios_base::binary);
+    int32_t magic_number = 0;
+    int32_t version = 0;
+    int64_t nstates = -1;
+    int64_t start = -1;
+    int64_t backoff_label = -1;
+    uint64_t fingerprint = 0;
+    fst::ReadType(strm, &magic_number);
+    fst::ReadType(strm, &version);
+    fst::ReadType(strm, &nstates);
+    fst::ReadType(strm, &start);
+    fst::ReadType(strm, &backoff_label);
+    fst::ReadType(strm, &fingerprint);
+    if (!strm || magic_number != kMetadataMagicNumber ||
+        version != kMetadataVersion) {
+      LOG(WARNING) << "NGramModel: Ignoring unreadable metadata file: "
+                   << source;
+      return false;
+    }
+    if (nstates != nstates_ || start != fst_.Start() ||
+        backoff_label != backoff_label_ ||
+        fingerprint != TopologyFingerprint()) {
+      LOG(WARNING) << "NGramModel: Ignoring metadata file written for "
+                   << "another model: " << source;
+      return false;
+    }
+    int64_t unigram = -1;
+    int32_t hi_order = 0;
+    std::vector<int> state_orders;
+    bool have_state_ngrams = false;
+    std::vector<std::vector<Label>> state_ngrams;
+    fst::ReadType(strm, &unigram);
+    fst::ReadType(strm, &hi_order);
+    fst::ReadType(strm, &state_orders);
+    fst::ReadType(strm, &have_state_ngrams);
+    if (have_state_ngrams_ && have_state_ngrams) {
+      fst::ReadType(strm, &state_ngrams);
+    }
+    if (strm && have_state_ngrams_ && !have_state_ngrams) {
+      VLOG(1) << "NGramModel: Metadata file has no state n-grams: " << source;
+      return false;
+    }
+    if (!strm || static_cast<StateId>(state_orders.size()) != nstates_ ||
+        (have_state_ngrams_ &&
+         static_cast<StateId>(state_ngrams.size()) != nstates_) ||
+        unigram != GetBackoff(fst_.Start(), nullptr)) {
+      LOG(WARNING) << "NGramModel: Ignoring incomplete metadata file: "
+                   << source;
+      return false;
+    }
+    unigram_ = unigram;
+    hi_order_ = hi_order;
+    state_orders_.swap(state_orders);
+    state_ngrams_.swap(state_ngrams);
+    VLOG(1) << "NGramModel: Adopted metadata file: " << source;
+    return true;
+  }
+
   // Traverse n-gram fst and record each state's n-gram order, return highest
   void ComputeStateOrders() {
     state_orders_.clear();
@@ -1071,6 +1261,7 @@ class NGramModel {
   // Returns true on convergence.
   bool StationaryStateProbs(std::vector<double> *probs, double alpha,
                             double converge_eps, size_t maxiters) const {
+    const auto start_time = std::chrono::steady_clock::now();
     std::vector<double> init_probs, last_probs;
     // Initialize based on ngram transition probabilities
     NGramStateProbs(&init_probs, true);
@@ -1098,9 +1289,16 @@ class NGramModel {
               << changed;
       if (++iters > maxiters) return false;
     } while (changed > 0);
+    VLOG(1) << "NGramModel::StationaryStateProbs: " << iters
+            << " iterations, " << SecondsSince(start_time) << " sec";
     return true;
   }
 
+  static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start).count();
+  }
+
   const fst::Fst<Arc> &fst_;
   StateId unigram_;                // unigram state
   Label backoff_label_;            // label of backoff transitions
@@ -0,0 +1,672 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// NGram model classes for merging any number of n-gram FSTs in a single pass.
+
+#ifndef NGRAM_NGRAM_MULTI_MERGE_H_
+#define NGRAM_NGRAM_MULTI_MERGE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fst/arcsort.h>
+#include <fst/matcher.h>
+#include <fst/symbol-table.h>
+#include <fst/vector-fst.h>
+#include <ngram/ngram-model.h>
+#include <ngram/ngram-mutable-model.h>
+#include <ngram/util.h>
+
+namespace ngram {
+
+// Merges N n-gram models at once. The union of the state contexts of all
+// models is found by a single traversal of their order-ascending arcs, which
+// yields for every merged state the exact state (if any) and the closest
+// backed-off state in each input. All weights of the merged model are then
+// computed in one pass over the merged states in order of increasing n-gram
+// order, so no intermediate models are built.
+template <class Arc>
+class NGramMultiMerge {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::Weight Weight;
+
+  // Constructs an NGramMultiMerge object consisting of the n-gram models to
+  // be merged. Ownership of the FSTs is retained by the caller, and they must
+  // outlive this object.
+  explicit NGramMultiMerge(const std::vector<const fst::Fst<Arc> *> &fsts,
+                           Label backoff_label = 0, double norm_eps = kNormEps,
+                           bool check_consistency = false)
+      : backoff_label_(backoff_label),
+        norm_eps_(norm_eps),
+        check_consistency_(check_consistency),
+        error_(false) {
+    if (fsts.empty()) {
+      NGRAMERROR() << "NGramMultiMerge: no models to merge";
+      SetError();
+      return;
+    }
+    if (!MergeWordLists(fsts)) return;
+    for (size_t i = 0; i < fsts.size(); ++i) {
+      const fst::Fst<Arc> &infst =
+          relabeled_fsts_[i] ? *relabeled_fsts_[i] : *fsts[i];
+      models_.emplace_back(new NGramModel<Arc>(infst, backoff_label_, norm_eps_,
+                                               check_consistency_));
+      if (models_.back()->Error()) {
+        SetError();
+        return;
+      }
+      matchers_.emplace_back(
+          new fst::Matcher<fst::Fst<Arc>>(infst, fst::MATCH_INPUT));
+    }
+    // By default, weights all models equally.
+    weights_.assign(models_.size(), 0.0);
+  }
+
+  virtual ~NGramMultiMerge() = default;
+
+  // Sets the mixing weights of the models, given as -log values.
+  void SetWeights(const std::vector<double> &weights) {
+    if (weights.size() != models_.size()) {
+      NGRAMERROR() << "NGramMultiMerge: expected " << models_.size()
+                   << " weights, got " << weights.size();
+      SetError();
+      return;
+    }
+    weights_ = weights;
+  }
+
+  // Sets the -log mixing weights that folding the models pairwise from left
+  // to right gives to each model, where each step weights the accumulated
+  // model by 'alpha' and the next model by 'beta'. The merged counts then
+  // match pairwise count merging.
+  void SetPairwiseWeights(double alpha, double beta) {
+    const size_t n = models_.size();
+    std::vector<double> weights(n);
+    // Model i is weighted by beta (if i > 0) and then once by alpha for each
+    // later model.
+    weights[0] = -(n - 1.0) * log(alpha);
+    for (size_t i = 1; i < n; ++i)
+      weights[i] = -log(beta) - (n - 1.0 - i) * log(alpha);
+    SetWeights(weights);
+  }
+
+  // Sets the -log mixing weights of a mixture weighting the first model by
+  // 'alpha' and every other model by 'beta'. For two models, this is the
+  // same as SetPairwiseWeights().
+  void SetMixtureWeights(double alpha, double beta) {
+    std::vector<double> weights(models_.size(), -log(beta));
+    weights[0] = -log(alpha);
+    SetWeights(weights);
+  }
+
+  // Number of models being merged.
+  size_t NumModels() const { return models_.size(); }
+
+  // Writes the merged model to 'ofst', normalizing it and recalculating the
+  // backoff weights if 'norm' is true. Returns false on error.
+  bool MergeNGramModels(fst::MutableFst<Arc> *ofst, bool norm = false) {
+    if (Error()) return false;
+    BuildStateMaps();
+    MergeFsts(ofst, norm);
+    if (Error()) return false;
+    ofst->SetInputSymbols(syms_.get());
+    ofst->SetOutputSymbols(syms_.get());
+    NGramMutableModel<Arc> merged(ofst, backoff_label_, norm_eps_,
+                                  check_consistency_);
+    if (merged.Error()) {
+      NGRAMERROR() << "NGramMultiMerge: Merged model is not an n-gram model";
+      SetError();
+      return false;
+    }
+    if (norm) {
+      merged.SetAllowInfiniteBO();
+      merged.RecalcBackoff();
+      if (merged.Error()) {
+        SetError();
+        return false;
+      }
+      if (!merged.CheckNormalization()) {
+        NGRAMERROR() << "NGramMultiMerge: Merged model not fully normalized";
+        SetError();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns true if the merge is in a bad state.
+  bool Error() const { return error_; }
+
+ protected:
+  void SetError() { error_ = true; }
+
+  // Specifies the resultant cost of 'label' (or of the final weight, if
+  // 'label' is kNoLabel) given the cost from each model, where costs are
+  // infinite for models that do not contribute. The default is the weighted
+  // sum of the contributions.
+  virtual double MergeCosts(Label label,
+                            const std::vector<double> &costs) const {
+    double cost = ScalarValue(Weight::Zero());
+    double kahan = 0.0;
+    for (size_t i = 0; i < costs.size(); ++i) {
+      if (costs[i] == ScalarValue(Weight::Zero())) continue;
+      cost = NegLogSum(cost, costs[i] + weights_[i], &kahan);
+    }
+    return cost;
+  }
+
+  // Specifies if n-grams missing from a model contribute the cost found by
+  // backing off in that model, rather than contributing nothing.
+  virtual bool MergeBackedOff() const { return false; }
+
+  // Specifies the -log normalization constant at a merged state, given
+  // whether each model has a state with the exact same context.
+  virtual double NormCost(const std::vector<bool> &in_model) const {
+    double cost = ScalarValue(Weight::Zero());
+    for (size_t i = 0; i < in_model.size(); ++i)
+      if (in_model[i]) cost = NegLogSum(cost, weights_[i]);
+    return cost;
+  }
+
+  // Returns the -log mixing weight of model 'i'.
+  double ModelWeight(size_t i) const { return weights_[i]; }
+
+  // Returns the model with index 'i'.
+  const NGramModel<Arc> &Model(size_t i) const { return *models_[i]; }
+
+  Label BackoffLabel() const { return backoff_label_; }
+
+  static double ScalarValue(Weight w) {
+    return NGramModel<Arc>::ScalarValue(w);
+  }
+
+ private:
+  // Builds a symbol table covering the words of all models, and relabels
+  // copies of those models whose symbol table does not match it. Returns
+  // false on error.
+  bool MergeWordLists(const std::vector<const fst::Fst<Arc> *> &fsts) {
+    relabeled_fsts_.resize(fsts.size());
+    const fst::SymbolTable *syms0 = fsts[0]->InputSymbols();
+    for (size_t i = 1; i < fsts.size(); ++i) {
+      if ((syms0 == nullptr) != (fsts[i]->InputSymbols() == nullptr)) {
+        NGRAMERROR() << "NGramMultiMerge: only some LMs have symbol tables";
+        SetError();
+        return false;
+      }
+    }
+    if (syms0 == nullptr) return true;  // labels are used as is
+    syms_.reset(syms0->Copy());
+    for (size_t i = 1; i < fsts.size(); ++i) {
+      const fst::SymbolTable *syms = fsts[i]->InputSymbols();
+      if (fst::CompatSymbols(syms_.get(), syms, false)) continue;
+      // Maps labels of model i to labels of the merged symbol table.
+      std::map<int64_t, int64_t> symbol_map;
+      symbol_map[backoff_label_] = backoff_label_;
+      relabeled_fsts_[i].reset(new fst::VectorFst<Arc>(*fsts[i]));
+      fst::VectorFst<Arc> *relabeled = relabeled_fsts_[i].get();
+      for (StateId st = 0; st < relabeled->NumStates(); ++st) {
+        for (fst::MutableArcIterator<fst::VectorFst<Arc>> aiter(relabeled,
+                                                                st);
+             !aiter.Done(); aiter.Next()) {
+          Arc arc = aiter.Value();
+          auto it = symbol_map.find(arc.ilabel);
+          if (it == symbol_map.end()) {
+            it = symbol_map
+                     .insert(std::make_pair(
+                         arc.ilabel, NewWordKey(syms->Find(arc.ilabel),
+                                                arc.ilabel)))
+                     .first;
+          }
+          if (arc.ilabel != it->second) {
+            arc.ilabel = arc.olabel = it->second;
+            aiter.SetValue(arc);
+          }
+        }
+      }
+      fst::ArcSort(relabeled, fst::ILabelCompare<Arc>());
+      relabeled->SetInputSymbols(syms_.get());
+      relabeled->SetOutputSymbols(syms_.get());
+    }
+    return true;
+  }
+
+  // Finds word key if in symbol table, otherwise adds (for merging wordlists)
+  int64_t NewWordKey(const std::string &symbol, int64_t key) {
+    int64_t merged_key = syms_->Find(symbol);
+    if (merged_key < 0) {  // Uses key if free, o.w. next available key.
+      merged_key = syms_->Find(key).empty() ? key : syms_->AvailableKey();
+      syms_->AddSymbol(symbol, merged_key);
+    }
+    return merged_key;
+  }
+
+  // Adds a merged state with the given incoming label, backoff state and
+  // order. The exact states in each model are initialized to none.
+  StateId AddMergedState(Label label, StateId backoff, int order) {
+    StateId st = state_label_.size();
+    state_label_.push_back(label);
+    state_backoff_.push_back(backoff);
+    state_order_.push_back(order);
+    child_begin_.push_back(0);
+    child_end_.push_back(0);
+    exact_.resize(exact_.size() + models_.size(), fst::kNoStateId);
+    return st;
+  }
+
+  StateId &Exact(StateId st, size_t i) {
+    return exact_[st * models_.size() + i];
+  }
+
+  StateId &BackoffMap(StateId st, size_t i) {
+    return backoff_map_[st * models_.size() + i];
+  }
+
+  // Returns the merged state reached by the order-ascending arc with 'label'
+  // from merged state 'st', or kNoStateId if there is none.
+  StateId FindChild(StateId st, Label label) const {
+    auto begin = state_label_.begin() + child_begin_[st];
+    auto end = state_label_.begin() + child_end_[st];
+    auto it = std::lower_bound(begin, end, label);
+    if (it == end || *it != label) return fst::kNoStateId;
+    return it - state_label_.begin();
+  }
+
+  // Returns the merged state for the longest suffix of the context of 'st'
+  // followed by 'label', which must be a proper suffix.
+  StateId FindBackoffChild(StateId st, Label label) const {
+    while (true) {
+      StateId child = FindChild(st, label);
+      if (child != fst::kNoStateId) return child;
+      if (st == kUnigram) return kUnigram;
+      st = state_backoff_[st];
+    }
+  }
+
+  // Traverses the order-ascending arcs of all models at once, creating a
+  // merged state for every state context found in any model. Merged states
+  // are numbered in order of increasing n-gram order, and the children of a
+  // state are numbered contiguously in label order. Also sets for each merged
+  // state and model the exact and closest backed-off states.
+  void BuildStateMaps() {
+    const size_t n = models_.size();
+    state_label_.clear();
+    state_backoff_.clear();
+    state_order_.clear();
+    child_begin_.clear();
+    child_end_.clear();
+    exact_.clear();
+    bool have_unigram = false;
+    AddMergedState(fst::kNoLabel, fst::kNoStateId, 1);  // kUnigram
+    for (size_t i = 0; i < n; ++i) {
+      StateId unigram = models_[i]->UnigramState();
+      if (unigram >= 0) have_unigram = true;
+      Exact(kUnigram, i) =
+          unigram >= 0 ? unigram : models_[i]->GetFst().Start();
+    }
+    start_ = kUnigram;
+    if (have_unigram) {  // start state context is the super-initial word
+      start_ = AddMergedState(0, kUnigram, 2);
+      for (size_t i = 0; i < n; ++i) {
+        if (models_[i]->UnigramState() >= 0)
+          Exact(start_, i) = models_[i]->GetFst().Start();
+      }
+    }
+
+    struct AscendingArc {
+      Label label;
+      size_t model;
+      StateId nextstate;
+      bool operator<(const AscendingArc &other) const {
+        return label < other.label ||
+               (label == other.label && model < other.model);
+      }
+    };
+    std::vector<AscendingArc> ascending;
+    for (StateId st = 0; st < state_label_.size(); ++st) {
+      ascending.clear();
+      for (size_t i = 0; i < n; ++i) {
+        StateId s = Exact(st, i);
+        if (s < 0) continue;
+        const NGramModel<Arc> &model = *models_[i];
+        for (fst::ArcIterator<fst::Fst<Arc>> aiter(model.GetFst(), s);
+             !aiter.Done(); aiter.Next()) {
+          const Arc &arc = aiter.Value();
+          if (arc.ilabel == backoff_label_ ||
+              model.StateOrder(arc.nextstate) <= model.StateOrder(s))
+            continue;
+          ascending.push_back({arc.ilabel, i, arc.nextstate});
+        }
+      }
+      std::sort(ascending.begin(), ascending.end());
+      child_begin_[st] = state_label_.size();
+      for (size_t a = 0; a < ascending.size(); ++a) {
+        const AscendingArc &arc = ascending[a];
+        StateId child;
+        if (a == 0 || arc.label != ascending[a - 1].label) {
+          StateId backoff =
+              st == kUnigram ? kUnigram
+                             : FindBackoffChild(state_backoff_[st], arc.label);
+          child = AddMergedState(arc.label, backoff, state_order_[st] + 1);
+        } else {
+          child = state_label_.size() - 1;
+        }
+        Exact(child, arc.model) = arc.nextstate;
+      }
+      child_end_[st] = state_label_.size();
+    }
+
+    // Backoff states always precede the states backing off to them.
+    backoff_map_.assign(exact_.size(), fst::kNoStateId);
+    for (StateId st = 0; st < state_label_.size(); ++st) {
+      for (size_t i = 0; i < n; ++i) {
+        BackoffMap(st, i) = Exact(st, i) >= 0
+                                ? Exact(st, i)
+                                : BackoffMap(state_backoff_[st], i);
+      }
+    }
+    VLOG(1) << "NGramMultiMerge: " << state_label_.size() << " merged states";
+  }
+
+  // Returns the cost of 'label' (or of the final weight, if 'label' is
+  // kNoLabel) at state 'st' of model 'i', following backoff arcs as needed
+  // if 'backoff' is true. Returns an infinite cost if not found.
+  double ModelCost(size_t i, StateId st, Label label, bool backoff) const {
+    const NGramModel<Arc> &model = *models_[i];
+    fst::Matcher<fst::Fst<Arc>> &matcher = *matchers_[i];
+    double cost = 0.0;
+    while (true) {
+      if (label == fst::kNoLabel) {
+        Weight final_weight = model.GetFst().Final(st);
+        if (final_weight != Weight::Zero())
+          return cost + ScalarValue(final_weight);
+      } else {
+        matcher.SetState(st);
+        if (matcher.Find(label))
+          return cost + ScalarValue(matcher.Value().weight);
+      }
+      if (!backoff) return ScalarValue(Weight::Zero());
+      Weight bocost;
+      st = model.GetBackoff(st, &bocost);
+      if (st < 0) return ScalarValue(Weight::Zero());
+      cost += ScalarValue(bocost);
+    }
+  }
+
+  // Finds the destination of the arc with 'label' leaving an already merged
+  // state 'st' of the output FST.
+  StateId FindMergedDest(const fst::MutableFst<Arc> &ofst, StateId st,
+                         Label label) {
+    fst::ArcIterator<fst::MutableFst<Arc>> aiter(ofst, st);
+    size_t low = 0, high = ofst.NumArcs(st);
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      aiter.Seek(mid);
+      if (aiter.Value().ilabel < label) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    aiter.Seek(low);
+    if (aiter.Done() || aiter.Value().ilabel != label) {
+      NGRAMERROR() << "NGramMultiMerge: lower order arc missing: " << st;
+      SetError();
+      return fst::kNoStateId;
+    }
+    return aiter.Value().nextstate;
+  }
+
+  // Computes the arcs and final weight of every merged state.
+  void MergeFsts(fst::MutableFst<Arc> *ofst, bool norm) {
+    const size_t n = models_.size();
+    const double zero = ScalarValue(Weight::Zero());
+    ofst->DeleteStates();
+    ofst->ReserveStates(state_label_.size());
+    for (StateId st = 0; st < state_label_.size(); ++st) ofst->AddState();
+    ofst->SetStart(start_);
+
+    std::vector<double> costs(n);
+    std::vector<bool> in_model(n);
+    std::vector<Label> labels;
+    std::vector<Arc> arcs;
+    for (StateId st = 0; st < state_label_.size(); ++st) {
+      labels.clear();
+      arcs.clear();
+      bool final = false;
+      for (size_t i = 0; i < n; ++i) {
+        StateId s = Exact(st, i);
+        in_model[i] = s >= 0;
+        if (s < 0) continue;
+        const fst::Fst<Arc> &infst = models_[i]->GetFst();
+        if (infst.Final(s) != Weight::Zero()) final = true;
+        for (fst::ArcIterator<fst::Fst<Arc>> aiter(infst, s); !aiter.Done();
+             aiter.Next()) {
+          if (aiter.Value().ilabel != backoff_label_)
+            labels.push_back(aiter.Value().ilabel);
+        }
+      }
+      std::sort(labels.begin(), labels.end());
+      labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+      if (final) labels.push_back(fst::kNoLabel);
+
+      for (Label label : labels) {
+        for (size_t i = 0; i < n; ++i) {
+          // Without backing off, only n-grams at the exact state count.
+          if (MergeBackedOff()) {
+            costs[i] = ModelCost(i, BackoffMap(st, i), label, true);
+          } else if (Exact(st, i) >= 0) {
+            costs[i] = ModelCost(i, Exact(st, i), label, false);
+          } else {
+            costs[i] = zero;
+          }
+        }
+        Weight weight = MergeCosts(label, costs);
+        if (label == fst::kNoLabel) {
+          ofst->SetFinal(st, weight);
+          continue;
+        }
+        StateId dest = FindChild(st, label);
+        if (dest == fst::kNoStateId) {
+          dest = st == kUnigram
+                     ? kUnigram
+                     : FindMergedDest(*ofst, state_backoff_[st], label);
+          if (Error()) return;
+        }
+        arcs.push_back(Arc(label, label, weight, dest));
+      }
+
+      if (norm) NormState(&arcs, ofst, st, NormCost(in_model));
+
+      if (st != kUnigram) {  // backoff arc
+        for (size_t i = 0; i < n; ++i) {
+          Weight bocost = Weight::Zero();
+          if (Exact(st, i) >= 0) models_[i]->GetBackoff(Exact(st, i), &bocost);
+          costs[i] = ScalarValue(bocost);
+        }
+        arcs.push_back(Arc(backoff_label_, backoff_label_,
+                           MergeCosts(backoff_label_, costs),
+                           state_backoff_[st]));
+      }
+      std::sort(arcs.begin(), arcs.end(), fst::ILabelCompare<Arc>());
+      ofst->ReserveArcs(st, arcs.size());
+      for (const Arc &arc : arcs) ofst->AddArc(st, arc);
+    }
+  }
+
+  // Applies normalization constant to arcs and final cost at state.
+  // If, after application of the normalization constant, the probabilities
+  // sum to greater than 1 (perhaps due to float imprecision) then a second
+  // round of brute force normalization is applied.
+  void NormState(std::vector<Arc> *arcs, fst::MutableFst<Arc> *ofst,
+                 StateId st, double norm) {
+    double kahan_factor = 0;
+    double tot_neg_log_prob = ScalarValue(Weight::Zero());
+    if (ofst->Final(st) != Weight::Zero()) {
+      ofst->SetFinal(st, ScalarValue(ofst->Final(st)) - norm);
+      tot_neg_log_prob = ScalarValue(ofst->Final(st));
+    }
+    for (Arc &arc : *arcs) {
+      arc.weight = ScalarValue(arc.weight) - norm;
+      tot_neg_log_prob =
+          NegLogSum(tot_neg_log_prob, ScalarValue(arc.weight), &kahan_factor);
+    }
+    if (tot_neg_log_prob < 0.0) {
+      // Normalizes directly since total probability mass greater than one.
+      if (ofst->Final(st) != Weight::Zero()) {
+        ofst->SetFinal(st, ScalarValue(ofst->Final(st)) - tot_neg_log_prob);
+      }
+      for (Arc &arc : *arcs)
+        arc.weight = ScalarValue(arc.weight) - tot_neg_log_prob;
+    }
+  }
+
+  static constexpr StateId kUnigram = 0;  // merged unigram state
+
+  Label backoff_label_;
+  double norm_eps_;
+  bool check_consistency_;
+  bool error_;
+  std::unique_ptr<fst::SymbolTable> syms_;  // merged symbol table
+  // Copies of the input FSTs relabeled to the merged symbol table, if needed.
+  std::vector<std::unique_ptr<fst::VectorFst<Arc>>> relabeled_fsts_;
+  std::vector<std::unique_ptr<NGramModel<Arc>>> models_;
+  std::vector<std::unique_ptr<fst::Matcher<fst::Fst<Arc>>>> matchers_;
+  std::vector<double> weights_;  // -log mixing weight of each model
+  StateId start_;                // merged start state
+  // Per merged state: label of incoming ascending arc, backoff state, order
+  // and range of children (merged states reached by ascending arcs).
+  std::vector<Label> state_label_;
+  std::vector<StateId> state_backoff_;
+  std::vector<int> state_order_;
+  std::vector<StateId> child_begin_;
+  std::vector<StateId> child_end_;
+  // Per merged state and model: the state with the exact same context (or
+  // kNoStateId), and the state with the closest backed-off context.
+  std::vector<StateId> exact_;
+  std::vector<StateId> backoff_map_;
+
+  NGramMultiMerge(const NGramMultiMerge &) = delete;
+  NGramMultiMerge &operator=(const NGramMultiMerge &) = delete;
+};
+
+// Merges count models, where n-gram counts are summed (with mixing weights)
+// over the models in which they occur.
+class NGramMultiCountMerge : public NGramMultiMerge<fst::StdArc> {
+ public:
+  typedef fst::StdArc::Label Label;
+
+  // Constructs an NGramMultiCountMerge object consisting of ngram models
+  // to be merged. Ownership of FSTs is retained by the caller.
+  explicit NGramMultiCountMerge(
+      const std::vector<const fst::StdFst *> &fsts, Label backoff_label = 0,
+      double norm_eps = kNormEps, bool check_consistency = false)
+      : NGramMultiMerge(fsts, backoff_label, norm_eps, check_consistency) {}
+
+  using NGramMultiMerge::MergeNGramModels;
+
+  // Performs count-model merger. Without normalization, the mixing weights
+  // are chosen to match pairwise merging from left to right with weights
+  // alpha and beta. With normalization, the counts of the first model are
+  // weighted by alpha and those of every other model by beta, and each state
+  // is normalized once by the weights of all the models having it; pairwise
+  // merging instead normalizes with the weights of its last step, so the two
+  // only agree for two models.
+  void MergeNGramModels(fst::StdMutableFst *ofst, double alpha, double beta,
+                        bool norm = false) {
+    if (norm) {
+      SetMixtureWeights(alpha, beta);
+    } else {
+      SetPairwiseWeights(alpha, beta);
+    }
+    if (!NGramMultiMerge::MergeNGramModels(ofst, norm)) {
+      NGRAMERROR() << "Count merging failed";
+      SetError();
+    }
+  }
+};
+
+// Merges smoothed models, where n-gram probabilities are interpolated
+// (with mixing weights) over all models, backing off in models where they
+// do not occur.
+class NGramMultiModelMerge : public NGramMultiMerge<fst::StdArc> {
+ public:
+  typedef fst::StdArc::Label Label;
+
+  // Constructs an NGramMultiModelMerge object consisting of ngram models
+  // to be merged. Ownership of FSTs is retained by the caller.
+  explicit NGramMultiModelMerge(
+      const std::vector<const fst::StdFst *> &fsts, Label backoff_label = 0,
+      double norm_eps = kNormEps, bool check_consistency = false)
+      : NGramMultiMerge(fsts, backoff_label, norm_eps, check_consistency) {
+    for (size_t i = 0; i < NumModels() && !Error(); ++i) {
+      if (!Model(i).CheckNormalization()) {
+        NGRAMERROR() << "NGramMultiModelMerge: Model " << i + 1
+                     << " must be normalized to use smoothing in merging";
+        SetError();
+      }
+    }
+  }
+
+  using NGramMultiMerge::MergeNGramModels;
+
+  // Performs smooth-model merger, interpolating the first model with weight
+  // alpha and every other model with weight beta. Each n-gram probability is
+  // the mixture of the probabilities of all models, backing off in models
+  // without the n-gram, and with normalization each state is normalized
+  // once by the total weight of all models before the backoff weights are
+  // recalculated. For two models this is pairwise model merging; folding
+  // more models pairwise instead backs off in (and renormalizes) the
+  // intermediate merged models.
+  void MergeNGramModels(fst::StdMutableFst *ofst, double alpha, double beta,
+                        bool norm = false) {
+    if (Error()) return;
+    SetMixtureWeights(alpha, beta);
+    if (!NGramMultiMerge::MergeNGramModels(ofst, norm)) {
+      NGRAMERROR() << "NGramMultiModelMerge: Model merging failed";
+      SetError();
+    }
+  }
+
+ protected:
+  // Interpolates probabilities, but keeps the backoff weight of the first
+  // model having the state.
+  double MergeCosts(Label label,
+                    const std::vector<double> &costs) const override {
+    if (label == BackoffLabel()) {  // don't modify (needed) backoff weights
+      for (size_t i = 0; i < costs.size(); ++i)
+        if (costs[i] != ScalarValue(Weight::Zero())) return costs[i];
+      return ScalarValue(Weight::Zero());
+    }
+    return NGramMultiMerge::MergeCosts(label, costs);
+  }
+
+  bool MergeBackedOff() const override { return true; }
+
+  // All models contribute to every state.
+  double NormCost(const std::vector<bool> &in_model) const override {
+    return NGramMultiMerge::NormCost(std::vector<bool>(in_model.size(), true));
+  }
+};
+
+}  // namespace ngram
+
+#endif  // NGRAM_NGRAM_MULTI_MERGE_H_
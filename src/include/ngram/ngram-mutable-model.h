@@ -19,11 +19,17 @@
 #define NGRAM_NGRAM_MUTABLE_MODEL_H_
 
 #include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <fst/arcsort.h>
+#include <fst/matcher.h>
 #include <fst/mutable-fst.h>
 #include <fst/statesort.h>
+#include <fst/symbol-table.h>
 #include <fst/vector-fst.h>
 #include <ngram/ngram-model.h>
 #include <ngram/util.h>
@@ -52,8 +58,10 @@ class NGramMutableModel : public NGramModel<Arc> {
   // Ownership of the FST is retained by the caller.
   explicit NGramMutableModel(fst::MutableFst<Arc> *infst,
                              Label backoff_label, double norm_eps,
-                             bool state_ngrams, bool infinite_backoff = false)
-      : NGramModel<Arc>(*infst, backoff_label, norm_eps, state_ngrams),
+                             bool state_ngrams, bool infinite_backoff = false,
+                             const std::string &metadata_source = "")
+      : NGramModel<Arc>(*infst, backoff_label, norm_eps, state_ngrams,
+                        metadata_source),
         infinite_backoff_(infinite_backoff),
         mutable_fst_(infst) {}
 
@@ -79,10 +87,35 @@ class NGramMutableModel : public NGramModel<Arc> {
 
   // For given state, recalculates backoff cost, assigns to backoff arc
   void RecalcBackoff(StateId st) {
+    double alpha;
+    if (CalcBackoffCost(st, &alpha)) SetBackoffCost(st, alpha);
+  }
+
+  // For given state, calculates backoff cost from neglog sums of hi and low
+  // order arcs without modifying the model. Returns false if the state has
+  // no backoff arc.
+  bool CalcBackoffCost(StateId st, double *alpha) {
     double hi_neglog_sum, low_neglog_sum;
-    if (CalcBONegLogSums(st, &hi_neglog_sum, &low_neglog_sum,
-                         infinite_backoff_)) {
-      UpdateBackoffCost(st, hi_neglog_sum, low_neglog_sum);
+    if (!CalcBONegLogSums(st, &hi_neglog_sum, &low_neglog_sum,
+                          infinite_backoff_)) {
+      return false;
+    }
+    *alpha =
+        CalculateBackoffCost(hi_neglog_sum, low_neglog_sum, infinite_backoff_);
+    AdjustCompleteStates(st, alpha);
+    return true;
+  }
+
+  // Assigns backoff cost to backoff arc of given state
+  void SetBackoffCost(StateId st, double alpha) {
+    fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(mutable_fst_, st);
+    if (FindMutableArc(&aiter, BackoffLabel())) {
+      Arc arc = aiter.Value();
+      SetScalarValue(&arc.weight, alpha);
+      aiter.SetValue(arc);
+    } else {
+      NGRAMERROR() << "NGramMutableModel: No backoff arc found: " << st;
+      NGramModel<Arc>::SetError();
     }
   }
 
@@ -115,11 +148,129 @@ class NGramMutableModel : public NGramModel<Arc> {
 
   // Sorts states in ngram-context lexicographic order.
   void SortStates() {
-    std::vector<StateId> order(NumStates()), inv_order(NumStates());
+    std::vector<StateId> order(NumStates());
     for (StateId s = 0; s < NumStates(); ++s) order[s] = s;
     std::sort(order.begin(), order.end(), StateCompare(*this));
-    for (StateId s = 0; s < NumStates(); ++s) inv_order[order[s]] = s;
-    StateSort(mutable_fst_, inv_order);
+    SortStates(order);
+  }
+
+  // Sorts states breadth first from the unigram and start states, so that
+  // lower orders precede higher ones and the states reached from a state by
+  // its arcs are adjacent, in the order a scorer reads them.
+  void SortStatesBreadthFirst() { SortStates(BreadthFirstOrder()); }
+
+  // Sorts states by decreasing visit count, e.g., from CountStateVisits() on
+  // sample text, so that frequently scored states are close together. States
+  // with equal counts are in breadth-first order.
+  void SortStatesByVisits(const std::vector<double> &visits) {
+    std::vector<StateId> order = BreadthFirstOrder();
+    std::stable_sort(order.begin(), order.end(),
+                     [&visits](StateId s1, StateId s2) {
+                       return visits[s1] > visits[s2];
+                     });
+    SortStates(order);
+  }
+
+  // Adds one to the visit count of each state read while scoring the string
+  // FST, including the states backed off through. Words not in the model
+  // restart from the unigram state.
+  void CountStateVisits(const fst::Fst<Arc> &string_fst,
+                        std::vector<double> *visits) const {
+    visits->resize(NumStates(), 0.0);
+    StateId unigram = UnigramState();
+    if (unigram < 0) unigram = GetFst().Start();
+    StateId st = GetFst().Start();
+    fst::Matcher<fst::Fst<Arc>> matcher(GetFst(), fst::MATCH_INPUT);
+    for (StateId s = string_fst.Start(); s != fst::kNoStateId;) {
+      ++(*visits)[st];
+      fst::ArcIterator<fst::Fst<Arc>> aiter(string_fst, s);
+      if (aiter.Done()) break;
+      const Label label = aiter.Value().ilabel;
+      s = aiter.Value().nextstate;
+      for (StateId next = st;;) {
+        matcher.SetState(next);
+        if (matcher.Find(label)) {
+          st = matcher.Value().nextstate;
+          break;
+        }
+        next = GetBackoff(next, nullptr);
+        if (next < 0) {
+          st = unigram;
+          break;
+        }
+        ++(*visits)[next];
+      }
+    }
+  }
+
+  // Renumbers words in order of decreasing unigram weight, i.e., probability
+  // in a model or count in a count FST, so frequent words get the smallest
+  // labels; ties keep their original order, followed by words without
+  // unigrams. The set of labels in use and the backoff label are unchanged.
+  // Relabels the arcs, which are then re-sorted, and the symbol tables.
+  // Optionally returns the (old, new) label pairs. InitModel() must be called
+  // before further use of the model.
+  void RelabelByFrequency(
+      std::vector<std::pair<Label, Label>> *pairs = nullptr) {
+    StateId unigram = UnigramState();
+    if (unigram < 0) unigram = GetFst().Start();
+    std::vector<std::pair<double, Label>> words;
+    std::set<Label> in_unigram;
+    for (fst::ArcIterator<fst::Fst<Arc>> aiter(GetFst(), unigram);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel == BackoffLabel()) continue;
+      words.emplace_back(ScalarValue(arc.weight), arc.ilabel);
+      in_unigram.insert(arc.ilabel);
+    }
+    const fst::SymbolTable *syms = GetFst().InputSymbols();
+    if (syms) {
+      for (const auto &item : *syms) {
+        const Label label = item.Label();
+        if (label != BackoffLabel() && in_unigram.count(label) == 0) {
+          words.emplace_back(ScalarValue(Arc::Weight::Zero()), label);
+        }
+      }
+    }
+    std::vector<Label> slots;
+    slots.reserve(words.size());
+    for (const auto &word : words) slots.push_back(word.second);
+    std::sort(slots.begin(), slots.end());
+    std::sort(words.begin(), words.end());  // By cost, then label.
+    std::unordered_map<Label, Label> relabel;
+    for (size_t i = 0; i < words.size(); ++i) {
+      relabel[words[i].second] = slots[i];
+      if (pairs) pairs->emplace_back(words[i].second, slots[i]);
+    }
+    if (pairs) std::sort(pairs->begin(), pairs->end());
+    for (StateId st = 0; st < NumStates(); ++st) {
+      for (fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(mutable_fst_,
+                                                               st);
+           !aiter.Done(); aiter.Next()) {
+        Arc arc = aiter.Value();
+        const auto it = relabel.find(arc.ilabel);
+        if (it == relabel.end()) continue;
+        arc.ilabel = it->second;
+        arc.olabel = it->second;
+        aiter.SetValue(arc);
+      }
+    }
+    fst::ArcSort(mutable_fst_, fst::ILabelCompare<Arc>());
+    if (syms) {
+      std::vector<std::pair<Label, std::string>> symbols;
+      for (const auto &item : *syms) {
+        const auto it = relabel.find(item.Label());
+        symbols.emplace_back(it == relabel.end() ? item.Label() : it->second,
+                             std::string(item.Symbol()));
+      }
+      std::sort(symbols.begin(), symbols.end());
+      fst::SymbolTable relabeled_syms(syms->Name());
+      for (const auto &symbol : symbols) {
+        relabeled_syms.AddSymbol(symbol.second, symbol.first);
+      }
+      mutable_fst_->SetInputSymbols(&relabeled_syms);
+      mutable_fst_->SetOutputSymbols(&relabeled_syms);
+    }
   }
 
   // Set a scalar value of a given weight to a specified value
@@ -142,6 +293,36 @@ class NGramMutableModel : public NGramModel<Arc> {
     return fcost;
   }
 
+  // Renumbers states so that order[i] becomes state i.
+  void SortStates(const std::vector<StateId> &order) {
+    std::vector<StateId> inv_order(NumStates());
+    for (StateId s = 0; s < NumStates(); ++s) inv_order[order[s]] = s;
+    StateSort(mutable_fst_, inv_order);
+  }
+
+  // Returns the states in breadth-first order from the unigram and start
+  // states, followed by any states not reached.
+  std::vector<StateId> BreadthFirstOrder() const {
+    std::vector<StateId> order;
+    order.reserve(NumStates());
+    std::vector<char> queued(NumStates(), false);
+    auto enqueue = [&order, &queued](StateId st) {
+      if (st < 0 || queued[st]) return;
+      queued[st] = true;
+      order.push_back(st);
+    };
+    enqueue(UnigramState());
+    enqueue(GetFst().Start());
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (fst::ArcIterator<fst::Fst<Arc>> aiter(GetFst(), order[i]);
+           !aiter.Done(); aiter.Next()) {
+        enqueue(aiter.Value().nextstate);
+      }
+    }
+    for (StateId st = 0; st < NumStates(); ++st) enqueue(st);
+    return order;
+  }
+
   // Uses iterator in place of matcher for mutable arc iterators,
   // avoids full copy and allows getting Position(). NB: begins
   // search from current position.
@@ -209,25 +390,6 @@ class NGramMutableModel : public NGramModel<Arc> {
   }
 
  private:
-  // Calculate and assign backoff cost from neglog
-  // sums of hi and low order arcs
-  void UpdateBackoffCost(StateId st, double hi_neglog_sum,
-                         double low_neglog_sum) {
-    double alpha =
-        CalculateBackoffCost(hi_neglog_sum, low_neglog_sum, infinite_backoff_);
-    AdjustCompleteStates(st, &alpha);
-    fst::MutableArcIterator<fst::MutableFst<Arc>> aiter(mutable_fst_,
-                                                                st);
-    if (FindMutableArc(&aiter, BackoffLabel())) {
-      Arc arc = aiter.Value();
-      SetScalarValue(&arc.weight, alpha);
-      aiter.SetValue(arc);
-    } else {
-      NGRAMERROR() << "NGramMutableModel: No backoff arc found: " << st;
-      NGramModel<Arc>::SetError();
-    }
-  }
-
   // Sets alpha to kInfBackoff for states with every possible n-gram
   void AdjustCompleteStates(StateId st, double *alpha) {
     int unigram_state = UnigramState();
@@ -21,6 +21,7 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <vector>
 
 #include <fst/compose.h>
 #include <ngram/ngram-context.h>
@@ -43,18 +44,24 @@ class NGramOutput : public NGramMutableModel<fst::StdArc> {
                        std::ostream &ostrm = std::cout, Label backoff_label = 0,
                        bool check_consistency = false,
                        const std::string &context_pattern = "",
-                       bool include_all_suffixes = false)
+                       bool include_all_suffixes = false,
+                       const std::string &metadata_source = "")
       : NGramMutableModel<fst::StdArc>(
             infst, backoff_label, kNormEps,
             /* state_ngrams= */ !context_pattern.empty() || check_consistency,
-            /* infinite_backoff= */ false),
+            /* infinite_backoff= */ false, metadata_source),
         ostrm_(ostrm),
+        num_threads_(1),
         include_all_suffixes_(include_all_suffixes),
         context_(context_pattern, HiOrder()) {
     if (!GetFst().InputSymbols()) {
       NGRAMERROR() << "NGramOutput: no symbol tables provided";
       NGramModel<fst::StdArc>::SetError();
     }
+    if (!context_.NullContext()) {
+      state_contexts_ =
+          NGramStateContexts(*this, context_, include_all_suffixes_);
+    }
   }
 
   enum class ShowBackoff {
@@ -63,6 +70,9 @@ class NGramOutput : public NGramMutableModel<fst::StdArc> {
     NONE,
   };
 
+  // Sets the number of threads used to format n-grams when printing.
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
   // Print the N-gram model: each n-gram is on a line with its weight
   void ShowNGramModel(ShowBackoff showeps, bool neglogs, bool intcnts,
                       bool ARPA) const;
@@ -134,19 +144,75 @@ class NGramOutput : public NGramMutableModel<fst::StdArc> {
     return -neglogcost / log(base);
   }
 
+  // Formats n-grams as text into a buffer, which is written to the output
+  // stream (if any) whenever it gets large. Keeps the words of the current
+  // n-gram history, so that n-grams are built without copying strings.
+  class NGramWriter {
+   public:
+    NGramWriter(const std::vector<std::string> &symbols, std::ostream *ostrm,
+                const std::string &history)
+        : symbols_(symbols), ostrm_(ostrm), history_(history) {}
+
+    ~NGramWriter() { Flush(); }
+
+    // Appends the symbol of the label to the history.
+    void PushWord(Label label);
+
+    // Restores the history to a previous size.
+    void PopWords(size_t size) { history_.resize(size); }
+
+    const std::string &History() const { return history_; }
+
+    void Append(const std::string &str) { buf_ += str; }
+    void Append(char c) { buf_ += c; }
+
+    // Appends a value as the output stream would with precision 7.
+    void AppendValue(double value);
+
+    // Ends the line, writing the buffer out if it is large.
+    void EndLine();
+
+    // Writes the buffer out, if there is an output stream.
+    void Flush();
+
+    // Releases the formatted text (when there is no output stream).
+    std::string *MutableBuffer() { return &buf_; }
+
+   private:
+    const std::vector<std::string> &symbols_;
+    std::ostream *ostrm_;
+    std::string history_;
+    std::string buf_;
+  };
+
+  // Symbol of each label in the model's symbol table
+  std::vector<std::string> SymbolStrings() const;
+
+  // Shows n-grams leaving a root state with 'history' through
+  // show(st, arc_begin, arc_end, show_final, writer): the arcs are split into
+  // ranges formatted concurrently, written out in order. The final n-gram
+  // goes with the first range if 'final_first', else with the last.
+  template <class ShowFn>
+  void ShowRootNGrams(StateId st, const std::string &history, bool final_first,
+                      const std::vector<std::string> &symbols,
+                      ShowFn show) const;
+
   // Print the header portion of the ARPA model format
   void ShowARPAHeader() const;
 
-  // Print n-grams leaving a particular state for the ARPA model format
-  void ShowARPANGrams(fst::StdArc::StateId st, const std::string &str,
-                      int order) const;
+  // Print n-grams of the given order leaving a particular state for the ARPA
+  // model format, following arcs [arc_begin, arc_end) of the state
+  void ShowARPANGrams(StateId st, int order, size_t arc_begin, size_t arc_end,
+                      bool show_final, NGramWriter *writer) const;
 
   // Print the N-gram model in ARPA format
   void ShowARPAModel() const;
 
-  // Print n-grams leaving a particular state, standard output format
-  void ShowNGrams(fst::StdArc::StateId st, const std::string &str,
-                  ShowBackoff showeps, bool neglogs, bool intcnts) const;
+  // Print n-grams leaving a particular state, standard output format,
+  // following arcs [arc_begin, arc_end) of the state
+  void ShowNGrams(StateId st, size_t arc_begin, size_t arc_end,
+                  bool show_final, ShowBackoff showeps, bool neglogs,
+                  bool intcnts, NGramWriter *writer) const;
 
   void ShowStringFst(const fst::Fst<fst::StdArc> &infst) const;
 
@@ -231,8 +297,10 @@ class NGramOutput : public NGramMutableModel<fst::StdArc> {
 
  private:
   std::ostream &ostrm_;
+  int num_threads_;
   bool include_all_suffixes_;
   NGramContext context_;
+  NGramStateContexts state_contexts_;  // Context membership of the states.
 };
 
 }  // namespace ngram
@@ -22,6 +22,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
 #include <vector>
 
 // Faster multinomial sampling possible if Gnu Scientific Library available.
@@ -31,28 +38,80 @@
 #endif  // HAVE_GSL
 
 #include <fst/fst.h>
+#include <fst/matcher.h>
 #include <fst/randgen.h>
 #include <ngram/util.h>
 
 namespace ngram {
 
+// Walker's alias table, sampling from a discrete distribution in constant time
+// given two uniform variates.
+class AliasTable {
+ public:
+  // Builds the table from non-negative, possibly unnormalized, probabilities,
+  // using Vose's method.
+  explicit AliasTable(const std::vector<double> &probs)
+      : prob_(probs.size(), 1.0), alias_(probs.size()) {
+    double total = 0.0;
+    for (const auto prob : probs) total += prob;
+    if (total <= 0.0) return;
+    std::vector<double> scaled(probs.size());
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < probs.size(); ++i) {
+      alias_[i] = i;
+      scaled[i] = probs[i] * probs.size() / total;
+      (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const size_t s = small.back(), l = large.back();
+      small.pop_back();
+      prob_[s] = scaled[s];
+      alias_[s] = l;
+      scaled[l] -= 1.0 - scaled[s];
+      if (scaled[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // Any remaining entries are 1.0 up to rounding error.
+  }
+
+  // Returns an outcome given two variates uniform in [0, 1).
+  size_t Sample(double r1, double r2) const {
+    const size_t i =
+        std::min(static_cast<size_t>(r1 * prob_.size()), prob_.size() - 1);
+    return r2 < prob_[i] ? i : alias_[i];
+  }
+
+  size_t Size() const { return prob_.size(); }
+
+ private:
+  std::vector<double> prob_;   // Probability of keeping each column.
+  std::vector<size_t> alias_;  // Outcome taken otherwise.
+};
+
 // Same as FastLogProbArcSelector but treats *all* epsilons as
 // failure transitions that have a backoff weight. The LM must
-// be fully normalized.
+// be fully normalized. Draws from its own random number stream, determined
+// by the seed and stream number, so selectors used by different threads
+// with different stream numbers are independent and reproducible.
 template <class A>
 class NGramArcSelector {
  public:
   typedef typename A::StateId StateId;
   typedef typename A::Weight Weight;
 
-  explicit NGramArcSelector(int seed = time(nullptr) + getpid()) : seed_(seed) {
-    srand(seed);
+  explicit NGramArcSelector(int seed = time(nullptr) + getpid(),
+                            int stream = 0)
+      : seed_(seed), stream_(stream) {
+    std::seed_seq seq{seed, stream};
+    rng_.seed(seq);
   }
 
   // Samples one transition.
   size_t operator()(const fst::Fst<A> &fst, StateId s, double total_prob,
                     fst::CacheLogAccumulator<A> *accumulator) const {
-    double r = rand() / (RAND_MAX + 1.0);
+    double r = Uniform();
     // In effect, subtract out excess mass from the cumulative distribution.
     // Requires the backoff epsilon be the initial transition.
     double z = r + total_prob - 1.0;
@@ -61,13 +120,150 @@ class NGramArcSelector {
     return accumulator->LowerBound(-log(z), &aiter);
   }
 
+  // Samples one outcome from an alias table.
+  size_t operator()(const AliasTable &table) const {
+    const double r1 = Uniform();
+    const double r2 = Uniform();
+    return table.Sample(r1, r2);
+  }
+
   int Seed() const { return seed_; }
 
+  int Stream() const { return stream_; }
+
+  // Returns a seed for another generator used with this selector, e.g.,
+  // GSL's, derived from the same seed sequence as the selector's stream, so
+  // that distinct (seed, stream) pairs give distinct seeds.
+  unsigned long GeneratorSeed() const {
+    std::seed_seq seq{seed_, stream_};
+    uint32_t seed;
+    seq.generate(&seed, &seed + 1);
+    return seed;
+  }
+
  private:
+  // Returns a variate uniform in [0, 1) with 53 random bits.
+  double Uniform() const { return (rng_() >> 11) * 0x1.0p-53; }
+
   int seed_;
+  int stream_;
+  mutable std::mt19937_64 rng_;
   fst::WeightConvert<Weight, fst::LogWeight> to_log_weight_;
 };
 
+// Returns the alias table over the arc positions of the state, followed by
+// its final weight. As with NGramArcSelector's cumulative sampling, the
+// initial transition takes the mass not taken by the others: a backoff
+// transition thus gets the backoff numerator, 1 - sum of the word
+// probabilities, rather than its weight (numerator / denominator).
+template <class A>
+AliasTable NGramStateAliasTable(const fst::Fst<A> &fst,
+                                typename A::StateId s) {
+  fst::WeightConvert<typename A::Weight, fst::Log64Weight> to_log_weight;
+  std::vector<double> probs;
+  probs.reserve(fst.NumArcs(s) + 1);
+  bool backoff = false;
+  for (fst::ArcIterator<fst::Fst<A>> aiter(fst, s); !aiter.Done();
+       aiter.Next()) {
+    if (probs.empty()) backoff = aiter.Value().ilabel == 0;
+    probs.push_back(exp(-to_log_weight(aiter.Value().weight).Value()));
+  }
+  probs.push_back(exp(-to_log_weight(fst.Final(s)).Value()));
+  double rest = 0.0;  // Mass of all but the initial transition.
+  for (size_t i = 1; i < probs.size(); ++i) rest += probs[i];
+  if (backoff) {
+    probs[0] = std::max(0.0, 1.0 - rest);
+  } else {
+    probs[0] = std::max(probs[0], 1.0 - rest);
+  }
+  return AliasTable(probs);
+}
+
+// Samples random sentences one at a time by walking the model, treating
+// epsilons as failure transitions as ArcSampler does with NGramArcSelector.
+// Unlike RandGen(), which builds the tree of all sampled sentences, memory
+// does not grow with the number of sentences.
+template <class A>
+class NGramSentenceSampler {
+ public:
+  typedef typename A::StateId StateId;
+  typedef typename A::Label Label;
+  typedef typename A::Weight Weight;
+
+  // The FST must be input label sorted. The selector must outlive the
+  // sampler.
+  NGramSentenceSampler(const fst::Fst<A> &fst,
+                       const NGramArcSelector<A> &selector,
+                       int max_length = INT_MAX)
+      : fst_(fst),
+        selector_(selector),
+        max_length_(max_length),
+        matcher_(fst_, fst::MATCH_INPUT) {}
+
+  // Samples a sentence, returning the labels of the arcs taken, including
+  // backoff epsilons. Returns false, like RandGen(), if the sentence reaches
+  // the maximum length or a dead end before finishing.
+  bool Sample(std::vector<Label> *labels) {
+    labels->clear();
+    backed_off_.clear();
+    StateId s = fst_.Start();
+    while (s != fst::kNoStateId && labels->size() < max_length_) {
+      if (fst_.NumArcs(s) == 0 && fst_.Final(s) == Weight::Zero()) break;
+      const AliasTable &table = GetAliasTable(s);
+      fst::ArcIterator<fst::Fst<A>> aiter(fst_, s);
+      Label label;
+      do {
+        const size_t pos = selector_(table);
+        if (pos < fst_.NumArcs(s)) {
+          aiter.Seek(pos);
+          label = aiter.Value().ilabel;
+        } else {
+          label = fst::kNoLabel;
+        }
+      } while (ForbiddenLabel(label));
+      if (label == fst::kNoLabel) return true;  // Super-final label.
+      labels->push_back(label);
+      if (label == 0) {
+        backed_off_.push_back(s);
+      } else {
+        backed_off_.clear();
+      }
+      s = aiter.Value().nextstate;
+    }
+    return false;
+  }
+
+ private:
+  const AliasTable &GetAliasTable(StateId s) {
+    auto it = alias_tables_.find(s);
+    if (it != alias_tables_.end()) return it->second;
+    return alias_tables_.emplace(s, NGramStateAliasTable(fst_, s))
+        .first->second;
+  }
+
+  // Words (or the super-final label) present at a state backed off from
+  // since the last word can't be taken at its backoff state.
+  bool ForbiddenLabel(Label label) {
+    if (label == 0) return false;
+    for (const auto s : backed_off_) {
+      if (label == fst::kNoLabel) {
+        if (fst_.Final(s) != Weight::Zero()) return true;
+      } else {
+        matcher_.SetState(s);
+        if (matcher_.Find(label)) return true;
+      }
+    }
+    return false;
+  }
+
+  const fst::Fst<A> &fst_;
+  const NGramArcSelector<A> &selector_;
+  size_t max_length_;
+  fst::Matcher<fst::Fst<A>> matcher_;
+  std::vector<StateId> backed_off_;  // States backed off from since a word.
+  std::unordered_map<StateId, AliasTable> alias_tables_;
+};
+
 }  // namespace ngram
 
 namespace fst {
@@ -93,9 +289,11 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
       NGRAMERROR() << "ArcSampler:  is not input-label sorted";
     accumulator_.reset(new C());
     accumulator_->Init(fst);
+    alias_tables_ =
+        std::make_shared<std::unordered_map<StateId, ngram::AliasTable>>();
 #ifdef HAVE_GSL
     rng_ = gsl_rng_alloc(gsl_rng_taus);
-    gsl_rng_set(rng_, arc_selector.Seed());
+    gsl_rng_set(rng_, arc_selector.GeneratorSeed());
 #endif  // HAVE_GSL
   }
 
@@ -107,8 +305,11 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
     if (fst) {
       accumulator_.reset(new C());
       accumulator_->Init(*fst);
+      alias_tables_ =
+          std::make_shared<std::unordered_map<StateId, ngram::AliasTable>>();
     } else {  // shallow copy
       accumulator_.reset(new C(*sampler.accumulator_));
+      alias_tables_ = sampler.alias_tables_;
     }
   }
 
@@ -129,10 +330,9 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
       return false;
     }
 
-    double total_prob = TotalProb(rstate.state_id);
-
 #ifdef HAVE_GSL
     if (fst_.NumArcs(rstate.state_id) + 1 < rstate.nsamples) {
+      double total_prob = TotalProb(rstate.state_id);
       Weight numer_weight, denom_weight;
       BackoffWeight(rstate.state_id, total_prob, &numer_weight, &denom_weight);
       MultinomialSample(rstate, numer_weight);
@@ -142,13 +342,13 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
 #endif  // HAVE_GSL
 
     fst::ArcIterator<fst::Fst<A> > aiter(fst_, rstate.state_id);
+    const ngram::AliasTable &table = GetAliasTable(rstate.state_id);
 
     for (size_t i = 0; i < rstate.nsamples; ++i) {
       size_t pos = 0;
       Label label = kNoLabel;
       do {
-        pos = arc_selector_(fst_, rstate.state_id, total_prob,
-                            accumulator_.get());
+        pos = arc_selector_(table);
         if (pos < fst_.NumArcs(rstate.state_id)) {
           aiter.Seek(pos);
           label = aiter.Value().ilabel;
@@ -178,6 +378,14 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
     return exp(-to_log_weight_(total_weight).Value());
   }
 
+  // Returns the alias table of the state, building it on first use.
+  const ngram::AliasTable &GetAliasTable(StateId s) {
+    auto it = alias_tables_->find(s);
+    if (it != alias_tables_->end()) return it->second;
+    return alias_tables_->emplace(s, ngram::NGramStateAliasTable(fst_, s))
+        .first->second;
+  }
+
   void BackoffWeight(StateId s, double total_prob, Weight *numer_weight,
                      Weight *denom_weight);
 
@@ -195,6 +403,9 @@ class ArcSampler<A, ngram::NGramArcSelector<A> > {
   std::map<size_t, size_t> sample_map_;
   std::map<size_t, size_t>::const_iterator sample_iter_;
   std::unique_ptr<C> accumulator_;
+  // Alias tables of the states sampled so far, shared by shallow copies.
+  std::shared_ptr<std::unordered_map<StateId, ngram::AliasTable>>
+      alias_tables_;
 
 #ifdef HAVE_GSL
   gsl_rng *rng_;              // GNU Sci Lib random number generator
@@ -18,6 +18,7 @@
 #ifndef NGRAM_NGRAM_SHRINK_H_
 #define NGRAM_NGRAM_SHRINK_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <limits>
 #include <sstream>
@@ -381,6 +382,11 @@ class NGramShrink : public NGramMutableModel<Arc> {
   // Map backoff arcs of dead states to dead_state_ (except for start state)
   void PointDeadBackoffArcs();
 
+  // Deletes dead states and pruned arcs, updating the model state info in
+  // place. Returns false, leaving the model unchanged, if some live state
+  // still points to a dead state so that a full reconnection is required.
+  bool CompactPrunedModel();
+
   bool normalized_;  // Whether the NGram model is initially normalized
   bool norm_;        // Whether to normalize the result (if input normalized)
   int shrink_opt_;   // Opt. level: Range 0 (fastest) to 2 (most accurate)
@@ -484,8 +490,10 @@ bool NGramShrink<Arc>::ShrinkNGramModel(bool require_norm, int min_order) {
     NGRAMERROR() << "NGramShrink: Error in redirecting arcs";
     return false;
   }
-  Connect(GetMutableFst());     // removes pruned arcs and dead states
-  InitModel();                  // re-calcs state info
+  if (!CompactPrunedModel()) {  // removes pruned arcs and dead states
+    Connect(GetMutableFst());    // falls back to full rebuild if needed
+    InitModel();                 // re-calcs state info
+  }
   if (Error()) {
     NGRAMERROR() << "NGramShrink: Error in recalculating state info";
     return false;
@@ -761,24 +769,35 @@ double NGramShrink<Arc>::ThetaForMaxNGrams(int target_number_of_ngrams,
   }
   if (scores.empty() || UnigramState() < 0)  // No ngrams to prune.
     return 0.0;
-  std::sort(scores.begin(), scores.end());
 
   // Unigram count is number of arcs leaving unigram + final cost.
   target_number_of_ngrams -= GetFst().NumArcs(UnigramState()) + 1;
   if (target_number_of_ngrams < 0) target_number_of_ngrams = 0;
 
   // Set threshold index to largest score to be pruned.
-  int threshold_index = scores.size() - target_number_of_ngrams - 1;
-  if (threshold_index < 0)
-    return scores[0] - 1.0;  // Sets threshold less than the lowest value.
-  double theta = scores[threshold_index];
-  while (threshold_index < scores.size() && scores[threshold_index] == theta) {
-    threshold_index++;
-  }
-  if (threshold_index >= scores.size()) {  // Sets theta more than max.
+  ssize_t threshold_index =
+      static_cast<ssize_t>(scores.size()) - target_number_of_ngrams - 1;
+  if (threshold_index < 0) {  // Sets threshold less than the lowest value.
+    return *std::min_element(scores.begin(), scores.end()) - 1.0;
+  }
+  // Only the score at threshold_index and the smallest score above it are
+  // needed, so a linear-time selection suffices instead of a full sort.
+  // After partitioning, all scores past threshold_index are >= theta.
+  auto nth = scores.begin() + threshold_index;
+  std::nth_element(scores.begin(), nth, scores.end());
+  double theta = *nth;
+  bool found_next = false;
+  double next_score = 0.0;
+  for (auto it = nth + 1; it != scores.end(); ++it) {
+    if (*it > theta && (!found_next || *it < next_score)) {
+      next_score = *it;
+      found_next = true;
+    }
+  }
+  if (!found_next) {  // Sets theta more than max.
     ++theta;
   } else {  // Sets theta midway between last to keep and first to prune.
-    theta += scores[threshold_index];
+    theta += next_score;
     theta /= 2;
   }
   return theta;
@@ -925,6 +944,38 @@ void NGramShrink<Arc>::PointDeadBackoffArcs() {
   }
 }
 
+// Deletes dead states and pruned arcs in place. Arcs to dead_state_ are
+// removed together with it, and the remaining states keep their relative
+// order, so the state orders (and n-grams) computed at construction only need
+// to be compacted rather than recomputed.
+template <class Arc>
+bool NGramShrink<Arc>::CompactPrunedModel() {
+  std::vector<bool> deleted(ns_, false);
+  std::vector<StateId> dead_states;
+  for (StateId st = 0; st < ns_; ++st) {
+    if (shrink_state_[st].state_dead && st != GetFst().Start()) {
+      deleted[st] = true;
+      dead_states.push_back(st);
+    }
+  }
+  for (StateId st = 0; st < ns_; ++st) {
+    if (deleted[st]) continue;
+    for (fst::ArcIterator<fst::ExpandedFst<Arc>> aiter(GetExpandedFst(), st);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.nextstate != dead_state_ &&
+          (arc.nextstate >= ns_ || deleted[arc.nextstate])) {
+        VLOG(1) << "NGramShrink: live arc to dead state from state: " << st;
+        return false;
+      }
+    }
+  }
+  dead_states.push_back(dead_state_);
+  GetMutableFst()->DeleteStates(dead_states);
+  NGramModel<Arc>::DeleteStateInfo(deleted);
+  return true;
+}
+
 // Makes model from NGram model FST with StdArc counts.  Unlike the function
 // below, has an ngram_list argument, which allows specification of a list of
 // n-grams to be removed from the model, via the 'list_prune' method.
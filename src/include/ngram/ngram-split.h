@@ -18,11 +18,12 @@
 #ifndef NGRAM_NGRAM_SPLIT_H_
 #define NGRAM_NGRAM_SPLIT_H_
 
-#include <map>
+#include <algorithm>
 #include <set>
 #include <string>
 #include <vector>
 
+#include <fst/vector-fst.h>
 #include <ngram/ngram-context.h>
 #include <ngram/ngram-model.h>
 #include <ngram/ngram-mutable-model.h>
@@ -56,12 +57,39 @@ class NGramSplit {
   // Return next NGram component model.
   bool NextNGramModel(fst::MutableFst<Arc> *outfst) {
     outfst->DeleteStates();
-    CreateSplitFst(model_.GetFst(), split_, outfst);
+    if (!CreateSplitFst(model_.GetFst(), split_, outfst)) SetError();
     ++split_;
     if (Error()) return false;
     return true;
   }
 
+  // Builds all remaining component models, num_threads at a time, passing
+  // each to write(fst) in order; at most batch_size models are held at once.
+  // Returns false on error or if write() does.
+  template <class Write>
+  bool NextNGramModels(int num_threads, size_t batch_size, Write write) {
+    if (Error()) return false;
+    model_.GetFst().Properties(fst::kILabelSorted, true);  // Before sharing.
+    batch_size = std::max<size_t>(batch_size, 1);
+    while (!Done()) {
+      const size_t size = std::min(batch_size, contexts_.size() - split_);
+      std::vector<fst::VectorFst<Arc>> fsts(size);
+      std::vector<char> created(size);
+      ParallelFor(size, num_threads, [&](size_t i) {
+        created[i] = CreateSplitFst(model_.GetFst(), split_ + i, &fsts[i]);
+      });
+      for (size_t i = 0; i < size; ++i) {
+        if (!created[i]) {
+          SetError();
+          return false;
+        }
+        if (!write(fsts[i])) return false;
+      }
+      split_ += size;
+    }
+    return true;
+  }
+
   // Indicates if no more components to return.
   bool Done() const { return split_ >= contexts_.size(); }
 
@@ -72,16 +100,40 @@ class NGramSplit {
   void SetError() { error_ = true; }
 
  private:
+  // A state's membership in a split.
+  struct SplitState {
+    size_t split;
+    StateId state;    // State in the split FST.
+    bool in_context;  // Strictly in the split's context.
+  };
+
   void SplitNGramModel(const fst::Fst<Arc> &fst);
 
-  void CreateSplitFst(const fst::Fst<Arc> &fst, size_t context_idx,
-                      fst::MutableFst<Arc> *split_fst);
+  // Returns the membership of the state in the split, or nullptr if the
+  // state is not in the split.
+  const SplitState *FindSplitState(StateId state, size_t context_idx) const {
+    const auto begin = split_states_.begin() + state_begin_[state];
+    const auto end = split_states_.begin() + state_begin_[state + 1];
+    const auto it = std::lower_bound(
+        begin, end, context_idx,
+        [](const SplitState &s, size_t idx) { return s.split < idx; });
+    return it != end && it->split == context_idx ? &*it : nullptr;
+  }
+
+  // Builds the split FST; only reads shared state, so splits can be built
+  // concurrently. Returns false on error.
+  bool CreateSplitFst(const fst::Fst<Arc> &fst, size_t context_idx,
+                      fst::MutableFst<Arc> *split_fst) const;
 
   NGramModel<Arc> model_;
   std::vector<std::unique_ptr<NGramContext>>
       contexts_;  // Ordered contexts to split
   std::vector<std::vector<StateId>>
       context_states_;  // States needed for each context.
+  // Split memberships of each state, ordered by split, in a flat array
+  // indexed by state_begin_.
+  std::vector<size_t> state_begin_;
+  std::vector<SplitState> split_states_;
   size_t split_;
   bool include_all_suffixes_;
   bool error_;
@@ -125,14 +177,19 @@ NGramSplit<Arc>::NGramSplit(const fst::Fst<Arc> &fst,
 template <typename Arc>
 void NGramSplit<Arc>::SplitNGramModel(const fst::Fst<Arc> &fst) {
   // For each state, compute the strict split it belongs to.
-  std::vector<std::set<size_t>> state_splits(model_.NumStates());
+  std::vector<std::vector<size_t>> strict_splits(model_.NumStates());
   for (StateId state = 0; state < model_.NumStates(); ++state) {
     const std::vector<Label> &ngram = model_.StateNGram(state);
     for (size_t i = 0; i < contexts_.size(); ++i) {
       if (contexts_[i]->HasContext(ngram, include_all_suffixes_))
-        state_splits[state].insert(i);
+        strict_splits[state].push_back(i);
     }
   }
+  std::vector<std::set<size_t>> state_splits(model_.NumStates());
+  for (StateId state = 0; state < model_.NumStates(); ++state) {
+    state_splits[state].insert(strict_splits[state].begin(),
+                               strict_splits[state].end());
+  }
 
   // Make sure the start state is added to every split.
   for (size_t i = 0; i < contexts_.size(); ++i)
@@ -179,87 +236,92 @@ void NGramSplit<Arc>::SplitNGramModel(const fst::Fst<Arc> &fst) {
     }
   }
 
-  // Create state vectors for every context.
+  // Create state vectors for every context, and the split memberships of
+  // every state.
   context_states_.resize(contexts_.size());
+  state_begin_.assign(1, 0);
+  state_begin_.reserve(model_.NumStates() + 1);
   for (StateId state = 0; state < model_.NumStates(); ++state) {
     for (std::set<size_t>::const_iterator iter = state_splits[state].begin();
          iter != state_splits[state].end(); ++iter) {
+      const bool in_context =
+          std::binary_search(strict_splits[state].begin(),
+                             strict_splits[state].end(), *iter);
+      split_states_.push_back(
+          {*iter, static_cast<StateId>(context_states_[*iter].size()),
+           in_context});
       context_states_[*iter].push_back(state);
     }
+    state_begin_.push_back(split_states_.size());
   }
 }
 
 template <typename Arc>
-void NGramSplit<Arc>::CreateSplitFst(const fst::Fst<Arc> &fst,
+bool NGramSplit<Arc>::CreateSplitFst(const fst::Fst<Arc> &fst,
                                      size_t context_idx,
-                                     fst::MutableFst<Arc> *split_fst) {
-  if (Error()) return;
+                                     fst::MutableFst<Arc> *split_fst) const {
+  if (Error()) return false;
   split_fst->SetInputSymbols(fst.InputSymbols());
   split_fst->SetOutputSymbols(fst.OutputSymbols());
-  std::map<StateId, StateId> state_map;
-  std::vector<bool> state_in_context(model_.NumStates());
-
-  // Create all required states in each split, and compute
-  // state map for each split.
-  for (size_t i = 0; i < context_states_[context_idx].size(); ++i) {
-    state_in_context[context_states_[context_idx][i]] = true;
-    state_map[context_states_[context_idx][i]] = split_fst->AddState();
-  }
+  const std::vector<StateId> &states = context_states_[context_idx];
 
-  // Add all needed and strictly in context transitions to each split.
-  for (size_t i = 0; i < context_states_[context_idx].size(); ++i) {
-    StateId state = context_states_[context_idx][i];
+  // Create all required states in the split; they are numbered in the order
+  // of the context states.
+  split_fst->ReserveStates(states.size());
+  for (size_t i = 0; i < states.size(); ++i) split_fst->AddState();
+
+  // Add all needed and strictly in context transitions to the split.
+  for (size_t i = 0; i < states.size(); ++i) {
+    const StateId state = states[i];
     Weight bo_weight = NGramModel<Arc>::UnitCount();
     StateId bo_state = model_.GetBackoff(state, &bo_weight);
 
     if (bo_state != fst::kNoStateId) {
       // Add backoff arc
-      split_fst->AddArc(state_map[state],
-                        Arc(0, 0, bo_weight, state_map[bo_state]));
+      const SplitState *bo_split_state =
+          FindSplitState(bo_state, context_idx);
+      if (!bo_split_state) {
+        NGRAMERROR() << "backoff state not in split";
+        return false;
+      }
+      split_fst->AddArc(i, Arc(0, 0, bo_weight, bo_split_state->state));
     }
 
-    if (state == fst.Start()) split_fst->SetStart(state_map[state]);
+    if (state == fst.Start()) split_fst->SetStart(i);
 
-    const std::vector<Label> &ngram = model_.StateNGram(state);
-    bool in_context =
-        contexts_[context_idx]->HasContext(ngram, include_all_suffixes_);
+    const bool in_context = FindSplitState(state, context_idx)->in_context;
 
     for (fst::ArcIterator<fst::Fst<Arc>> aiter(fst, state);
          !aiter.Done(); aiter.Next()) {
       const Arc &arc = aiter.Value();
       if (arc.ilabel == model_.BackoffLabel()) continue;
       StateId nextstate = arc.nextstate;
+      const SplitState *next = FindSplitState(nextstate, context_idx);
       if (!in_context &&
           ((model_.StateOrder(nextstate) != model_.StateOrder(state) + 1) ||
-           !state_in_context[nextstate])) {
+           !next)) {
         continue;
       }
-      auto iter = state_map.find(nextstate);
-      if (!in_context && state != fst.Start() && iter == state_map.end()) {
-        NGRAMERROR() << "out of context n-gram with no destination state";
-        SetError();
-        return;
-      }
-      while (iter == state_map.end()) {
+      while (!next) {
         nextstate = model_.GetBackoff(nextstate, nullptr);
         if (nextstate == fst::kNoStateId) {
           NGRAMERROR() << "backoff state not found for destination state";
-          SetError();
-          return;
+          return false;
         }
-        iter = state_map.find(nextstate);
+        next = FindSplitState(nextstate, context_idx);
       }
-      split_fst->AddArc(state_map[state],
-                        Arc(arc.ilabel, arc.olabel, arc.weight, iter->second));
+      split_fst->AddArc(i, Arc(arc.ilabel, arc.olabel, arc.weight,
+                               next->state));
     }
 
     if (in_context &&
         NGramModel<Arc>::ScalarValue(fst.Final(state)) !=
             NGramModel<Arc>::ScalarValue(Weight::Zero())) {
-      split_fst->SetFinal(state_map[state], fst.Final(state));
+      split_fst->SetFinal(i, fst.Final(state));
     }
   }
   ArcSort(split_fst, fst::ILabelCompare<Arc>());
+  return true;
 }
 
 }  // namespace ngram
@@ -18,7 +18,11 @@
 #ifndef NGRAM_NGRAM_TRANSFER_H_
 #define NGRAM_NGRAM_TRANSFER_H_
 
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <fst/fst.h>
@@ -66,7 +70,7 @@ class NGramTransfer {
     }
     InitSrc(fst, context_pn, dest_model_->BackoffLabel(),
             dest_model_->NormEps());
-    if (!TransferNGrams()) SetError();
+    if (!TransferNGrams(dest_fst_, *dest_model_, *dest_context_)) SetError();
     return !Error();
   }
 
@@ -82,10 +86,48 @@ class NGramTransfer {
     }
     InitDest(fst, context_pn, src_model_->BackoffLabel(),
              src_model_->NormEps());
-    if (!TransferNGrams()) SetError();
+    if (!TransferNGrams(dest_fst_, *dest_model_, *dest_context_)) SetError();
     return !Error();
   }
 
+  // Transfer from ctr FST to each of these arg FSTs, with the corresponding
+  // context patterns; up to 'num_threads' destinations are processed
+  // concurrently.
+  bool TransferNGramsTo(const std::vector<fst::MutableFst<Arc> *> &fsts,
+                        const std::vector<std::string> &context_pns,
+                        int num_threads) {
+    if (Error()) return false;
+    if (transfer_from_) {
+      NGRAMERROR() << "NGramTransfer::NGramTransferTo: constructor FST should "
+                      "not be mutable";
+      SetError();
+      return false;
+    }
+    if (fsts.size() != context_pns.size()) {
+      NGRAMERROR() << "NGramTransfer::NGramTransferTo: " << fsts.size()
+                   << " FSTs but " << context_pns.size() << " contexts";
+      SetError();
+      return false;
+    }
+    src_fst_->Properties(fst::kILabelSorted, true);  // Before sharing.
+    std::vector<char> transferred(fsts.size(), false);
+    ParallelFor(fsts.size(), num_threads, [&](size_t i) {
+      const NGramMutableModel<Arc> dest_model(
+          fsts[i], src_model_->BackoffLabel(), src_model_->NormEps(),
+          /* state_ngrams= */ false, /* infinite_backoff= */ false);
+      if (dest_model.Error()) return;
+      const NGramContext dest_context(context_pns[i], dest_model.HiOrder());
+      transferred[i] = TransferNGrams(fsts[i], dest_model, dest_context);
+    });
+    for (const auto ok : transferred) {
+      if (!ok) {
+        SetError();
+        return false;
+      }
+    }
+    return true;
+  }
+
   // Normalizes model after all transfer has taken place.
   bool TransferNormalize() {
     if (!Error()) {
@@ -96,15 +138,24 @@ class NGramTransfer {
   }
 
  private:
-  bool TransferNGrams() const;
+  // Destination state of each (state, label) pair reached by backoff.
+  typedef std::unordered_map<uint64_t, StateId> NextStateMap;
+
+  // Transfers n-grams from the source model to the destination; only reads
+  // the source, so destinations can be filled concurrently.
+  bool TransferNGrams(fst::MutableFst<Arc> *dest_fst,
+                      const NGramModel<Arc> &dest_model,
+                      const NGramContext &dest_context) const;
 
-  StateId FindNextState(StateId s, Label label) const;
+  // Returns the destination of the arc with 'label' from the backoff states
+  // of 's', or the lowest order state reached, memoized in 'next_states'.
+  StateId FindNextState(StateId s, Label label,
+                        fst::Matcher<fst::Fst<Arc>> *matcher,
+                        NextStateMap *next_states) const;
 
   void InitSrc(const fst::Fst<Arc> &fst, const std::string &context_pattern,
                Label backoff_label, double norm_eps) {
     src_fst_.reset(fst.Copy());
-    src_matcher_.reset(new fst::Matcher<fst::Fst<Arc>>(
-        *src_fst_, fst::MATCH_INPUT));
     src_model_.reset(
         new NGramModel<Arc>(*src_fst_, backoff_label, norm_eps, true));
     src_context_ =
@@ -133,7 +184,6 @@ class NGramTransfer {
 
  private:
   std::unique_ptr<const fst::Fst<Arc>> src_fst_;
-  std::unique_ptr<fst::Matcher<fst::Fst<Arc>>> src_matcher_;
   std::unique_ptr<NGramModel<Arc>> src_model_;
   std::unique_ptr<NGramContext> src_context_;
 
@@ -147,39 +197,45 @@ class NGramTransfer {
 };
 
 template <typename Arc>
-typename Arc::StateId NGramTransfer<Arc>::FindNextState(StateId s,
-                                                        Label label) const {
-  fst::Matcher<fst::Fst<Arc>> matcher(*dest_fst_, fst::MATCH_INPUT);
-  matcher.SetState(s);
-  StateId bs = s;
+typename Arc::StateId NGramTransfer<Arc>::FindNextState(
+    StateId s, Label label, fst::Matcher<fst::Fst<Arc>> *matcher,
+    NextStateMap *next_states) const {
   Label find_backoff_label = src_model_->BackoffLabel()
                                  ? src_model_->BackoffLabel()
                                  : fst::kNoLabel;
-  bool found = false;
-  do {
-    if (matcher.Find(find_backoff_label))
-      bs = matcher.Value().nextstate;
-    else
-      return bs;
-    matcher.SetState(bs);
-    found = matcher.Find(label);
-  } while (!found);
-  return matcher.Value().nextstate;
+  matcher->SetState(s);
+  if (!matcher->Find(find_backoff_label)) return s;
+  const StateId bs = matcher->Value().nextstate;
+  // Lower order states are no longer changed, so their results are kept.
+  const uint64_t key =
+      (static_cast<uint64_t>(bs) << 32) | static_cast<uint32_t>(label);
+  auto iter = next_states->find(key);
+  if (iter != next_states->end()) return iter->second;
+  matcher->SetState(bs);
+  const StateId nextstate =
+      matcher->Find(label) ? matcher->Value().nextstate
+                           : FindNextState(bs, label, matcher, next_states);
+  (*next_states)[key] = nextstate;
+  return nextstate;
 }
 
 template <typename Arc>
-bool NGramTransfer<Arc>::TransferNGrams() const {
+bool NGramTransfer<Arc>::TransferNGrams(
+    fst::MutableFst<Arc> *dest_fst, const NGramModel<Arc> &dest_model,
+    const NGramContext &dest_context) const {
   if (Error()) return false;
   std::vector<StateId> states(src_model_->NumStates(), fst::kNoStateId);
-  states[src_fst_->Start()] = dest_fst_->Start();
+  fst::Matcher<fst::Fst<Arc>> src_matcher(*src_fst_, fst::MATCH_INPUT);
+  NextStateMap next_states;
+  states[src_fst_->Start()] = dest_fst->Start();
   if (src_model_->UnigramState() >= 0) {  // src_model_ is not a unigram model.
-    if (dest_model_->UnigramState() < 0) {
+    if (dest_model.UnigramState() < 0) {
       NGRAMERROR() << "destination model is a unigram but source model is not";
       return false;
     }
-    states[src_model_->UnigramState()] = dest_model_->UnigramState();
+    states[src_model_->UnigramState()] = dest_model.UnigramState();
   } else {  // src_model_ is a unigram model, so should dest_model_ be.
-    if (dest_model_->UnigramState() != src_model_->UnigramState()) {
+    if (dest_model.UnigramState() != src_model_->UnigramState()) {
       NGRAMERROR() << "destination model is not a unigram but source model is";
       return false;
     }
@@ -192,27 +248,27 @@ bool NGramTransfer<Arc>::TransferNGrams() const {
       StateId sp = states[s];
 
       // (1) if both ascending, set states[d] = dp
-      src_matcher_->SetState(s);
-      for (fst::ArcIterator<fst::Fst<Arc>> aiter(*dest_fst_, sp);
+      src_matcher.SetState(s);
+      for (fst::ArcIterator<fst::Fst<Arc>> aiter(*dest_fst, sp);
            !aiter.Done(); aiter.Next()) {
         const Arc &arc = aiter.Value();
-        if (arc.ilabel == dest_model_->BackoffLabel()) continue;
-        if (dest_model_->StateOrder(arc.nextstate) <=
-            dest_model_->StateOrder(sp)) {
+        if (arc.ilabel == dest_model.BackoffLabel()) continue;
+        if (dest_model.StateOrder(arc.nextstate) <=
+            dest_model.StateOrder(sp)) {
           continue;
         }
-        if (!src_matcher_->Find(arc.ilabel)) continue;
-        if (dest_model_->StateOrder(arc.nextstate) !=
-            src_model_->StateOrder(src_matcher_->Value().nextstate)) {
+        if (!src_matcher.Find(arc.ilabel)) continue;
+        if (dest_model.StateOrder(arc.nextstate) !=
+            src_model_->StateOrder(src_matcher.Value().nextstate)) {
           continue;
         }
-        if (states[src_matcher_->Value().nextstate] != fst::kNoStateId) {
-          NGRAMERROR() << "State " << src_matcher_->Value().nextstate
+        if (states[src_matcher.Value().nextstate] != fst::kNoStateId) {
+          NGRAMERROR() << "State " << src_matcher.Value().nextstate
                        << " value already set to "
-                       << states[src_matcher_->Value().nextstate];
+                       << states[src_matcher.Value().nextstate];
           return false;
         }
-        states[src_matcher_->Value().nextstate] = arc.nextstate;
+        states[src_matcher.Value().nextstate] = arc.nextstate;
       }
 
       // (2) if strictly in context in the reference, do the transfer
@@ -221,7 +277,7 @@ bool NGramTransfer<Arc>::TransferNGrams() const {
       }
 
       std::map<Label, Arc> arcs;
-      for (fst::ArcIterator<fst::Fst<Arc>> aiter(*dest_fst_, sp);
+      for (fst::ArcIterator<fst::Fst<Arc>> aiter(*dest_fst, sp);
            !aiter.Done(); aiter.Next()) {
         const Arc &arc = aiter.Value();
         arcs[arc.ilabel] = arc;
@@ -230,30 +286,35 @@ bool NGramTransfer<Arc>::TransferNGrams() const {
       // If loosely in context for the destination, missing arcs and finality
       // need to be added.
       bool add_missing =
-          dest_context_->HasContext(src_model_->StateNGram(s), true);
+          dest_context.HasContext(src_model_->StateNGram(s), true);
 
-      for (fst::ArcIterator<fst::Fst<Arc>> aiter(*src_fst_, s);
-           !aiter.Done(); aiter.Next()) {
-        const Arc &arc = aiter.Value();
-        auto iter = arcs.find(arc.ilabel);
-        if (iter != arcs.end()) {
-          iter->second.weight = arc.weight;
-        } else if (add_missing) {
-          arcs[arc.ilabel] = Arc(arc.ilabel, arc.olabel, arc.weight,
-                                 FindNextState(sp, arc.ilabel));
+      {
+        // The matcher is done with before the arcs of 'sp' are replaced.
+        fst::Matcher<fst::Fst<Arc>> dest_matcher(*dest_fst, fst::MATCH_INPUT);
+        for (fst::ArcIterator<fst::Fst<Arc>> aiter(*src_fst_, s);
+             !aiter.Done(); aiter.Next()) {
+          const Arc &arc = aiter.Value();
+          auto iter = arcs.find(arc.ilabel);
+          if (iter != arcs.end()) {
+            iter->second.weight = arc.weight;
+          } else if (add_missing) {
+            arcs[arc.ilabel] = Arc(
+                arc.ilabel, arc.olabel, arc.weight,
+                FindNextState(sp, arc.ilabel, &dest_matcher, &next_states));
+          }
         }
       }
 
-      dest_fst_->DeleteArcs(sp);
+      dest_fst->DeleteArcs(sp);
       for (auto iter = arcs.begin(); iter != arcs.end(); ++iter) {
-        dest_fst_->AddArc(sp, iter->second);
+        dest_fst->AddArc(sp, iter->second);
       }
       if (NGramModel<Arc>::ScalarValue(src_fst_->Final(s)) !=
               NGramModel<Arc>::ScalarValue(Weight::Zero()) &&
           (add_missing ||
-           NGramModel<Arc>::ScalarValue(dest_fst_->Final(sp)) !=
+           NGramModel<Arc>::ScalarValue(dest_fst->Final(sp)) !=
                NGramModel<Arc>::ScalarValue(Weight::Zero()))) {
-        dest_fst_->SetFinal(sp, src_fst_->Final(s));
+        dest_fst->SetFinal(sp, src_fst_->Final(s));
       }
     }
   }
@@ -16,6 +16,12 @@
 #ifndef NGRAM_UTIL_H_
 #define NGRAM_UTIL_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
 #include <fst/flags.h>
 #include <fst/log.h>
 
@@ -27,4 +33,40 @@ DECLARE_bool(ngram_error_fatal);
   LOG(LEVEL(FST_FLAGS_ngram_error_fatal ? base_logging::FATAL \
                                                    : base_logging::ERROR))
 
+// UTILITY FOR MULTI-THREADING
+
+namespace ngram {
+
+// Calls fn(i) for every i in [0, size), using up to 'num_threads' threads
+// (including the calling thread). Indices are handed out in contiguous blocks
+// in increasing order, so fn() should only touch per-index state; callers
+// needing a deterministic result store per-index output and reduce it
+// serially afterwards. With fewer than two threads this is a plain loop.
+template <class Fn>
+void ParallelFor(size_t size, int num_threads, Fn fn) {
+  if (num_threads < 2 || size < 2) {
+    for (size_t i = 0; i < size; ++i) fn(i);
+    return;
+  }
+  num_threads = std::min<size_t>(num_threads, size);
+  const size_t block =
+      std::max<size_t>(1, std::min<size_t>(1024, size / (8 * num_threads)));
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (;;) {
+      const size_t begin = next.fetch_add(block);
+      if (begin >= size) return;
+      const size_t end = std::min(size, begin + block);
+      for (size_t i = begin; i < end; ++i) fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (int t = 1; t < num_threads; ++t) threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads) thread.join();
+}
+
+}  // namespace ngram
+
 #endif  // NGRAM_UTIL_H_
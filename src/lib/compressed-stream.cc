@@ -0,0 +1,377 @@
+// Copyright 2005-2013 Brian Roark
+// Copyright 2005-2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the 'License');
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an 'AS IS' BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include <ngram/compressed-stream.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif  // HAVE_ZLIB
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif  // HAVE_ZSTD
+
+#include <ngram/util.h>
+
+namespace ngram {
+
+// (De)compresses data from an input buffer into an output buffer.
+class StreamCodec {
+ public:
+  virtual ~StreamCodec() = default;
+
+  // Consumes input from [*in, in_end) and produces output into
+  // [*out, out_end), advancing both pointers. When compressing, 'finish'
+  // asks to end the compressed stream once all input is consumed. Sets
+  // '*end' when a decompressed gzip member or zstd frame is complete, or
+  // when a finished compressed stream is fully written. Returns false on
+  // error.
+  virtual bool Run(const char **in, const char *in_end, char **out,
+                   char *out_end, bool finish, bool *end) = 0;
+
+  // Prepares to decompress another gzip member or zstd frame.
+  virtual bool Reset() = 0;
+};
+
+namespace {
+
+constexpr size_t kBufferSize = 1 << 16;
+
+bool HasSuffix(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+const char *CompressionName(Compression compression) {
+  return compression == Compression::GZIP ? "gzip" : "zstd";
+}
+
+#ifdef HAVE_ZLIB
+
+class GzipCodec : public StreamCodec {
+ public:
+  explicit GzipCodec(bool decompress) : decompress_(decompress) {
+    // Window bits of 15 plus 16 write a gzip header; plus 32 detect it.
+    ok_ = (decompress ? inflateInit2(&strm_, 15 + 32)
+                      : deflateInit2(&strm_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                     15 + 16, 8, Z_DEFAULT_STRATEGY)) == Z_OK;
+  }
+
+  ~GzipCodec() override {
+    if (!ok_) return;
+    if (decompress_) {
+      inflateEnd(&strm_);
+    } else {
+      deflateEnd(&strm_);
+    }
+  }
+
+  bool Ok() const { return ok_; }
+
+  bool Run(const char **in, const char *in_end, char **out, char *out_end,
+           bool finish, bool *end) override {
+    strm_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(*in));
+    strm_.avail_in = in_end - *in;
+    strm_.next_out = reinterpret_cast<Bytef *>(*out);
+    strm_.avail_out = out_end - *out;
+    const int ret = decompress_
+                        ? inflate(&strm_, Z_NO_FLUSH)
+                        : deflate(&strm_, finish ? Z_FINISH : Z_NO_FLUSH);
+    *in = reinterpret_cast<const char *>(strm_.next_in);
+    *out = reinterpret_cast<char *>(strm_.next_out);
+    *end = ret == Z_STREAM_END;
+    // No progress being possible (Z_BUF_ERROR) just needs more data or room.
+    return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
+  }
+
+  bool Reset() override { return inflateReset(&strm_) == Z_OK; }
+
+ private:
+  bool decompress_;
+  bool ok_;
+  z_stream strm_ = {};
+};
+
+#endif  // HAVE_ZLIB
+
+#ifdef HAVE_ZSTD
+
+class ZstdCodec : public StreamCodec {
+ public:
+  explicit ZstdCodec(bool decompress)
+      : cctx_(decompress ? nullptr : ZSTD_createCCtx()),
+        dctx_(decompress ? ZSTD_createDCtx() : nullptr) {}
+
+  ~ZstdCodec() override {
+    ZSTD_freeCCtx(cctx_);
+    ZSTD_freeDCtx(dctx_);
+  }
+
+  bool Ok() const { return cctx_ || dctx_; }
+
+  bool Run(const char **in, const char *in_end, char **out, char *out_end,
+           bool finish, bool *end) override {
+    ZSTD_inBuffer input = {*in, static_cast<size_t>(in_end - *in), 0};
+    ZSTD_outBuffer output = {*out, static_cast<size_t>(out_end - *out), 0};
+    // Both return the amount of data left to flush, zero once the frame is
+    // complete.
+    const size_t ret =
+        dctx_ ? ZSTD_decompressStream(dctx_, &output, &input)
+              : ZSTD_compressStream2(cctx_, &output, &input,
+                                     finish ? ZSTD_e_end : ZSTD_e_continue);
+    *in += input.pos;
+    *out += output.pos;
+    if (ZSTD_isError(ret)) return false;
+    *end = ret == 0 && (dctx_ || finish);
+    return true;
+  }
+
+  // Frames follow each other without resetting the decompressor.
+  bool Reset() override { return true; }
+
+ private:
+  ZSTD_CCtx *cctx_;
+  ZSTD_DCtx *dctx_;
+};
+
+#endif  // HAVE_ZSTD
+
+// Returns the (de)compressor, or null if the compression was not built in.
+std::unique_ptr<StreamCodec> MakeCodec(Compression compression,
+                                       bool decompress) {
+  switch (compression) {
+#ifdef HAVE_ZLIB
+    case Compression::GZIP: {
+      auto codec = std::make_unique<GzipCodec>(decompress);
+      if (codec->Ok()) return codec;
+      break;
+    }
+#endif  // HAVE_ZLIB
+#ifdef HAVE_ZSTD
+    case Compression::ZSTD: {
+      auto codec = std::make_unique<ZstdCodec>(decompress);
+      if (codec->Ok()) return codec;
+      break;
+    }
+#endif  // HAVE_ZSTD
+    default:
+      NGRAMERROR() << "CodecStreamBuf: " << CompressionName(compression)
+                   << " support not compiled in; rebuild with "
+                   << (compression == Compression::GZIP ? "zlib" : "libzstd")
+                   << " to " << (decompress ? "read" : "write")
+                   << " compressed files";
+      return nullptr;
+  }
+  NGRAMERROR() << "CodecStreamBuf: Could not initialize "
+               << CompressionName(compression);
+  return nullptr;
+}
+
+}  // namespace
+
+Compression CompressionFromMagic(const std::string &magic) {
+  if (magic.compare(0, 2, "\x1f\x8b") == 0) return Compression::GZIP;
+  if (magic.compare(0, 4, "\x28\xb5\x2f\xfd") == 0) return Compression::ZSTD;
+  return Compression::NONE;
+}
+
+Compression CompressionFromExtension(const std::string &name) {
+  if (HasSuffix(name, ".gz")) return Compression::GZIP;
+  if (HasSuffix(name, ".zst") || HasSuffix(name, ".zstd"))
+    return Compression::ZSTD;
+  return Compression::NONE;
+}
+
+CodecStreamBuf::CodecStreamBuf() = default;
+
+CodecStreamBuf::~CodecStreamBuf() { Close(); }
+
+bool CodecStreamBuf::Open(Compression compression, bool decompress,
+                          const std::string &name) {
+  if (IsOpen() || compression == Compression::NONE) return false;
+  codec_ = MakeCodec(compression, decompress);
+  if (!codec_) return false;
+  file_ = std::fopen(name.c_str(), decompress ? "rb" : "wb");
+  if (!file_) {
+    codec_.reset();
+    return false;
+  }
+  output_ = !decompress;
+  eof_ = false;
+  ended_ = false;
+  error_ = false;
+  buf_.resize(kBufferSize);
+  raw_.resize(kBufferSize);
+  raw_begin_ = raw_end_ = raw_.data();
+  if (output_) {
+    setp(buf_.data(), buf_.data() + buf_.size());
+  } else {
+    setg(buf_.data(), buf_.data(), buf_.data());
+  }
+  return true;
+}
+
+bool CodecStreamBuf::Close() {
+  if (!IsOpen()) return true;
+  if (output_) WriteBuffer(/*finish=*/true);
+  if (std::fclose(file_) != 0) error_ = true;
+  file_ = nullptr;
+  codec_.reset();
+  setg(nullptr, nullptr, nullptr);
+  setp(nullptr, nullptr);
+  return !error_;
+}
+
+CodecStreamBuf::int_type CodecStreamBuf::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  if (!IsOpen() || output_ || eof_) return traits_type::eof();
+  char *out = buf_.data();
+  while (out == buf_.data() && !eof_) {
+    if (ended_ && raw_begin_ < raw_end_) {  // Another member or frame.
+      if (!codec_->Reset()) {
+        error_ = eof_ = true;
+        break;
+      }
+      ended_ = false;
+    }
+    if (!ended_) {
+      const char *in = raw_begin_;
+      if (!codec_->Run(&raw_begin_, raw_end_, &out, buf_.data() + buf_.size(),
+                       /*finish=*/false, &ended_) ||
+          (out == buf_.data() && raw_begin_ == in && in < raw_end_)) {
+        NGRAMERROR() << "CodecStreamBuf: Corrupt compressed data";
+        error_ = eof_ = true;
+        break;
+      }
+    }
+    if (out > buf_.data() || raw_begin_ < raw_end_) continue;
+    const size_t size = std::fread(raw_.data(), 1, raw_.size(), file_);
+    if (size == 0) {
+      if (std::ferror(file_)) error_ = true;
+      if (!ended_) {
+        NGRAMERROR() << "CodecStreamBuf: Truncated compressed data";
+        error_ = true;
+      }
+      eof_ = true;
+    }
+    raw_begin_ = raw_.data();
+    raw_end_ = raw_begin_ + size;
+  }
+  if (out == buf_.data()) return traits_type::eof();
+  setg(buf_.data(), buf_.data(), out);
+  return traits_type::to_int_type(*gptr());
+}
+
+CodecStreamBuf::int_type CodecStreamBuf::overflow(int_type c) {
+  if (!IsOpen() || !output_ || !WriteBuffer(/*finish=*/false)) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int CodecStreamBuf::sync() {
+  if (IsOpen() && output_ && !WriteBuffer(/*finish=*/false)) return -1;
+  return 0;
+}
+
+bool CodecStreamBuf::WriteBuffer(bool finish) {
+  const char *in = pbase();
+  while (!error_) {
+    char *out = raw_.data();
+    bool end = false;
+    if (!codec_->Run(&in, pptr(), &out, raw_.data() + raw_.size(), finish,
+                     &end)) {
+      NGRAMERROR() << "CodecStreamBuf: Compression failed";
+      error_ = true;
+    }
+    const size_t size = out - raw_.data();
+    if (size > 0 && std::fwrite(raw_.data(), 1, size, file_) != size) {
+      error_ = true;
+    }
+    // Without 'finish', the codec may keep some input to compress later.
+    if (finish ? end : in == pptr() && out < raw_.data() + raw_.size()) break;
+  }
+  setp(buf_.data(), buf_.data() + buf_.size());
+  return !error_;
+}
+
+void CompressedIfstream::Open(const std::string &source) {
+  Close();
+  if (!file_.open(source, std::ios_base::in)) {
+    setstate(std::ios_base::failbit);
+    return;
+  }
+  char magic[4];
+  const auto size = file_.sgetn(magic, sizeof(magic));
+  compression_ = CompressionFromMagic(std::string(magic, size > 0 ? size : 0));
+  if (compression_ == Compression::NONE) {
+    file_.pubseekpos(0, std::ios_base::in);
+    rdbuf(&file_);
+    return;
+  }
+  file_.close();
+  if (!codec_.Open(compression_, /*decompress=*/true, source)) {
+    setstate(std::ios_base::failbit);
+    return;
+  }
+  rdbuf(&codec_);
+}
+
+bool CompressedIfstream::Close() {
+  bool ok = codec_.Close();
+  if (file_.is_open()) file_.close();
+  rdbuf(&file_);
+  compression_ = Compression::NONE;
+  return ok;
+}
+
+void CompressedOfstream::Open(const std::string &dest) {
+  Close();
+  compression_ = CompressionFromExtension(dest);
+  if (compression_ == Compression::NONE) {
+    if (!file_.open(dest, std::ios_base::out)) {
+      setstate(std::ios_base::failbit);
+      return;
+    }
+    rdbuf(&file_);
+    return;
+  }
+  if (!codec_.Open(compression_, /*decompress=*/false, dest)) {
+    setstate(std::ios_base::failbit);
+    return;
+  }
+  rdbuf(&codec_);
+}
+
+bool CompressedOfstream::Close() {
+  if (!IsOpen()) return true;
+  flush();
+  bool ok = good();
+  if (codec_.IsOpen()) ok = codec_.Close() && ok;
+  if (file_.is_open()) ok = file_.close() != nullptr && ok;
+  rdbuf(&file_);
+  compression_ = Compression::NONE;
+  return ok;
+}
+
+}  // namespace ngram
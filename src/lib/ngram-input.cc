@@ -15,12 +15,19 @@
 //
 #include <ngram/ngram-input.h>
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <deque>
 #include <fstream>
 #include <limits>
 #include <sstream>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
 
 #include <fst/arcsort.h>
+#include <fst/mapped-file.h>
 #include <fst/matcher.h>
 #include <fst/vector-fst.h>
 #include <ngram/ngram-model.h>
@@ -34,6 +41,7 @@ namespace ngram {
 using ::fst::ArcIterator;
 using ::fst::kNoStateId;
 using ::fst::Log64Weight;
+using ::fst::MappedFile;
 using ::fst::MATCH_INPUT;
 using ::fst::Matcher;
 using ::fst::MutableArcIterator;
@@ -45,6 +53,69 @@ using ::fst::StdMutableFst;
 using ::fst::StdVectorFst;
 using ::fst::SymbolTable;
 
+namespace {
+
+// Splits the next line off the text, as std::getline() would; returns false
+// if no text remains.
+bool NextLine(std::string_view *text, std::string_view *line) {
+  if (text->empty()) return false;
+  const auto end = text->find('\n');
+  *line = text->substr(0, end);
+  text->remove_prefix(end == std::string_view::npos ? text->size() : end + 1);
+  return true;
+}
+
+// Using whitespace as delimiter, splits the next token off the line.
+bool NextToken(std::string_view *line, std::string_view *token) {
+  size_t begin = 0;
+  while (begin < line->size() && isspace((*line)[begin])) ++begin;
+  if (begin == line->size()) return false;
+  size_t end = begin;
+  while (end < line->size() && !isspace((*line)[end])) ++end;
+  *token = line->substr(begin, end - begin);
+  line->remove_prefix(end);
+  return true;
+}
+
+// Splits text ending at whitespace into about the requested number of ranges,
+// each ending at whitespace.
+std::vector<std::string_view> SplitAtWhiteSpace(std::string_view text,
+                                                size_t num_ranges) {
+  std::vector<std::string_view> ranges;
+  const size_t size = std::max<size_t>(1, text.size() / num_ranges);
+  while (!text.empty()) {
+    size_t end = std::min(size, text.size());
+    while (end < text.size() && !isspace(text[end - 1])) ++end;
+    ranges.push_back(text.substr(0, end));
+    text.remove_prefix(end);
+  }
+  return ranges;
+}
+
+// Converts the leading numerical part of a token, as operator>>() would. Also
+// accepts "inf", "-inf" and "Infinity" forms.
+template <class A>
+bool TokenValue(std::string_view token, A *val) {
+  if (!token.empty() && token[0] == '+') token.remove_prefix(1);
+  return std::from_chars(token.data(), token.data() + token.size(), *val).ec ==
+         std::errc();
+}
+
+// Converts an ARPA log prob or backoff token, taking the same infinite forms
+// as NGramInput::CheckInfVal(). Returns false if the token is not a number.
+bool ARPATokenValue(std::string_view token, double *val) {
+  if (token == "-inf" || token == "-Infinity") {
+    *val = -std::numeric_limits<double>::infinity();
+    return true;
+  } else if (token == "inf" || token == "Infinity") {
+    *val = std::numeric_limits<double>::infinity();
+    return true;
+  }
+  return TokenValue(token, val) && std::isfinite(*val);
+}
+
+}  // namespace
+
 void ReadTokenString(const std::string &str, std::vector<std::string> *words) {
   auto it = str.cbegin();
   while (it < str.cend()) {
@@ -69,6 +140,7 @@ NGramInput::NGramInput(std::istream &istrm, std::ostream &ostrm,
       end_symbol_(end_symbol),
       istrm_(istrm),
       ostrm_(ostrm),
+      num_threads_(1),
       error_(false) {
   InitializeSymbols(symbols, epsilon_symbol);
 }
@@ -401,7 +473,7 @@ void NGramInput::ReadARPAOrder(std::vector<int> *orders, int order,
       SetError();
       return;
     }
-    NGramInput::CheckInfVal(token, &boprob);
+    NGramInput::CheckInfVal(token, &nlprob);
     nlprob *= -log(10);  // Converts to neglog base e from log base 10.
     ssize_t st = ngram_counter->NGramUnigramState();
     StateId nextstate = fst::kNoStateId;
@@ -413,21 +485,7 @@ void NGramInput::ReadARPAOrder(std::vector<int> *orders, int order,
     Label label = ExtractNGramLabel(&it, &str, add_words,
                                     /*dups=*/false, &stsym, &endsym);
     if (Error()) return;
-    if (endsym) {
-      ngram_counter->SetFinalNGramWeight(st, nlprob);
-    } else if (!stsym) {
-      // Tests for presence of all suffixes of n-gram.
-      auto backoff_st = ngram_counter->NGramBackoffState(st);
-      while (backoff_st >= 0) {
-        ngram_counter->FindArc(backoff_st, label);
-        backoff_st = ngram_counter->NGramBackoffState(backoff_st);
-      }
-      const auto arc_id = ngram_counter->FindArc(st, label);
-      ngram_counter->SetNGramWeight(arc_id, nlprob);
-      nextstate = ngram_counter->NGramNextState(arc_id);
-    } else {
-      nextstate = ngram_counter->NGramStartState();
-    }
+    nextstate = AddARPANGram(st, label, stsym, endsym, nlprob, ngram_counter);
     if (GetStringVal(&it, &str, &boprob, &token) &&
         (nextstate >= 0 || boprob != 0)) {  // Found non-zero backoff cost.
       if (nextstate == fst::kNoStateId) {
@@ -454,24 +512,287 @@ void NGramInput::ReadARPAOrder(std::vector<int> *orders, int order,
   }
 }
 
+// Adds an ARPA n-gram with the given history state and (neglog) prob to the
+// counter, returning the state it leads to (if any).
+typename NGramInput::StateId NGramInput::AddARPANGram(
+    ssize_t st, Label label, bool stsym, bool endsym, double nlprob,
+    Counter *ngram_counter) {
+  if (endsym) {
+    ngram_counter->SetFinalNGramWeight(st, nlprob);
+    return kNoStateId;
+  } else if (stsym) {
+    return ngram_counter->NGramStartState();
+  }
+  // Tests for presence of all suffixes of n-gram.
+  auto backoff_st = ngram_counter->NGramBackoffState(st);
+  while (backoff_st >= 0) {
+    ngram_counter->FindArc(backoff_st, label);
+    backoff_st = ngram_counter->NGramBackoffState(backoff_st);
+  }
+  const auto arc_id = ngram_counter->FindArc(st, label);
+  ngram_counter->SetNGramWeight(arc_id, nlprob);
+  return ngram_counter->NGramNextState(arc_id);
+}
+
+// Gets the label of an ARPA word from a mapped file, caching it by text.
+typename NGramInput::Label NGramInput::GetMappedNGramLabel(
+    std::string_view word, bool add, bool *stsym, bool *endsym,
+    LabelMap *labels) {
+  *stsym = false;
+  *endsym = false;
+  const auto it = labels->find(word);
+  if (it != labels->end()) {
+    *stsym = it->second == -1;
+    *endsym = it->second == -2;
+    if (add && add_symbols_ && !*stsym && !*endsym) {  // Shouldn't find dup.
+      NGRAMERROR() << "NGramInput: Symbol already found in list: " << word;
+      SetError();
+    }
+    return it->second;
+  }
+  const auto label =
+      GetNGramLabel(std::string(word), add, /*dups=*/false, stsym, endsym);
+  if (!Error()) labels->emplace(word, label);
+  return label;
+}
+
+// Reads the header at the top of a mapped ARPA file, collecting n-gram orders.
+int NGramInput::ReadMappedARPATopHeader(std::string_view *text,
+                                        std::vector<int> *orders) {
+  std::string_view line;
+  // Scans the file until a \data\ record is found.
+  while (NextLine(text, &line)) {
+    if (line == "\\data\\") break;
+  }
+  if (!NextLine(text, &line)) {
+    NGRAMERROR() << "Input stream read error, or no \\data\\ record found";
+    SetError();
+    return 0;
+  }
+  int order = 0;
+  while (!line.empty()) {
+    const auto eq = line.find('=');
+    if (eq == std::string_view::npos) {
+      NGRAMERROR()
+          << "NGramInput: ARPA header mismatch!  No '=' in ngram count.";
+      SetError();
+      return 0;
+    }
+    line.remove_prefix(eq + 1);
+    std::string_view token;
+    int ngram_cnt = 0;  // Must have n-gram count, fails if not found.
+    if (!NextToken(&line, &token) || !TokenValue(token, &ngram_cnt)) {
+      NGRAMERROR() << "NGramInput: ARPA header mismatch!  No ngram count.";
+      SetError();
+      return 0;
+    }
+    orders->push_back(ngram_cnt);
+    if (ngram_cnt > 0) ++order;  // Some reported n-gram orders may be empty.
+    if (!NextLine(text, &line)) {
+      NGRAMERROR() << "Input stream read error";
+      SetError();
+      return 0;
+    }
+  }
+  return order;
+}
+
+// Parses n-gram 'idx' of the given order from its line.
+bool NGramInput::ParseMappedARPALine(std::string_view line, int order,
+                                     const LabelMap &labels, size_t idx,
+                                     ARPANGrams *ngrams, bool *resolved) {
+  static const double kLog10 = log(10);
+  std::string_view token;
+  if (!NextToken(&line, &token)) return false;
+  double nlprob = 0.0;
+  if (!ARPATokenValue(token, &nlprob)) return false;
+  ngrams->probs[idx] = nlprob * -kLog10;  // Converts to neglog base e.
+  Label *ngram_labels = &ngrams->labels[idx * (order + 1)];
+  for (int j = 0; j <= order; ++j) {
+    if (!NextToken(&line, &token)) return false;
+    if (order == 0) {
+      ngrams->words[idx] = token;
+      continue;
+    }
+    const auto it = labels.find(token);
+    if (it != labels.end()) {
+      ngram_labels[j] = it->second;
+    } else {
+      *resolved = false;
+    }
+  }
+  double boprob = 0.0;
+  ngrams->has_backoff[idx] = NextToken(&line, &token);
+  if (ngrams->has_backoff[idx] && !ARPATokenValue(token, &boprob)) return false;
+  ngrams->backoffs[idx] = boprob * -kLog10;
+  return true;
+}
+
+// Splits the n-grams of the particular order off a mapped ARPA file.
+bool NGramInput::SplitMappedARPAOrder(std::string_view *text, int order,
+                                      int count, std::string_view *body) {
+  std::string_view line;
+  const std::string header = "\\" + std::to_string(order + 1) + "-grams:";
+  if (!NextLine(text, &line)) {
+    NGRAMERROR() << "Input stream read error";
+    SetError();
+    return false;
+  }
+  if (line != header) {
+    NGRAMERROR() << "NGramInput: ARPA header mismatch!  Line reads: " << line
+                 << "   Line should read: " << header;
+    SetError();
+    return false;
+  }
+  // N-grams end at the first blank line.
+  size_t size = 0;
+  if (count > 0) {
+    const auto end = text->find("\n\n");
+    size = end == std::string_view::npos ? text->size() : end + 1;
+  }
+  *body = text->substr(0, size);
+  text->remove_prefix(size);
+  if (!NextLine(text, &line)) {
+    NGRAMERROR() << "Input stream read error";
+    SetError();
+    return false;
+  }
+  if (!line.empty()) {
+    NGRAMERROR() << "Expected blank line at end of n-grams";
+    SetError();
+    return false;
+  }
+  return true;
+}
+
+// Reads in n-grams for the particular order from a mapped ARPA file.
+void NGramInput::ReadMappedARPAOrder(std::string_view *text,
+                                     const std::vector<int> &orders, int order,
+                                     std::vector<double> *boweights,
+                                     Counter *ngram_counter,
+                                     LabelMap *labels) {
+  std::string_view body;
+  if (!SplitMappedARPAOrder(text, order, orders[order], &body)) return;
+  // Splits the n-grams into ranges of whole lines, and counts the lines of
+  // each range to find the index of its first n-gram.
+  const size_t nranges = num_threads_ > 1 ? 8 * num_threads_ : 1;
+  std::vector<size_t> bounds(1, 0);
+  for (size_t i = 1; i < nranges; ++i) {
+    const auto end = body.find('\n', body.size() * i / nranges);
+    if (end == std::string_view::npos) break;
+    if (end + 1 > bounds.back()) bounds.push_back(end + 1);
+  }
+  if (body.size() > bounds.back()) bounds.push_back(body.size());
+  const size_t nchunks = bounds.size() - 1;
+  std::vector<size_t> first(nchunks + 1, 0);
+  ParallelFor(nchunks, num_threads_, [&](size_t c) {
+    first[c + 1] = std::count(body.begin() + bounds[c],
+                              body.begin() + bounds[c + 1], '\n');
+  });
+  for (size_t c = 0; c < nchunks; ++c) first[c + 1] += first[c];
+  const size_t count = first[nchunks];
+  if (count != orders[order]) {
+    NGRAMERROR() << "NGramInput: ARPA header mismatch!  Found " << count
+                 << " " << order + 1 << "-grams, header reports "
+                 << orders[order];
+    SetError();
+    return;
+  }
+  ARPANGrams ngrams;
+  ngrams.labels.resize(count * (order + 1), fst::kNoLabel);
+  if (order == 0) ngrams.words.resize(count);
+  ngrams.probs.resize(count);
+  ngrams.backoffs.resize(count);
+  ngrams.has_backoff.resize(count);
+  // Lines that are malformed, or have words to be labeled serially.
+  std::vector<size_t> bad(nchunks, count);
+  std::vector<std::vector<std::pair<size_t, std::string_view>>> unresolved(
+      nchunks);
+  ParallelFor(nchunks, num_threads_, [&](size_t c) {
+    auto chunk = body.substr(bounds[c], bounds[c + 1] - bounds[c]);
+    std::string_view line;
+    for (size_t idx = first[c]; NextLine(&chunk, &line); ++idx) {
+      bool resolved = true;
+      if (!ParseMappedARPALine(line, order, *labels, idx, &ngrams,
+                               &resolved)) {
+        bad[c] = idx;
+        return;
+      }
+      if (!resolved) unresolved[c].emplace_back(idx, line);
+    }
+  });
+  for (size_t c = 0; c < nchunks; ++c) {
+    if (bad[c] < count) {
+      NGRAMERROR() << "NGramInput: ARPA format mismatch!  Malformed "
+                   << order + 1 << "-gram: " << bad[c] + 1;
+      SetError();
+      return;
+    }
+  }
+  bool stsym;   // stsym == 1 for <s>.
+  bool endsym;  // endsym == 1 for </s>.
+  if (order == 0) {  // Labels words in order of appearance.
+    for (size_t idx = 0; idx < count; ++idx) {
+      ngrams.labels[idx] = GetMappedNGramLabel(ngrams.words[idx], /*add=*/true,
+                                               &stsym, &endsym, labels);
+      if (Error()) return;
+    }
+  }
+  for (const auto &chunk : unresolved) {
+    for (auto line : chunk) {
+      std::string_view token;
+      NextToken(&line.second, &token);  // Skips the n-gram log prob.
+      for (int j = 0; j <= order; ++j) {
+        NextToken(&line.second, &token);
+        ngrams.labels[line.first * (order + 1) + j] = GetMappedNGramLabel(
+            token, /*add=*/false, &stsym, &endsym, labels);
+        if (Error()) return;
+      }
+    }
+  }
+  // Adds the n-grams to the counter in file order.
+  for (size_t idx = 0; idx < count; ++idx) {
+    const Label *ngram_labels = &ngrams.labels[idx * (order + 1)];
+    ssize_t st = ngram_counter->NGramUnigramState();
+    for (int j = 0; j < order; ++j) {  // Finds n-gram history state.
+      st = NextStateFromLabel(st, ngram_labels[j], ngram_labels[j] == -1,
+                              ngram_labels[j] == -2, ngram_counter);
+      if (Error()) return;
+    }
+    const auto label = ngram_labels[order];
+    const auto nextstate = AddARPANGram(st, label, label == -1, label == -2,
+                                        ngrams.probs[idx], ngram_counter);
+    const double boprob = ngrams.backoffs[idx];
+    if (ngrams.has_backoff[idx] &&
+        (nextstate >= 0 || boprob != 0)) {  // Found non-zero backoff cost.
+      if (nextstate == kNoStateId) {
+        NGRAMERROR() << "NGramInput: Have a backoff cost with no state ID!";
+        SetError();
+        return;
+      }
+      if (nextstate >= boweights->size())
+        boweights->resize(nextstate + 1, StdArc::Weight::Zero().Value());
+      (*boweights)[nextstate] = boprob;
+    }
+  }
+}
+
 typename NGramInput::StateId NGramInput::FindNewDest(StateId st) {
   StateId newdest = st;
   if (fst_->NumArcs(st) > 1 || fst_->Final(st) != StdArc::Weight::Zero()) {
     return newdest;
   }
-  MutableArcIterator<StdMutableFst> aiter(fst_.get(), st);
+  ArcIterator<MutableFst<Arc>> aiter(*fst_, st);
   const auto &arc = aiter.Value();
   if (arc.ilabel == 0) newdest = FindNewDest(arc.nextstate);
   return newdest;
 }
 
 void NGramInput::SetARPANGramDests() {
-  std::vector<StateId> newdests;
+  std::vector<StateId> newdests(fst_->NumStates());
+  ParallelFor(newdests.size(), num_threads_,
+              [this, &newdests](size_t st) { newdests[st] = FindNewDest(st); });
   StateIterator<MutableFst<Arc>> siter(*fst_);
-  for (; !siter.Done(); siter.Next()) {
-    newdests.push_back(FindNewDest(siter.Value()));
-  }
-  siter.Reset();
   for (; !siter.Done(); siter.Next()) {
     for (MutableArcIterator<StdMutableFst> aiter(fst_.get(), siter.Value());
          !aiter.Done(); aiter.Next()) {
@@ -508,26 +829,23 @@ void NGramInput::SetARPABackoffWeights(std::vector<double> *boweights) {
   }
 }
 
-double NGramInput::GetLowerOrderProb(StateId st, Label label) {
+bool NGramInput::GetLowerOrderProb(StateId st, Label label, double *prob) {
   Matcher<MutableFst<Arc>> matcher(*fst_, MATCH_INPUT);
   matcher.SetState(st);
   if (matcher.Find(label)) {
-    return matcher.Value().weight.Value();
-  }
-  if (!matcher.Find(0)) {
-    NGRAMERROR() << "NGramInput: No backoff probability";
-    SetError();
-    return StdArc::Weight::Zero().Value();
+    *prob = matcher.Value().weight.Value();
+    return true;
   }
+  if (!matcher.Find(0)) return false;
   for (; !matcher.Done(); matcher.Next()) {
     const auto &arc = matcher.Value();
     if (arc.ilabel == 0) {
-      return arc.weight.Value() + GetLowerOrderProb(arc.nextstate, label);
+      if (!GetLowerOrderProb(arc.nextstate, label, prob)) return false;
+      *prob += arc.weight.Value();
+      return true;
     }
   }
-  NGRAMERROR() << "NGramInput: No backoff arc found";
-  SetError();
-  return StdArc::Weight::Zero().Value();
+  return false;
 }
 
 // Descends backoff arcs to find backoff final cost and sets it.
@@ -539,26 +857,77 @@ double NGramInput::GetFinalBackoff(StateId st) {
   return fst_->Final(st).Value();
 }
 
+// Finds the arcs of the state that are missing from the ARPA model.
+bool NGramInput::FindARPAHoles(StateId st,
+                               std::vector<std::pair<size_t, double>> *holes) {
+  double boprob;
+  StateId bostate = kNoStateId;
+  for (ArcIterator<MutableFst<Arc>> aiter(*fst_, st); !aiter.Done();
+       aiter.Next()) {
+    const auto &arc = aiter.Value();
+    if (arc.ilabel == 0) {
+      boprob = arc.weight.Value();
+      bostate = arc.nextstate;
+    } else if (arc.weight == StdArc::Weight::Zero()) {
+      double loprob;
+      if (bostate < 0 || !GetLowerOrderProb(bostate, arc.ilabel, &loprob))
+        return false;
+      holes->emplace_back(aiter.Position(), boprob + loprob);
+    }
+  }
+  return true;
+}
+
 void NGramInput::FillARPAHoles() {
-  for (StateIterator<MutableFst<Arc>> siter(*fst_); !siter.Done();
-       siter.Next()) {
-    const auto st = siter.Value();
-    double boprob;
-    StateId bostate = kNoStateId;
-    for (MutableArcIterator<StdMutableFst> aiter(fst_.get(), st); !aiter.Done();
-         aiter.Next()) {
-      auto arc = aiter.Value();
-      if (arc.ilabel == 0) {
-        boprob = arc.weight.Value();
-        bostate = arc.nextstate;
-      } else {
-        if (arc.weight == StdArc::Weight::Zero()) {
-          arc.weight = boprob + GetLowerOrderProb(bostate, arc.ilabel);
-          if (Error()) return;
-          aiter.SetValue(arc);
-        }
+  const StateId ns = fst_->NumStates();
+  // Matchers compute missing FST properties; does so before threading.
+  if (num_threads_ > 1) fst_->Properties(fst::kILabelSorted, true);
+  std::vector<StateId> backoffs(ns);
+  ParallelFor(ns, num_threads_,
+              [this, &backoffs](size_t st) { backoffs[st] = GetBackoff(st); });
+  // Holes are filled from the arcs of lower order states, which may be holes
+  // themselves, so states are filled in order of ascending n-gram order.
+  std::vector<int> orders(ns, -1);
+  std::vector<std::vector<StateId>> order_states;
+  for (StateId st = 0; st < ns; ++st) {
+    std::vector<StateId> chain;
+    StateId bo = st;
+    for (; bo >= 0 && orders[bo] < 0; bo = backoffs[bo]) chain.push_back(bo);
+    int order = bo >= 0 ? orders[bo] : -1;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+      orders[*it] = ++order;
+    if (order_states.size() <= static_cast<size_t>(orders[st]))
+      order_states.resize(orders[st] + 1);
+    order_states[orders[st]].push_back(st);
+  }
+  for (const auto &states : order_states) {
+    std::vector<std::vector<std::pair<size_t, double>>> holes(states.size());
+    std::vector<char> found(states.size());  // Errors are reported after join.
+    ParallelFor(states.size(), num_threads_, [&](size_t i) {
+      found[i] = FindARPAHoles(states[i], &holes[i]);
+    });
+    for (size_t i = 0; i < states.size(); ++i) {
+      if (!found[i]) {
+        NGRAMERROR() << "NGramInput: No backoff probability for hole at state "
+                     << states[i];
+        SetError();
+        return;
+      }
+    }
+    for (size_t i = 0; i < states.size(); ++i) {
+      if (holes[i].empty()) continue;
+      MutableArcIterator<StdMutableFst> aiter(fst_.get(), states[i]);
+      for (const auto &hole : holes[i]) {
+        aiter.Seek(hole.first);
+        auto arc = aiter.Value();
+        arc.weight = hole.second;
+        aiter.SetValue(arc);
       }
     }
+    if (num_threads_ > 1) fst_->Properties(fst::kILabelSorted, true);
+  }
+  for (StateId st = 0; st < ns; ++st) {
+    const auto bostate = backoffs[st];
     if (bostate >= 0 && fst_->Final(st) != StdArc::Weight::Zero() &&
         fst_->Final(bostate) == StdArc::Weight::Zero()) {
       GetFinalBackoff(bostate);
@@ -582,11 +951,67 @@ bool NGramInput::CompileARPAModel(bool output, bool renormalize) {
   }
   ARPAHeaderStringMatch("\\end\\");  // Verify that everything parsed well
   if (Error()) return false;
+  return CompileARPANGrams(&ngram_counter, &boweights, output, renormalize);
+}
+
+// Reads an ARPA model from the named file, memory-mapping it.
+bool NGramInput::ReadMappedARPA(const std::string &source, bool output,
+                                bool renormalize_arpa) {
+  if (Error()) return false;
+  std::ifstream istrm(source, std::ios_base::in | std::ios_base::binary);
+  if (!istrm) {
+    NGRAMERROR() << "NGramInput: Could not open ARPA file: " << source;
+    SetError();
+    return false;
+  }
+  istrm.seekg(0, std::ios_base::end);
+  const size_t size = istrm.tellg();
+  istrm.seekg(0, std::ios_base::beg);
+  if (size == 0) return CompileMappedARPAModel({}, output, renormalize_arpa);
+  std::unique_ptr<MappedFile> mapped(
+      MappedFile::Map(istrm, /*memorymap=*/true, source, size));
+  if (!mapped) {
+    NGRAMERROR() << "NGramInput: Could not map ARPA file: " << source;
+    SetError();
+    return false;
+  }
+  return CompileMappedARPAModel(
+      std::string_view(static_cast<const char *>(mapped->data()), size),
+      output, renormalize_arpa);
+}
+
+// Reads in headers and n-grams from a mapped ARPA model text.
+bool NGramInput::CompileMappedARPAModel(std::string_view text, bool output,
+                                        bool renormalize) {
+  std::vector<int> orders;
+  ReadMappedARPATopHeader(&text, &orders);
+  if (Error()) return false;
+  std::vector<double> boweights;
+  Counter ngram_counter(orders.size());
+  LabelMap labels;
+  for (auto i = 0; i < orders.size(); i++) {  // Read n-grams of each order
+    ReadMappedARPAOrder(&text, orders, i, &boweights, &ngram_counter, &labels);
+    if (Error()) return false;
+  }
+  std::string_view line;
+  if (!NextLine(&text, &line) || line != "\\end\\") {
+    NGRAMERROR() << "NGramInput: ARPA header mismatch!  No \\end\\ line";
+    SetError();
+    return false;
+  }
+  return CompileARPANGrams(&ngram_counter, &boweights, output, renormalize);
+}
+
+// Builds the model FST from n-grams and backoff weights read from an ARPA
+// model, and dumps it.
+bool NGramInput::CompileARPANGrams(Counter *ngram_counter,
+                                   std::vector<double> *boweights, bool output,
+                                   bool renormalize) {
   fst_ = std::make_unique<StdVectorFst>();
-  ngram_counter.GetFst(fst_.get());
+  ngram_counter->GetFst(fst_.get());
   static const StdILabelCompare icomp;
   ArcSort(fst_.get(), icomp);
-  SetARPABackoffWeights(&boweights);
+  SetARPABackoffWeights(boweights);
   if (Error()) return false;
   FillARPAHoles();
   if (Error()) return false;
@@ -621,7 +1046,19 @@ void NGramInput::RenormalizeARPAModel() {
     arc.weight = ngram_model.ScaleWeight(arc.weight, -renorm_val);
     aiter.SetValue(arc);
   }
-  ngram_model.RecalcBackoff();
+  // Recalculates backoff costs concurrently, then assigns them. Computing a
+  // backoff cost only reads the model: its neglog sums are positive, so the
+  // NegLogDiff calls cannot set the model error from the workers.
+  if (num_threads_ > 1) fst_->Properties(fst::kILabelSorted, true);
+  std::vector<double> alphas(fst_->NumStates());
+  std::vector<char> has_backoff(fst_->NumStates());
+  ParallelFor(alphas.size(), num_threads_, [&](size_t st) {
+    has_backoff[st] = ngram_model.CalcBackoffCost(st, &alphas[st]);
+  });
+  for (StateId st = 0; st < alphas.size(); ++st) {
+    if (ngram_model.Error()) break;
+    if (has_backoff[st]) ngram_model.SetBackoffCost(st, alphas[st]);
+  }
   if (!ngram_model.CheckNormalization()) {
     NGRAMERROR() << "ARPA model could not be renormalized";
     SetError();
@@ -820,16 +1257,75 @@ double NGramInput::FillStringLabels(std::string *str,
 
 // Converts text corpus to symbol table.
 bool NGramInput::CompileSymbolTable(bool output) {
-  for (std::string str; std::getline(istrm_, str);) {  // For each string.
-    std::vector<Label> labels;
-    FillStringLabels(&str, &labels, false);
-    if (Error()) return false;
+  if (add_symbols_) {
+    CollectSymbols();
+  } else {
+    for (std::string str; std::getline(istrm_, str);) {  // For each string.
+      std::vector<Label> labels;
+      FillStringLabels(&str, &labels, false);
+      if (Error()) return false;
+    }
   }
+  if (Error()) return false;
   if (!oov_symbol_.empty()) syms_->AddSymbol(oov_symbol_);
   if (output) syms_->WriteText(ostrm_);
   return true;
 }
 
+// Adds the corpus words to the symbol table in order of first occurrence.
+// The corpus is read in large chunks ending at whitespace. Each chunk is split
+// into ranges whose unseen words are collected in parallel, as views into the
+// chunk, then added serially in range order.
+void NGramInput::CollectSymbols() {
+  constexpr size_t kChunkSize = 1 << 24;
+  std::unordered_set<std::string_view> seen;
+  std::deque<std::string> words;  // Owns the words viewed by seen.
+  for (const auto &item : *syms_) {
+    words.emplace_back(item.Symbol());
+    seen.insert(words.back());
+  }
+  const size_t num_ranges = num_threads_ > 1 ? 4 * num_threads_ : 1;
+  std::string chunk;
+  for (bool done = false; !done;) {
+    const size_t carry = chunk.size();
+    chunk.resize(carry + kChunkSize);
+    istrm_.read(&chunk[carry], kChunkSize);
+    chunk.resize(carry + istrm_.gcount());
+    if (istrm_.bad()) {
+      NGRAMERROR() << "NGramInput: Could not read corpus";
+      SetError();
+      return;
+    }
+    done = !istrm_;
+    // Leaves a word that may continue in the next chunk for later.
+    size_t end = chunk.size();
+    if (!done) {
+      while (end > 0 && !isspace(chunk[end - 1])) --end;
+    }
+    const auto ranges =
+        SplitAtWhiteSpace(std::string_view(chunk.data(), end), num_ranges);
+    std::vector<std::vector<std::string_view>> unseen(ranges.size());
+    ParallelFor(ranges.size(), num_threads_, [&](size_t r) {
+      std::unordered_set<std::string_view> local;
+      std::string_view text = ranges[r];
+      for (std::string_view word; NextToken(&text, &word);) {
+        if (seen.count(word) == 0 && local.insert(word).second) {
+          unseen[r].push_back(word);
+        }
+      }
+    });
+    for (const auto &range : unseen) {
+      for (const auto word : range) {
+        if (seen.count(word) > 0) continue;
+        words.emplace_back(word);
+        seen.insert(words.back());
+        syms_->AddSymbol(words.back());
+      }
+    }
+    chunk.erase(0, end);
+  }
+}
+
 // Writes resulting FST to output stream.
 void NGramInput::DumpFst(bool incl_symbols, bool output) {
   if (incl_symbols) {
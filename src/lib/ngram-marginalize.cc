@@ -17,6 +17,7 @@
 
 #include <ngram/ngram-marginalize.h>
 
+#include <utility>
 #include <vector>
 
 #include <ngram/util.h>
@@ -47,15 +48,34 @@ bool NGramMarginal::CalculateStateProbs() {
     marginal_stats_[s].log_prob = log(weights[s]);
     marginal_stats_[s].sum_ho_log_prob_w_bo = log(weights[s]);
   }
+  // Lists states backing off to each state, in flat arrays indexed by
+  // state offset: first counts them, then fills them in state order.
+  std::vector<StateId> backoffs(ns_);
+  hi_begin_.assign(ns_ + 1, 0);
   for (StateId st = 0; st < ns_; ++st) {
-    StateId bst = GetBackoff(st, nullptr);
+    StateId bst = backoffs[st] = GetBackoff(st, nullptr);
     if (bst >= 0) {       // if state backs off to another state
-      marginal_stats_[bst].hi_states.push_back(st);  // add to list
+      ++hi_begin_[bst + 1];
       marginal_stats_[bst].sum_ho_log_prob =
           -NegLogSum(-marginal_stats_[bst].sum_ho_log_prob,
                      -marginal_stats_[st].log_prob);  // add to ho_prob
     }
   }
+  for (StateId st = 0; st < ns_; ++st) hi_begin_[st + 1] += hi_begin_[st];
+  hi_states_.resize(hi_begin_[ns_]);
+  std::vector<size_t> next(hi_begin_.begin(), hi_begin_.end() - 1);
+  for (StateId st = 0; st < ns_; ++st) {
+    if (backoffs[st] >= 0) hi_states_[next[backoffs[st]]++] = st;
+  }
+  // Arc statistics (including </s>) are only needed for states backed off to.
+  arc_begin_.assign(ns_ + 1, 0);
+  for (StateId st = 0; st < ns_; ++st) {
+    arc_begin_[st + 1] = arc_begin_[st];
+    if (NumHiStates(st) > 0)
+      arc_begin_[st + 1] += GetExpandedFst().NumArcs(st) + 1;
+  }
+  arc_found_.resize(arc_begin_[ns_]);
+  arc_notfound_.resize(arc_begin_[ns_]);
   return true;
 }
 
@@ -91,12 +111,12 @@ void NGramMarginal::UpdateAccum(StateId st, StateId bst, size_t idx,
                                 size_t hidx, bool update_found, double arcvalue,
                                 double bo_weight) {
   if (update_found) {  // updating found items, too
-    if (!marginal_stats_[bst].arc_found.empty()) {  // not highest order
+    if (NumHiStates(bst) > 0) {  // not highest order
       // add in the arc_found values from higher order state
-      AddToArcFound(st, idx, -marginal_stats_[bst].arc_found[hidx]);
+      AddToArcFound(st, idx, -ArcFound(bst, hidx));
       // add in the arc value from all states using the bst arc
       AddToArcFound(st, idx,
-                    arcvalue - marginal_stats_[bst].arc_notfound[hidx]);
+                    arcvalue - ArcNotFound(bst, hidx));
     } else {
       AddToArcFound(st, idx, arcvalue - marginal_stats_[bst].log_prob);
     }
@@ -105,39 +125,49 @@ void NGramMarginal::UpdateAccum(StateId st, StateId bst, size_t idx,
                       bo_weight - marginal_stats_[bst].sum_ho_log_prob_w_bo);
 }
 
-// initialize every arc 'not there' value with total; or reset index to -1
-void NGramMarginal::SetArcIndices(StateId st, bool initialize) {
+// initialize every arc 'not there' value with total
+void NGramMarginal::InitArcNotFound(StateId st) {
   size_t idx = 0;
-  if (initialize && GetFst().Final(st) != StdArc::Weight::Zero())
-    marginal_stats_[st].arc_notfound[idx] =
-        marginal_stats_[st].sum_ho_log_prob_w_bo;
+  if (GetFst().Final(st) != StdArc::Weight::Zero())
+    ArcNotFound(st, idx) = marginal_stats_[st].sum_ho_log_prob_w_bo;
   for (ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st); !aiter.Done();
        aiter.Next()) {
     StdArc arc = aiter.Value();
     ++idx;
     if (arc.ilabel == BackoffLabel()) continue;  // ignore backoff arc
-    while (indices_.size() <= arc.ilabel + 1) indices_.push_back(-1);
-    indices_[arc.ilabel] = initialize ? idx : -1;
-    if (initialize)  // if initializing, set backoff sums for arc
-      marginal_stats_[st].arc_notfound[idx] =
-          marginal_stats_[st].sum_ho_log_prob_w_bo;
+    ArcNotFound(st, idx) = marginal_stats_[st].sum_ho_log_prob_w_bo;
   }
 }
 
-// Get idx from current state
-int NGramMarginal::GetCurrentArcIndex(int label) {
-  while (indices_.size() <= label + 1) indices_.push_back(-1);
-  return indices_[label];
+// Get idx of arc with label from state (idx = 0 is </s>), or -1 if not found.
+// Binary search over the sorted arcs; no shared lookup table is needed, so
+// states can be processed concurrently.
+int NGramMarginal::FindArcIndex(StateId st, Label label) const {
+  ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st);
+  size_t low = 0, high = GetExpandedFst().NumArcs(st);
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    aiter.Seek(mid);
+    if (aiter.Value().ilabel < label) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == GetExpandedFst().NumArcs(st)) return -1;
+  aiter.Seek(low);
+  if (aiter.Value().ilabel != label || label == BackoffLabel()) return -1;
+  return low + 1;
 }
 
 // Scan through arcs in a state and collect higher order statistics.
 // Later iterations only update the 'not_found' statistics, hence sum_found bool
-void NGramMarginal::HigherOrderArcSum(StateId st, bool sum_found) {
-  SetArcIndices(st, true);
-  for (size_t i = 0; i < marginal_stats_[st].hi_states.size(); ++i) {
-    Matcher<StdFst> matcher(GetFst(), MATCH_INPUT);
-    matcher.SetState(st);
-    StateId bst = marginal_stats_[st].hi_states[i];  // higher order state
+// Returns false if some arc has no lower order arc at state; the caller
+// reports the error, since states are summed concurrently.
+bool NGramMarginal::HigherOrderArcSum(StateId st, bool sum_found) {
+  InitArcNotFound(st);
+  for (size_t i = 0; i < NumHiStates(st); ++i) {
+    StateId bst = HiState(st, i);  // higher order state
     size_t idx = 0, hidx = 0;                        // idx = 0 is </s>
     Weight bo_weight;
     GetBackoff(bst, &bo_weight);
@@ -149,46 +179,30 @@ void NGramMarginal::HigherOrderArcSum(StateId st, bool sum_found) {
       StdArc arc = aiter.Value();
       ++hidx;
       if (arc.ilabel == BackoffLabel()) continue;  // ignore backoff arc
-      if (!matcher.Find(arc.ilabel)) {
-        NGRAMERROR() << "lower order arc not found";
-        NGramModel<StdArc>::SetError();
-        return;
-      }
-      StdArc barc = matcher.Value();
-      int val = GetCurrentArcIndex(barc.ilabel);  // get idx from current state
-      if (val < 0) {
-        NGRAMERROR() << "lower order arc index not set";
-        NGramModel<StdArc>::SetError();
-        return;
-      }
+      int val = FindArcIndex(st, arc.ilabel);  // get idx from current state
+      if (val < 0) return false;
       idx = val;
       UpdateAccum(st, bst, idx, hidx, sum_found, arc.weight.Value(),
                   ScalarValue(bo_weight));
     }
   }
-  SetArcIndices(st, false);
+  return true;
 }
 
 // Scan through states backing off to state and collect statistics
 void NGramMarginal::HigherOrderStateSum(StateId st) {
   // initialize arc_found and arc_notfound values for state
-  bool first_iteration = marginal_stats_[st].arc_found.empty();
-  for (size_t i = 0; i <= GetExpandedFst().NumArcs(st); ++i) {
-    if (first_iteration) {  // need to push back onto vector
-      marginal_stats_[st].arc_found.push_back(-LogArc::Weight::Zero().Value());
-      // value in arc_notfound includes residual mass at state itself
-      marginal_stats_[st].arc_notfound.push_back(marginal_stats_[st].log_prob);
-    } else {  // already allocated
-      marginal_stats_[st].arc_found[i] = -LogArc::Weight::Zero().Value();
-      marginal_stats_[st].arc_notfound[i] = marginal_stats_[st].log_prob;
-    }
+  for (size_t i = 0; i < NumArcStats(st); ++i) {
+    ArcFound(st, i) = -LogArc::Weight::Zero().Value();
+    // value in arc_notfound includes residual mass at state itself
+    ArcNotFound(st, i) = marginal_stats_[st].log_prob;
   }
   // for recursive accumulation of higher order probabilities
-  for (size_t i = 0; i < marginal_stats_[st].hi_states.size(); ++i) {
-    StateId bst = marginal_stats_[st].hi_states[i];  // bst backs off to st
+  for (size_t i = 0; i < NumHiStates(st); ++i) {
+    StateId bst = HiState(st, i);  // bst backs off to st
     Weight bo_weight;
     GetBackoff(bst, &bo_weight);
-    if (!marginal_stats_[bst].arc_found.empty())  // if not highest order
+    if (NumHiStates(bst) > 0)  // if not highest order
       marginal_stats_[st].sum_ho_log_prob =  // otherwise already accumulated
           -NegLogSum(-marginal_stats_[st].sum_ho_log_prob,
                      -marginal_stats_[bst].sum_ho_log_prob);
@@ -200,7 +214,7 @@ void NGramMarginal::HigherOrderStateSum(StateId st) {
 
 // Calculate arc weight while ensuring resulting value is sane
 double NGramMarginal::SaneArcWeight(StateId st, size_t idx, double prob) {
-  double has = -marginal_stats_[st].arc_found[idx];
+  double has = -ArcFound(st, idx);
   if (has <= prob) {  // numerator <= 0; set to small default value
     VLOG(2) << "NGramMarginalize: non-positive arc weight set to kFloatEps: "
             << "st: "  << st << " idx: " << idx;
@@ -208,7 +222,7 @@ double NGramMarginal::SaneArcWeight(StateId st, size_t idx, double prob) {
   } else {
     prob = NegLogDiff(prob, has);
   }
-  prob -= -marginal_stats_[st].arc_notfound[idx];
+  prob -= -ArcNotFound(st, idx);
   return prob;
 }
 
@@ -259,7 +273,7 @@ double NGramMarginal::UpdSaneArcWeights(StateId st, std::vector<double> *wts,
                                         std::vector<double> *hold_notfound) {
   size_t idx = 0;
   double orig_norm = (*wts)[0];  // keep track of original normalization
-  (*wts)[0] -= (*hold_notfound)[idx] - marginal_stats_[st].arc_notfound[idx];
+  (*wts)[0] -= (*hold_notfound)[idx] - ArcNotFound(st, idx);
   double norm = (*wts)[0];
   for (ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st); !aiter.Done();
        aiter.Next()) {
@@ -268,77 +282,137 @@ double NGramMarginal::UpdSaneArcWeights(StateId st, std::vector<double> *wts,
     if (arc.ilabel == BackoffLabel()) continue;
     orig_norm = NegLogSum(orig_norm, (*wts)[idx]);
     (*wts)[idx] -=
-        (*hold_notfound)[idx] - marginal_stats_[st].arc_notfound[idx];
+        (*hold_notfound)[idx] - ArcNotFound(st, idx);
     norm = NegLogSum(norm, (*wts)[idx]);
   }
 
   return MassReservedForBackoff(st, orig_norm, norm);
 }
 
-// Recalculate backoff weights of all higher order states; indicate if changed
-bool NGramMarginal::StateHigherOrderBackoffRecalc(StateId st) {
+// Calculate (old, new) backoff weights of all higher order states
+void NGramMarginal::CalcHigherOrderBackoffs(
+    StateId st, std::vector<std::pair<double, double>> *bo_weights) {
+  bo_weights->clear();
+  for (size_t i = 0; i < NumHiStates(st); ++i) {
+    StateId bst = HiState(st, i);
+    Weight bo_weight;
+    GetBackoff(bst, &bo_weight);
+    double new_bo_weight = ScalarValue(bo_weight);
+    CalcBackoffCost(bst, &new_bo_weight);
+    bo_weights->emplace_back(ScalarValue(bo_weight), new_bo_weight);
+  }
+}
+
+// Assign new backoff weights of all higher order states
+void NGramMarginal::SetHigherOrderBackoffs(
+    StateId st, const std::vector<std::pair<double, double>> &bo_weights) {
+  for (size_t i = 0; i < NumHiStates(st); ++i)
+    SetBackoffCost(HiState(st, i), bo_weights[i].second);
+}
+
+// Given recalculated backoff weights of higher order states,
+// if updated, recalculate arcs based on this.
+bool NGramMarginal::HigherOrderBackoffRecalc(
+    StateId st, const std::vector<std::pair<double, double>> &bo_weights,
+    std::vector<double> *wts, double *norm, bool *failed) {
   bool upd = false;
   marginal_stats_[st].sum_ho_log_prob_w_bo = marginal_stats_[st].log_prob;
-  for (size_t i = 0; i < marginal_stats_[st].hi_states.size(); ++i) {
-    StateId bst = marginal_stats_[st].hi_states[i];
-    Weight bo_weight, new_bo_weight;
-    GetBackoff(bst, &bo_weight);
-    RecalcBackoff(bst);
-    GetBackoff(bst, &new_bo_weight);
+  for (size_t i = 0; i < NumHiStates(st); ++i) {
+    StateId bst = HiState(st, i);
+    Weight new_bo_weight;
+    GetBackoff(bst, &new_bo_weight);  // as stored in the model
     marginal_stats_[st].sum_ho_log_prob_w_bo =
         -NegLogSum(-marginal_stats_[st].sum_ho_log_prob_w_bo,
                    -marginal_stats_[bst].sum_ho_log_prob_w_bo +
                        ScalarValue(new_bo_weight));
-    if (fabs(ScalarValue(bo_weight) - ScalarValue(new_bo_weight)) < kNormEps)
+    if (fabs(bo_weights[i].first - ScalarValue(new_bo_weight)) < kNormEps)
       continue;
     upd = true;
   }
-  return upd;
-}
-
-// Recalculate backoff weights of higher order states;
-// if updated, recalculate arcs based on this.
-bool NGramMarginal::HigherOrderBackoffRecalc(StateId st,
-                                             std::vector<double> *wts,
-                                             double *norm) {
-  if (StateHigherOrderBackoffRecalc(st)) {  // recalculate denominators of arcs
-    std::vector<double> hold_notfound;      // to hold prior not_found values
-    for (size_t i = 0; i < marginal_stats_[st].arc_notfound.size(); ++i) {
-      hold_notfound.push_back(marginal_stats_[st].arc_notfound[i]);
-      marginal_stats_[st].arc_notfound[i] = marginal_stats_[st].log_prob;
-    }
-    HigherOrderArcSum(st, false);  // perform arc sum, but don't update found
-    (*norm) = UpdSaneArcWeights(st, wts, &hold_notfound);
-    return true;
+  if (!upd) return false;
+  // recalculate denominators of arcs
+  std::vector<double> hold_notfound;  // to hold prior not_found values
+  for (size_t i = 0; i < NumArcStats(st); ++i) {
+    hold_notfound.push_back(ArcNotFound(st, i));
+    ArcNotFound(st, i) = marginal_stats_[st].log_prob;
   }
-  return false;
+  if (!HigherOrderArcSum(st, false)) {  // arc sum, but don't update found
+    *failed = true;
+    return false;
+  }
+  (*norm) = UpdSaneArcWeights(st, wts, &hold_notfound);
+  return true;
 }
 
-// Calculate new weights enforcing marginalization constraints
-// P(w, h') - sum_of_found gamma(w | h) p(h) / sum_of_not alpha_h p(h)
-void NGramMarginal::CalculateNewStateWeights(StateId st) {
-  HigherOrderStateSum(st);      // collect stats from higher order states
-  HigherOrderArcSum(st, true);  // collect stats for all arcs
-  std::vector<double> wts;      // For storing resulting arc weights
-  double norm = GetSaneArcWeights(st, &wts);
-  bool need_upd = true;
-  int upd_count = 0;
-  while (need_upd && (upd_count == 0 || upd_count < max_bo_updates_)) {
-    SetSaneArcWeights(st, &wts, norm);  // assign new weights to arcs
-    need_upd = (max_bo_updates_ > 0) ?
-        HigherOrderBackoffRecalc(st, &wts, &norm) : false;
-    ++upd_count;
+// Reports states whose arc sums failed, after the concurrent pass is joined.
+bool NGramMarginal::CheckArcSums(const std::vector<StateId> &states,
+                                 const std::vector<char> &failed) {
+  for (size_t i = 0; i < states.size(); ++i) {
+    if (failed[i]) {
+      NGRAMERROR() << "lower order arc not found: " << states[i];
+      NGramModel<StdArc>::SetError();
+      return false;
+    }
   }
+  return true;
 }
 
 // Calculate state weights from highest order to lowest order
 void NGramMarginal::CalculateNewWeights() {
+  std::vector<StateId> states;            // states of the current order
+  std::vector<std::vector<double>> wts;   // resulting arc weights per state
+  std::vector<double> norms;
+  std::vector<std::vector<std::pair<double, double>>> bo_weights;
+  std::vector<size_t> active, updated;    // states (indices) to be updated
+  std::vector<char> need_upd;  // not vector<bool>, as set concurrently
+  std::vector<char> failed;    // states with lower order arcs missing
   for (int order = HiOrder() - 1; order >= 1; --order) {  // for each order
+    states.clear();
     for (StateId st = 0; st < GetExpandedFst().NumStates(); ++st) {  // all st
       if (StateOrder(st) == order &&  // if state is the current order and
-          !marginal_stats_[st].hi_states.empty()) {  // is backed off to
-        CalculateNewStateWeights(st);
+          NumHiStates(st) > 0) {  // is backed off to
+        states.push_back(st);
+      }
+    }
+    wts.assign(states.size(), std::vector<double>());
+    norms.assign(states.size(), 0.0);
+    bo_weights.resize(states.size());
+    need_upd.assign(states.size(), false);
+    failed.assign(states.size(), false);
+    ForEachState(states.size(), [&](size_t i) {
+      HigherOrderStateSum(states[i]);  // collect stats from higher orders
+      if (!HigherOrderArcSum(states[i], true)) {  // collect stats for all arcs
+        failed[i] = true;
+        return;
       }
+      norms[i] = GetSaneArcWeights(states[i], &wts[i]);
+    });
+    if (!CheckArcSums(states, failed)) return;
+    active.resize(states.size());
+    for (size_t i = 0; i < states.size(); ++i) active[i] = i;
+    for (int upd_count = 1;; ++upd_count) {
+      for (size_t i : active)  // assign new weights to arcs
+        SetSaneArcWeights(states[i], &wts[i], norms[i]);
+      if (max_bo_updates_ <= 0) break;
+      ForEachState(active.size(), [&](size_t a) {
+        CalcHigherOrderBackoffs(states[active[a]], &bo_weights[active[a]]);
+      });
+      for (size_t i : active) SetHigherOrderBackoffs(states[i], bo_weights[i]);
+      if (Error()) return;
+      ForEachState(active.size(), [&](size_t a) {
+        size_t i = active[a];
+        bool state_failed = false;
+        need_upd[i] =
+            HigherOrderBackoffRecalc(states[i], bo_weights[i], &wts[i],
+                                     &norms[i], &state_failed);
+        failed[i] = state_failed;
+      });
+      if (!CheckArcSums(states, failed)) return;
+      updated.clear();
+      for (size_t i : active)
+        if (need_upd[i]) updated.push_back(i);
+      active.swap(updated);
+      if (active.empty() || upd_count >= max_bo_updates_) break;
     }
   }
 }
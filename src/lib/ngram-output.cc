@@ -17,6 +17,8 @@
 
 #include <ngram/ngram-output.h>
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <ctime>
@@ -46,6 +48,7 @@ using fst::StdMutableFst;
 // Determine whether n-gram state is in context or not
 bool NGramOutput::InContext(StateId st) const {
   if (context_.NullContext()) return true;
+  if (st < state_contexts_.NumStates()) return state_contexts_.HasContext(st);
   const std::vector<Label> &ngram = StateNGram(st);
   if (context_.HasContext(ngram, include_all_suffixes_)) return true;
   return false;
@@ -66,10 +69,18 @@ void NGramOutput::ShowNGramModel(NGramOutput::ShowBackoff showeps, bool neglogs,
   if (ARPA) {
     ShowARPAModel();
   } else {
+    const auto symbols = SymbolStrings();
+    auto show = [this, showeps, neglogs, intcnts](
+                    StateId st, size_t arc_begin, size_t arc_end,
+                    bool show_final, NGramWriter *writer) {
+      ShowNGrams(st, arc_begin, arc_end, show_final, showeps, neglogs,
+                 intcnts, writer);
+    };
     std::string str = "";  // init n-grams from unigram state
     double start_wt;  // weight of <s> (count or prob) same as unigram </s>
     if (UnigramState() >= 0) {  // show n-grams from unigram state
-      ShowNGrams(UnigramState(), str, showeps, neglogs, intcnts);
+      ShowRootNGrams(UnigramState(), str, /*final_first=*/false, symbols,
+                     show);
       start_wt =
           WeightRep(GetFst().Final(UnigramState()).Value(), neglogs, intcnts);
       str = FST_FLAGS_start_symbol;  // init n-grams from <s> state
@@ -86,7 +97,83 @@ void NGramOutput::ShowNGramModel(NGramOutput::ShowBackoff showeps, bool neglogs,
                                     neglogs, intcnts);
       ostrm_ << '\n';
     }
-    ShowNGrams(GetFst().Start(), str, showeps, neglogs, intcnts);
+    ShowRootNGrams(GetFst().Start(), str, /*final_first=*/false, symbols, show);
+  }
+}
+
+// Appends the symbol of the label to the history.
+void NGramOutput::NGramWriter::PushWord(Label label) {
+  if (!history_.empty()) history_ += ' ';
+  if (label >= 0 && static_cast<size_t>(label) < symbols_.size())
+    history_ += symbols_[label];
+}
+
+// Appends a value as the output stream would with precision 7.
+void NGramOutput::NGramWriter::AppendValue(double value) {
+  char str[32];
+  const auto result = std::to_chars(str, str + sizeof(str), value,
+                                    std::chars_format::general, 7);
+  buf_.append(str, result.ptr);
+}
+
+// Ends the line, writing the buffer out if it is large.
+void NGramOutput::NGramWriter::EndLine() {
+  static constexpr size_t kFlushSize = 1 << 20;
+  buf_ += '\n';
+  if (buf_.size() >= kFlushSize) Flush();
+}
+
+// Writes the buffer out, if there is an output stream.
+void NGramOutput::NGramWriter::Flush() {
+  if (!ostrm_ || buf_.empty()) return;
+  ostrm_->write(buf_.data(), buf_.size());
+  buf_.clear();
+}
+
+// Symbol of each label in the model's symbol table
+std::vector<std::string> NGramOutput::SymbolStrings() const {
+  std::vector<std::string> symbols;
+  for (const auto &item : *GetFst().InputSymbols()) {
+    if (item.Label() < 0) continue;
+    if (static_cast<size_t>(item.Label()) >= symbols.size())
+      symbols.resize(item.Label() + 1);
+    symbols[item.Label()] = item.Symbol();
+  }
+  return symbols;
+}
+
+// Shows n-grams leaving a root state, formatting ranges of its arcs
+// concurrently
+template <class ShowFn>
+void NGramOutput::ShowRootNGrams(StateId st, const std::string &history,
+                                 bool final_first,
+                                 const std::vector<std::string> &symbols,
+                                 ShowFn show) const {
+  if (st < 0) return;  // ignore for st < 0
+  const size_t narcs = GetFst().NumArcs(st);
+  const size_t nranges =
+      num_threads_ > 1 ? std::max<size_t>(
+                             1, std::min<size_t>(narcs, 16 * num_threads_))
+                       : 1;
+  auto show_range = [&](size_t r, NGramWriter *writer) {
+    const bool show_final = final_first ? r == 0 : r == nranges - 1;
+    show(st, narcs * r / nranges, narcs * (r + 1) / nranges, show_final,
+         writer);
+  };
+  if (nranges == 1) {
+    NGramWriter writer(symbols, &ostrm_, history);
+    show_range(0, &writer);
+    return;
+  }
+  std::vector<std::string> bufs(nranges);
+  ParallelFor(nranges, num_threads_, [&](size_t r) {
+    NGramWriter writer(symbols, nullptr, history);
+    show_range(r, &writer);
+    bufs[r].swap(*writer.MutableBuffer());
+  });
+  for (auto &buf : bufs) {
+    ostrm_.write(buf.data(), buf.size());
+    std::string().swap(buf);
   }
 }
 
@@ -138,38 +225,51 @@ void NGramOutput::ShowARPAHeader() const {
   ostrm_ << '\n';
 }
 
-// Print n-grams leaving a particular state for the ARPA model format
-void NGramOutput::ShowARPANGrams(StdArc::StateId st, const std::string &str,
-                                 int order) const {
+// Print n-grams of the given order leaving a particular state for the ARPA
+// model format
+void NGramOutput::ShowARPANGrams(StateId st, int order, size_t arc_begin,
+                                 size_t arc_end, bool show_final,
+                                 NGramWriter *writer) const {
   if (st < 0 || StateOrder(st) > order) return;  // ignore for st < 0
-  bool show = InContext(st);
-  if (show && order == StateOrder(st) &&               // only show target order
+  const bool show = order == StateOrder(st) &&  // only show target order
+                    InContext(st);
+  if (show && show_final &&
       GetFst().Final(st) != StdArc::Weight::Zero()) {  // </s> n-gram to show
     // log_10(p)
-    ostrm_ << ShowLogNewBase(GetFst().Final(st).Value(), 10) << "\t";
-    if (!str.empty()) ostrm_ << str << " ";
-    ostrm_ << FST_FLAGS_end_symbol << '\n';
+    writer->AppendValue(ShowLogNewBase(GetFst().Final(st).Value(), 10));
+    writer->Append('\t');
+    if (!writer->History().empty()) {
+      writer->Append(writer->History());
+      writer->Append(' ');
+    }
+    writer->Append(FST_FLAGS_end_symbol);
+    writer->EndLine();
   }
-  for (ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st); !aiter.Done();
+  const size_t history_size = writer->History().size();
+  ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st);
+  for (aiter.Seek(arc_begin); !aiter.Done() && aiter.Position() < arc_end;
        aiter.Next()) {
-    StdArc arc = aiter.Value();
+    const StdArc &arc = aiter.Value();
     if (arc.ilabel == BackoffLabel())  // ignore backoff arc
       continue;
-    // Find symbol str.
-    std::string symbol = GetFst().InputSymbols()->Find(arc.ilabel);
-    std::string newstr = str;                   // history string
-    AppendWordToNGramHistory(&newstr, symbol);  // Full n-gram
-    if (show && order == StateOrder(st)) {      // only show target order
-      ostrm_ << ShowLogNewBase(arc.weight.Value(), 10);  // log_10 n-gram prob
-      ostrm_ << "\t" << newstr;
-      if (StateOrder(arc.nextstate) > StateOrder(st))  // show backoff
-        ostrm_ << "\t" << ShowLogNewBase(
-                              ScalarValue(GetBackoffCost(arc.nextstate)), 10);
-      ostrm_ << '\n';
+    const bool ascends = StateOrder(arc.nextstate) > StateOrder(st);
+    if (!show && !ascends) continue;
+    writer->PushWord(arc.ilabel);  // Full n-gram
+    if (show) {
+      writer->AppendValue(ShowLogNewBase(arc.weight.Value(), 10));
+      writer->Append('\t');
+      writer->Append(writer->History());
+      if (ascends) {  // show backoff
+        writer->Append('\t');
+        writer->AppendValue(
+            ShowLogNewBase(ScalarValue(GetBackoffCost(arc.nextstate)), 10));
+      }
+      writer->EndLine();
+    } else {  // depth-first traversal
+      ShowARPANGrams(arc.nextstate, order, 0,
+                     GetFst().NumArcs(arc.nextstate), true, writer);
     }
-    if (arc.ilabel != BackoffLabel() &&  // depth-first traversal
-        StateOrder(arc.nextstate) > StateOrder(st))
-      ShowARPANGrams(arc.nextstate, newstr, order);
+    writer->PopWords(history_size);
   }
 }
 
@@ -177,6 +277,7 @@ void NGramOutput::ShowARPANGrams(StdArc::StateId st, const std::string &str,
 void NGramOutput::ShowARPAModel() const {
   ostrm_.precision(7);
   ShowARPAHeader();
+  const auto symbols = SymbolStrings();
   for (int i = 0; i < HiOrder(); ++i) {
     ostrm_ << "\\" << i + 1 << "-grams:\n";
     if (i == 0 &&  // following SRILM, add <s> unigram w/ dummy weight of -99
@@ -188,15 +289,20 @@ void NGramOutput::ShowARPAModel() const {
                                  10);
       ostrm_ << '\n';
     }
+    auto show = [this, i](StateId st, size_t arc_begin, size_t arc_end,
+                          bool show_final, NGramWriter *writer) {
+      ShowARPANGrams(st, i + 1, arc_begin, arc_end, show_final, writer);
+    };
     if (UnigramState() >= 0) {
       // init n-grams from <s> state
-      ShowARPANGrams(GetFst().Start(), FST_FLAGS_start_symbol,
-                     i + 1);
+      ShowRootNGrams(GetFst().Start(), FST_FLAGS_start_symbol,
+                     /*final_first=*/true, symbols, show);
       // show n-grams from unigram state
-      ShowARPANGrams(UnigramState(), "", i + 1);
+      ShowRootNGrams(UnigramState(), "", /*final_first=*/true, symbols, show);
     } else {
       // init n-grams from unigram state
-      ShowARPANGrams(GetFst().Start(), "", i + 1);
+      ShowRootNGrams(GetFst().Start(), "", /*final_first=*/true, symbols,
+                     show);
     }
     ostrm_ << '\n';
   }
@@ -204,41 +310,53 @@ void NGramOutput::ShowARPAModel() const {
 }
 
 // Print n-grams leaving a particular state, standard output format
-void NGramOutput::ShowNGrams(StdArc::StateId st, const std::string &str,
-                             NGramOutput::ShowBackoff showeps, bool neglogs,
-                             bool intcnts) const {
+void NGramOutput::ShowNGrams(StateId st, size_t arc_begin, size_t arc_end,
+                             bool show_final, NGramOutput::ShowBackoff showeps,
+                             bool neglogs, bool intcnts,
+                             NGramWriter *writer) const {
   if (st < 0) return;  // ignore for st < 0
   bool show = InContext(st);
-  for (ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st); !aiter.Done();
+  const size_t history_size = writer->History().size();
+  ArcIterator<StdExpandedFst> aiter(GetExpandedFst(), st);
+  for (aiter.Seek(arc_begin); !aiter.Done() && aiter.Position() < arc_end;
        aiter.Next()) {
-    StdArc arc = aiter.Value();
+    const StdArc &arc = aiter.Value();
     if (arc.ilabel == BackoffLabel() &&
         showeps != ShowBackoff::EPSILON)  // skip backoff unless showing EPSILON
       continue;
-    // Find symbol str.
-    std::string symbol = GetFst().InputSymbols()->Find(arc.ilabel);
-    std::string newstr = str;                   // history string
-    AppendWordToNGramHistory(&newstr, symbol);  // Full n-gram string
+    const bool ascends = arc.ilabel != BackoffLabel() &&
+                         StateOrder(arc.nextstate) > StateOrder(st);
+    if (!show && !ascends) continue;
+    writer->PushWord(arc.ilabel);  // Full n-gram string
     if (show) {
-      ostrm_ << newstr << "\t";  // output n-gram and its weight
-      ostrm_ << WeightRep(arc.weight.Value(), neglogs, intcnts);
+      writer->Append(writer->History());  // output n-gram and its weight
+      writer->Append('\t');
+      writer->AppendValue(WeightRep(arc.weight.Value(), neglogs, intcnts));
       if (showeps == ShowBackoff::INLINE &&
-          StateOrder(arc.nextstate) > StateOrder(st))  // show backoff
-        ostrm_ << "\t" << WeightRep(GetBackoffCost(arc.nextstate).Value(),
-                                    neglogs, intcnts);
-      ostrm_ << '\n';
+          StateOrder(arc.nextstate) > StateOrder(st)) {  // show backoff
+        writer->Append('\t');
+        writer->AppendValue(
+            WeightRep(GetBackoffCost(arc.nextstate).Value(), neglogs, intcnts));
+      }
+      writer->EndLine();
     }
-    if (arc.ilabel != BackoffLabel() &&  // depth-first traversal
-        StateOrder(arc.nextstate) > StateOrder(st))
-      ShowNGrams(arc.nextstate, newstr, showeps, neglogs, intcnts);
+    if (ascends) {  // depth-first traversal
+      ShowNGrams(arc.nextstate, 0, GetFst().NumArcs(arc.nextstate), true,
+                 showeps, neglogs, intcnts, writer);
+    }
+    writer->PopWords(history_size);
   }
-  if (show &&
+  if (show && show_final &&
       GetFst().Final(st) != StdArc::Weight::Zero()) {  // show </s> counts
-    if (!str.empty())  // if history string, print it
-      ostrm_ << str << " ";
-    ostrm_ << FST_FLAGS_end_symbol << '\t'
-           << WeightRep(GetFst().Final(st).Value(), neglogs, intcnts);
-    ostrm_ << '\n';
+    if (!writer->History().empty()) {  // if history string, print it
+      writer->Append(writer->History());
+      writer->Append(' ');
+    }
+    writer->Append(FST_FLAGS_end_symbol);
+    writer->Append('\t');
+    writer->AppendValue(
+        WeightRep(GetFst().Final(st).Value(), neglogs, intcnts));
+    writer->EndLine();
   }
 }
 
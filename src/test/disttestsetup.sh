@@ -13,7 +13,7 @@ if [[ ${FRAC_DIST} = true ]]; then
   readonly NODIST_DISCOUNT_BINS=4
 else
   echo "NOFRAC"
-  readonly DIST_BIN="${srcdir}/../bin/ngramdisttrain.sh"
+  readonly DIST_BIN="${BIN}/ngramdisttrain"
   readonly NODIST_DISCOUNT_BINS=-1
 fi
 readonly NODIST_BIN="${srcdir}/../bin/ngramdisttrain.sh"
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Tests the command line binary ngrammap.
+
+set -eou pipefail
+
+readonly BIN="../bin"
+readonly TESTDATA="${srcdir}/testdata"
+readonly TEST_TMPDIR="${TEST_TMPDIR:-$(mktemp -d)}"
+
+compile_test_fst() {
+  fstcompile \
+    --isymbols="${TESTDATA}/${1}.sym" \
+    --osymbols="${TESTDATA}/${1}.sym" \
+    --keep_isymbols \
+    --keep_osymbols \
+    --keep_state_numbering \
+    "${TESTDATA}/${1}.txt" \
+    "${TEST_TMPDIR}/${1}.ref"
+}
+
+for MODEL in earnest.mod earnest-katz.mod earnest-kneser_ney.mod; do
+  compile_test_fst "${MODEL}"
+
+  "${BIN}/ngrammap" \
+    "${TEST_TMPDIR}/${MODEL}.ref" \
+    "${TEST_TMPDIR}/${MODEL}.map"
+
+  # The mapped model has the same arcs, state orders, backoffs and lookups.
+  "${BIN}/ngrammap" \
+    --check \
+    "${TEST_TMPDIR}/${MODEL}.ref" \
+    "${TEST_TMPDIR}/${MODEL}.map"
+done
+
+# A model FST is not a mapped model.
+if "${BIN}/ngrammap" \
+  --check \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/earnest.mod.ref"; then
+  exit 1
+fi
@@ -27,3 +27,11 @@ compile_test_fst earnest-katz.marg.mod
 fstequal \
   "${TEST_TMPDIR}/earnest-katz.marg.mod.ref" \
   "${TEST_TMPDIR}/earnest-katz.marg.mod"
+
+"${BIN}/ngrammarginalize" --threads=4 \
+  "${TEST_TMPDIR}/earnest-katz.mod.ref" \
+  "${TEST_TMPDIR}/earnest-katz.marg.threads.mod"
+
+fstequal \
+  "${TEST_TMPDIR}/earnest-katz.marg.mod.ref" \
+  "${TEST_TMPDIR}/earnest-katz.marg.threads.mod"
@@ -69,3 +69,126 @@ compile_test_fst earnest.mrg.smooth.norm
 fstequal \
   "${TEST_TMPDIR}/earnest.mrg.smooth.norm.ref" \
   "${TEST_TMPDIR}/earnest.mrg.smooth.norm"
+
+# Merging all models in a single pass yields the same n-grams as pairwise.
+"${BIN}/ngrammerge" \
+  --check_consistency \
+  --method=count_merge \
+  --single_pass \
+  "${TEST_TMPDIR}/earnest-absolute.mod.ref" \
+  "${TEST_TMPDIR}/earnest-seymore.pru.ref" \
+  "${TEST_TMPDIR}/earnest.mrg.single"
+
+"${BIN}/ngramprint" --backoff --negativelogs \
+  "${TEST_TMPDIR}/earnest.mrg.ref" | sort > "${TEST_TMPDIR}/earnest.mrg.txt"
+"${BIN}/ngramprint" --backoff --negativelogs \
+  "${TEST_TMPDIR}/earnest.mrg.single" | sort \
+  > "${TEST_TMPDIR}/earnest.mrg.single.txt"
+
+cmp "${TEST_TMPDIR}/earnest.mrg.txt" "${TEST_TMPDIR}/earnest.mrg.single.txt"
+
+# With more than two models, single-pass count merging yields the same
+# counts as folding the models pairwise.
+compile_test_fst earnest.cnts
+compile_test_fst earnest-det.cnts
+compile_test_fst earnest-min.cnts
+"${BIN}/ngrammerge" \
+  --check_consistency \
+  --method=count_merge \
+  --round_to_int \
+  --ofile="${TEST_TMPDIR}/earnest.cnts.mrg3" \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest-det.cnts.ref" \
+  "${TEST_TMPDIR}/earnest-min.cnts.ref"
+
+"${BIN}/ngrammerge" \
+  --check_consistency \
+  --method=count_merge \
+  --round_to_int \
+  --single_pass \
+  --ofile="${TEST_TMPDIR}/earnest.cnts.mrg3.single" \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest-det.cnts.ref" \
+  "${TEST_TMPDIR}/earnest-min.cnts.ref"
+
+"${BIN}/ngramprint" --backoff \
+  "${TEST_TMPDIR}/earnest.cnts.mrg3" | sort \
+  > "${TEST_TMPDIR}/earnest.cnts.mrg3.txt"
+"${BIN}/ngramprint" --backoff \
+  "${TEST_TMPDIR}/earnest.cnts.mrg3.single" | sort \
+  > "${TEST_TMPDIR}/earnest.cnts.mrg3.single.txt"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.cnts.mrg3.txt" \
+  "${TEST_TMPDIR}/earnest.cnts.mrg3.single.txt"
+
+# Single-pass model merging of two models scores text as pairwise merging.
+"${BIN}/ngrammerge" \
+  --check_consistency \
+  --method=model_merge \
+  --normalize \
+  --single_pass \
+  "${TEST_TMPDIR}/earnest-absolute.mod.ref" \
+  "${TEST_TMPDIR}/earnest-seymore.pru.ref" \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.single"
+
+farcompilestrings \
+  --fst_type=compact \
+  --symbols="${TESTDATA}/earnest.sym" \
+  --keep_symbols \
+  "${TESTDATA}/earnest.txt" \
+  "${TEST_TMPDIR}/earnest.far"
+
+for MODEL in earnest.mrg.smooth.norm.ref earnest.mrg.smooth.norm.single; do
+  "${BIN}/ngramperplexity" \
+    "${TEST_TMPDIR}/${MODEL}" \
+    "${TEST_TMPDIR}/earnest.far" \
+    | tail -1 > "${TEST_TMPDIR}/${MODEL}.perp"
+done
+
+cmp \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.ref.perp" \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.single.perp"
+
+# Merging more models in a single pass mixes all of them at once, normalizing
+# once: mixing a model twice with weight beta is mixing it once with weight
+# twice beta.
+for METHOD in count_merge model_merge; do
+  "${BIN}/ngrammerge" \
+    --check_consistency \
+    --method="${METHOD}" \
+    --normalize \
+    --single_pass \
+    --ofile="${TEST_TMPDIR}/earnest.${METHOD}.mrg3" \
+    "${TEST_TMPDIR}/earnest-absolute.mod.ref" \
+    "${TEST_TMPDIR}/earnest-seymore.pru.ref" \
+    "${TEST_TMPDIR}/earnest-seymore.pru.ref"
+
+  "${BIN}/ngrammerge" \
+    --check_consistency \
+    --method="${METHOD}" \
+    --normalize \
+    --single_pass \
+    --beta=2 \
+    "${TEST_TMPDIR}/earnest-absolute.mod.ref" \
+    "${TEST_TMPDIR}/earnest-seymore.pru.ref" \
+    "${TEST_TMPDIR}/earnest.${METHOD}.mrg2"
+
+  fstequal \
+    "${TEST_TMPDIR}/earnest.${METHOD}.mrg2" \
+    "${TEST_TMPDIR}/earnest.${METHOD}.mrg3"
+done
+
+# Merging states of each order on several threads gives the same model.
+"${BIN}/ngrammerge" \
+  --check_consistency \
+  --method=model_merge \
+  --normalize \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest-absolute.mod.ref" \
+  "${TEST_TMPDIR}/earnest-seymore.pru.ref" \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.threads"
+
+fstequal \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.ref" \
+  "${TEST_TMPDIR}/earnest.mrg.smooth.norm.threads"
@@ -27,6 +27,14 @@ compile_test_fst earnest-witten_bell.mod
 
 cmp "${TESTDATA}/earnest.arpa" "${TEST_TMPDIR}/earnest.arpa"
 
+"${BIN}/ngramprint" \
+  --ARPA \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest-witten_bell.mod.ref" \
+  "${TEST_TMPDIR}/earnest.threads.arpa"
+
+cmp "${TESTDATA}/earnest.arpa" "${TEST_TMPDIR}/earnest.threads.arpa"
+
 "${BIN}/ngramread" --ARPA "${TESTDATA}/earnest.arpa" "${TEST_TMPDIR}/earnest.arpa.mod"
 
 "${BIN}/ngramprint" \
@@ -42,6 +50,56 @@ fstequal \
   "${TEST_TMPDIR}/earnest.arpa.mod" \
   "${TEST_TMPDIR}/earnest.arpa.mod2"
 
+"${BIN}/ngramread" \
+  --ARPA \
+  --threads=4 \
+  "${TESTDATA}/earnest.arpa" \
+  "${TEST_TMPDIR}/earnest.arpa.mod3"
+
+fstequal \
+  "${TEST_TMPDIR}/earnest.arpa.mod" \
+  "${TEST_TMPDIR}/earnest.arpa.mod3"
+
+# Infinite log probs and backoffs read the same from a (mapped) file as from
+# standard input, and a malformed log prob is an error.
+cat > "${TEST_TMPDIR}/inf.arpa" <<'EOF'
+
+\data\
+ngram 1=4
+ngram 2=2
+
+\1-grams:
+-0.60206 </s>
+-inf <s> -0.30103
+-0.30103 a -Infinity
+-inf b -0.30103
+
+\2-grams:
+-0.30103 <s> a
+-0.17609 a </s>
+
+\end\
+EOF
+
+"${BIN}/ngramread" --ARPA "${TEST_TMPDIR}/inf.arpa" \
+  "${TEST_TMPDIR}/inf.arpa.mod"
+
+"${BIN}/ngramread" --ARPA - "${TEST_TMPDIR}/inf.arpa.mod2" \
+  < "${TEST_TMPDIR}/inf.arpa"
+
+fstequal \
+  "${TEST_TMPDIR}/inf.arpa.mod" \
+  "${TEST_TMPDIR}/inf.arpa.mod2"
+
+sed 's/^-0.30103 a /x a /' "${TEST_TMPDIR}/inf.arpa" \
+  > "${TEST_TMPDIR}/bad.arpa"
+
+if "${BIN}/ngramread" --ARPA "${TEST_TMPDIR}/bad.arpa" \
+     "${TEST_TMPDIR}/bad.arpa.mod"; then
+  echo "ngramread accepted a malformed log prob" >&2
+  exit 1
+fi
+
 compile_test_fst earnest.cnts
 "${BIN}/ngramprint" \
   --check_consistency \
@@ -50,6 +108,13 @@ compile_test_fst earnest.cnts
 
 cmp "${TESTDATA}/earnest.cnt.print" "${TEST_TMPDIR}/earnest.cnt.print"
 
+"${BIN}/ngramprint" \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.threads.cnt.print"
+
+cmp "${TESTDATA}/earnest.cnt.print" "${TEST_TMPDIR}/earnest.threads.cnt.print"
+
 "${BIN}/ngramread" \
   --symbols="${TESTDATA}/earnest.sym" \
   "${TESTDATA}/earnest.cnt.print" \
@@ -66,3 +131,31 @@ cmp "${TESTDATA}/earnest.cnt.print" "${TEST_TMPDIR}/earnest.cnt.print"
 fstequal \
   "${TEST_TMPDIR}/earnest.cnts" \
   "${TEST_TMPDIR}/earnest.cnts2"
+
+gzip -c "${TESTDATA}/earnest.arpa" > "${TEST_TMPDIR}/earnest.arpa.gz"
+
+# Without zlib support, compressed files are rejected with an error.
+if ! "${BIN}/ngramread" \
+  --ARPA \
+  "${TEST_TMPDIR}/earnest.arpa.gz" \
+  "${TEST_TMPDIR}/earnest.gz.mod" \
+  2> "${TEST_TMPDIR}/earnest.gz.log"; then
+  grep -q "gzip support not compiled in" "${TEST_TMPDIR}/earnest.gz.log"
+else
+  fstequal \
+    "${TEST_TMPDIR}/earnest.arpa.mod" \
+    "${TEST_TMPDIR}/earnest.gz.mod"
+
+  "${BIN}/ngramprint" \
+    --ARPA \
+    "${TEST_TMPDIR}/earnest.arpa.mod" \
+    "${TEST_TMPDIR}/earnest.print.arpa.gz"
+
+  "${BIN}/ngramprint" \
+    --ARPA \
+    "${TEST_TMPDIR}/earnest.arpa.mod" \
+    "${TEST_TMPDIR}/earnest.print.arpa"
+
+  gzip -dc "${TEST_TMPDIR}/earnest.print.arpa.gz" \
+    | cmp "${TEST_TMPDIR}/earnest.print.arpa" -
+fi
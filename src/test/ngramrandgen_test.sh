@@ -35,3 +35,125 @@ compile_test_fst earnest.mod
 farequal \
   "${TEST_TMPDIR}/randgen.far" \
   "${TEST_TMPDIR}/randgen2.far"
+
+"${BIN}/ngramrandgen" \
+  --max_sents=1000 \
+  --seed=12 \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.threads.far"
+"${BIN}/ngramrandgen" \
+  --max_sents=1000 \
+  --seed=12 \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen2.threads.far"
+
+farequal \
+  "${TEST_TMPDIR}/randgen.threads.far" \
+  "${TEST_TMPDIR}/randgen2.threads.far"
+
+"${BIN}/ngramrandgen" \
+  --max_sents=1000 \
+  --seed=12 \
+  --stream \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.stream.far"
+"${BIN}/ngramrandgen" \
+  --max_sents=1000 \
+  --seed=12 \
+  --stream \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen2.stream.far"
+
+farequal \
+  "${TEST_TMPDIR}/randgen.stream.far" \
+  "${TEST_TMPDIR}/randgen2.stream.far"
+
+"${BIN}/ngramrandgen" \
+  --max_sents=1000 \
+  --seed=12 \
+  --text \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.txt"
+
+[[ "$(wc -l < "${TEST_TMPDIR}/randgen.txt")" -eq 1000 ]]
+
+if "${BIN}/ngramrandgen" \
+     --max_sents=1000 \
+     --text \
+     --weighted \
+     "${TEST_TMPDIR}/earnest.mod.ref" \
+     "${TEST_TMPDIR}/randgen.weighted.txt"; then
+  echo "ngramrandgen accepted --weighted with --text" >&2
+  exit 1
+fi
+
+# Sentences back off at the start state at the rate of its backoff numerator,
+# 1 - (sum of the probabilities of the words and end of sentence there). Only
+# after backing off can a sentence start with a word not seen at the start
+# state.
+"${BIN}/ngramrandgen" \
+  --max_sents=20000 \
+  --seed=12 \
+  --text \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.backoff.txt"
+
+awk -F'\t' '
+  NR == 1 { start = $1 }
+  $1 == start && NF >= 4 && $3 != "<epsilon>" {
+    print $3; sum += exp(-$5)
+  }
+  $1 == start && NF <= 2 { print ""; sum += exp(-$2) }
+  END { print 1 - sum > "/dev/stderr" }
+' "${TESTDATA}/earnest.mod.txt" \
+  > "${TEST_TMPDIR}/randgen.start.words" \
+  2> "${TEST_TMPDIR}/randgen.start.numer"
+
+awk -v numer="$(cat "${TEST_TMPDIR}/randgen.start.numer")" '
+  FNR == NR { seen[$0] = 1; next }
+  { ++total; if (!($1 in seen)) ++backoff }
+  END {
+    rate = backoff / total
+    if (rate - numer > 0.02 || numer - rate > 0.02) {
+      print "backoff rate " rate " differs from numerator " numer
+      exit 1
+    }
+  }
+' "${TEST_TMPDIR}/randgen.start.words" "${TEST_TMPDIR}/randgen.backoff.txt"
+
+# Streamed and tree-sampled sentences have the same mean length.
+"${BIN}/ngramrandgen" \
+  --max_sents=5000 \
+  --seed=12 \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.length.far"
+"${BIN}/ngramrandgen" \
+  --max_sents=5000 \
+  --seed=12 \
+  --stream \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/randgen.length.stream.far"
+
+mean_length() {
+  farprintstrings "${1}" | awk '
+    {
+      ++sents
+      for (i = 1; i <= NF; ++i) if ($i != "<epsilon>" && $i != "0") ++words
+    }
+    END { print words / sents }
+  '
+}
+
+awk -v tree="$(mean_length "${TEST_TMPDIR}/randgen.length.far")" \
+    -v stream="$(mean_length "${TEST_TMPDIR}/randgen.length.stream.far")" '
+  BEGIN {
+    if (tree - stream > 0.05 * tree || stream - tree > 0.05 * tree) {
+      print "mean lengths differ: " tree " and " stream
+      exit 1
+    }
+  }
+'
@@ -239,6 +239,7 @@ int ngramrandtest_main(int argc, char **argv) {
       fst::FarWriter<fst::StdArc>::Create(directory + "tocount.far",
                                                   far_type));
   ngram::NGramArcSelector<fst::StdArc> selector(FST_FLAGS_seed);
+  srand(FST_FLAGS_seed);
   // rand burn in, for improved randomness;
   for (int i = 0; i < 10; i++) rand();  // NOLINT
 
@@ -0,0 +1,221 @@
+#!/bin/bash
+# Tests the command line binary ngramsort.
+
+set -eou pipefail
+
+readonly BIN="../bin"
+readonly TESTDATA="${srcdir}/testdata"
+readonly TEST_TMPDIR="${TEST_TMPDIR:-$(mktemp -d)}"
+
+compile_test_fst() {
+  fstcompile \
+    --isymbols="${TESTDATA}/${1}.sym" \
+    --osymbols="${TESTDATA}/${1}.sym" \
+    --keep_isymbols \
+    --keep_osymbols \
+    --keep_state_numbering \
+    "${TESTDATA}/${1}.txt" \
+    "${TEST_TMPDIR}/${1}.ref"
+}
+
+compile_test_fst earnest.mod
+
+# Relabeling keeps the n-grams and their weights.
+"${BIN}/ngramsort" \
+  --relabel \
+  --relabel_pairs="${TEST_TMPDIR}/earnest.relabel.pairs" \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/earnest.relabel.mod"
+
+"${BIN}/ngramprint" --ARPA "${TEST_TMPDIR}/earnest.mod.ref" \
+  | sort > "${TEST_TMPDIR}/earnest.arpa.sorted"
+
+"${BIN}/ngramprint" --ARPA "${TEST_TMPDIR}/earnest.relabel.mod" \
+  | sort > "${TEST_TMPDIR}/earnest.relabel.arpa.sorted"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.arpa.sorted" \
+  "${TEST_TMPDIR}/earnest.relabel.arpa.sorted"
+
+# Relabeling again leaves the model unchanged.
+"${BIN}/ngramsort" \
+  --relabel \
+  "${TEST_TMPDIR}/earnest.relabel.mod" \
+  "${TEST_TMPDIR}/earnest.relabel2.mod"
+
+fstequal \
+  "${TEST_TMPDIR}/earnest.relabel.mod" \
+  "${TEST_TMPDIR}/earnest.relabel2.mod"
+
+# Scoring-oriented state orders keep the n-grams and their weights.
+"${BIN}/ngramsort" \
+  --state_order=breadth_first \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/earnest.bfs.mod"
+
+"${BIN}/ngramprint" --ARPA "${TEST_TMPDIR}/earnest.bfs.mod" \
+  | sort > "${TEST_TMPDIR}/earnest.bfs.arpa.sorted"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.arpa.sorted" \
+  "${TEST_TMPDIR}/earnest.bfs.arpa.sorted"
+
+# In breadth-first order, states are in order of non-decreasing n-gram order,
+# the order of a state being one more than that of its backoff state.
+fstprint "${TEST_TMPDIR}/earnest.bfs.mod" \
+  | awk -F'\t' '
+      function order(s) {
+        if (!(s in ord)) ord[s] = (s in bo) ? order(bo[s]) + 1 : 1
+        return ord[s]
+      }
+      NF >= 4 && $3 == "<epsilon>" { bo[$1] = $2 }
+      { ns = ($1 + 1 > ns) ? $1 + 1 : ns }
+      END {
+        for (s = 0; s < ns; ++s) {
+          if (order(s) < prev) {
+            print "State " s " of order " order(s) " follows order " prev
+            exit 1
+          }
+          prev = order(s)
+        }
+      }'
+
+farcompilestrings \
+  --fst_type=compact \
+  --symbols="${TESTDATA}/earnest.sym" \
+  --keep_symbols \
+  "${TESTDATA}/earnest.txt" \
+  "${TEST_TMPDIR}/earnest.far"
+
+"${BIN}/ngramsort" \
+  --state_order=visits \
+  --visit_profile="${TEST_TMPDIR}/earnest.far" \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/earnest.visits.mod"
+
+"${BIN}/ngramprint" --ARPA "${TEST_TMPDIR}/earnest.visits.mod" \
+  | sort > "${TEST_TMPDIR}/earnest.visits.arpa.sorted"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.arpa.sorted" \
+  "${TEST_TMPDIR}/earnest.visits.arpa.sorted"
+
+# Ordered by visits, states are in order of non-increasing visit count when
+# scoring the profile, counting the states backed off through.
+fstprint "${TEST_TMPDIR}/earnest.visits.mod" \
+  > "${TEST_TMPDIR}/earnest.visits.mod.txt"
+
+awk -F'\t' '
+  NR == FNR {
+    if (FNR == 1) start = $1
+    if (NF >= 4 && $3 == "<epsilon>") {
+      bo[$1] = $2
+    } else if (NF >= 4) {
+      arc[$1, $3] = $2
+    }
+    ns = ($1 + 1 > ns) ? $1 + 1 : ns
+    next
+  }
+  FNR == 1 {
+    for (s = 0; s < ns; ++s) if (!(s in bo)) unigram = s
+  }
+  {
+    st = start
+    n = split($0, words, " ")
+    for (i = 1; i <= n; ++i) {
+      ++visits[st]
+      for (s = st;;) {
+        if ((s, words[i]) in arc) {
+          st = arc[s, words[i]]
+          break
+        }
+        if (!(s in bo)) {
+          st = unigram
+          break
+        }
+        s = bo[s]
+        ++visits[s]
+      }
+    }
+    ++visits[st]
+  }
+  END {
+    for (s = 1; s < ns; ++s) {
+      if (visits[s] + 0 > visits[s - 1] + 0) {
+        print "State " s " visited " visits[s] + 0 " times follows state " \
+              s - 1 " visited " visits[s - 1] + 0 " times"
+        exit 1
+      }
+    }
+  }' "${TEST_TMPDIR}/earnest.visits.mod.txt" "${TESTDATA}/earnest.txt"
+
+# Models adopting the metadata written with the sorted model are unchanged,
+# and metadata written for another model is ignored.
+"${BIN}/ngramsort" \
+  --metadata="${TEST_TMPDIR}/earnest.sorted.meta" \
+  "${TEST_TMPDIR}/earnest.mod.ref" \
+  "${TEST_TMPDIR}/earnest.sorted.mod"
+
+"${BIN}/ngraminfo" "${TEST_TMPDIR}/earnest.sorted.mod" \
+  > "${TEST_TMPDIR}/earnest.sorted.info"
+
+"${BIN}/ngraminfo" \
+  --metadata="${TEST_TMPDIR}/earnest.sorted.meta" \
+  "${TEST_TMPDIR}/earnest.sorted.mod" \
+  > "${TEST_TMPDIR}/earnest.sorted.meta.info"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.sorted.info" \
+  "${TEST_TMPDIR}/earnest.sorted.meta.info"
+
+"${BIN}/ngraminfo" \
+  --v=1 \
+  --metadata="${TEST_TMPDIR}/earnest.sorted.meta" \
+  "${TEST_TMPDIR}/earnest.sorted.mod" \
+  > /dev/null \
+  2> "${TEST_TMPDIR}/earnest.sorted.meta.log"
+
+grep -q "Adopted metadata file" "${TEST_TMPDIR}/earnest.sorted.meta.log"
+
+# A truncated metadata file is rejected and the metadata recomputed.
+head -c 64 "${TEST_TMPDIR}/earnest.sorted.meta" \
+  > "${TEST_TMPDIR}/earnest.truncated.meta"
+
+"${BIN}/ngraminfo" \
+  --metadata="${TEST_TMPDIR}/earnest.truncated.meta" \
+  "${TEST_TMPDIR}/earnest.sorted.mod" \
+  > "${TEST_TMPDIR}/earnest.truncated.meta.info" \
+  2> "${TEST_TMPDIR}/earnest.truncated.meta.log"
+
+grep -q "Ignoring incomplete metadata file" \
+  "${TEST_TMPDIR}/earnest.truncated.meta.log"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.sorted.info" \
+  "${TEST_TMPDIR}/earnest.truncated.meta.info"
+
+"${BIN}/ngramprint" --ARPA \
+  --metadata="${TEST_TMPDIR}/earnest.sorted.meta" \
+  "${TEST_TMPDIR}/earnest.bfs.mod" \
+  | sort > "${TEST_TMPDIR}/earnest.bfs.meta.arpa.sorted"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.arpa.sorted" \
+  "${TEST_TMPDIR}/earnest.bfs.meta.arpa.sorted"
+
+# The relabeled model has the same shape as the sorted one but different arc
+# labels, so the sorted model's metadata is ignored for it.
+"${BIN}/ngraminfo" "${TEST_TMPDIR}/earnest.relabel.mod" \
+  > "${TEST_TMPDIR}/earnest.relabel.info"
+
+"${BIN}/ngraminfo" \
+  --metadata="${TEST_TMPDIR}/earnest.sorted.meta" \
+  "${TEST_TMPDIR}/earnest.relabel.mod" \
+  > "${TEST_TMPDIR}/earnest.relabel.meta.info" \
+  2> "${TEST_TMPDIR}/earnest.relabel.meta.log"
+
+grep -q "Ignoring metadata file" "${TEST_TMPDIR}/earnest.relabel.meta.log"
+
+cmp \
+  "${TEST_TMPDIR}/earnest.relabel.info" \
+  "${TEST_TMPDIR}/earnest.relabel.meta.info"
@@ -0,0 +1,72 @@
+#!/bin/bash
+# Tests the command line binary ngramsplit.
+
+set -eou pipefail
+
+readonly BIN="../bin"
+readonly TESTDATA="${srcdir}/testdata"
+readonly TEST_TMPDIR="${TEST_TMPDIR:-$(mktemp -d)}"
+
+compile_test_fst() {
+  fstcompile \
+    --isymbols="${TESTDATA}/${1}.sym" \
+    --osymbols="${TESTDATA}/${1}.sym" \
+    --keep_isymbols \
+    --keep_osymbols \
+    --keep_state_numbering \
+    "${TESTDATA}/${1}.txt" \
+    "${TEST_TMPDIR}/${1}.ref"
+}
+
+compile_test_fst earnest.cnts
+"${BIN}/ngramcontext" \
+  --contexts=8 \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.contexts"
+
+"${BIN}/ngramsplit" \
+  --contexts="${TEST_TMPDIR}/earnest.contexts" \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.split."
+
+"${BIN}/ngramsplit" \
+  --contexts="${TEST_TMPDIR}/earnest.contexts" \
+  --threads=4 \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.threads.split."
+
+for SPLIT in "${TEST_TMPDIR}/earnest.split."*; do
+  fstequal \
+    "${SPLIT}" \
+    "${TEST_TMPDIR}/earnest.threads.split.${SPLIT##*.}"
+done
+
+# --report_balance logs the predicted and actual sizes of the contexts, and
+# the largest balanced context is no larger than the largest greedy one.
+for METHOD in greedy balanced; do
+  "${BIN}/ngramcontext" \
+    --method="${METHOD}" \
+    --contexts=8 \
+    --report_balance \
+    "${TEST_TMPDIR}/earnest.cnts.ref" \
+    "${TEST_TMPDIR}/earnest.${METHOD}.contexts" \
+    2> "${TEST_TMPDIR}/earnest.${METHOD}.balance"
+  grep -q "Predicted arcs per context: max = " \
+    "${TEST_TMPDIR}/earnest.${METHOD}.balance"
+  grep -q "Actual arcs per context: max = " \
+    "${TEST_TMPDIR}/earnest.${METHOD}.balance"
+done
+
+max_arcs() {
+  sed -n "s/.*${1} arcs per context: max = \([0-9]*\),.*/\1/p" \
+    "${TEST_TMPDIR}/earnest.${2}.balance"
+}
+
+[ "$(max_arcs Predicted balanced)" -le "$(max_arcs Predicted greedy)" ]
+
+[ "$(wc -l < "${TEST_TMPDIR}/earnest.balanced.contexts")" -le 8 ]
+
+"${BIN}/ngramsplit" \
+  --contexts="${TEST_TMPDIR}/earnest.balanced.contexts" \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.balanced.split."
@@ -10,3 +10,10 @@ readonly TEST_TMPDIR="${TEST_TMPDIR:-$(mktemp -d)}"
 "${BIN}/ngramsymbols" "${TESTDATA}/earnest.txt" "${TEST_TMPDIR}/earnest.sym"
 
 cmp "${TESTDATA}/earnest.sym" "${TEST_TMPDIR}/earnest.sym"
+
+"${BIN}/ngramsymbols" \
+  --threads=4 \
+  "${TESTDATA}/earnest.txt" \
+  "${TEST_TMPDIR}/earnest.threads.sym"
+
+cmp "${TESTDATA}/earnest.sym" "${TEST_TMPDIR}/earnest.threads.sym"
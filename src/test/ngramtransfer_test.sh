@@ -0,0 +1,51 @@
+#!/bin/bash
+# Tests the command line binary ngramtransfer.
+
+set -eou pipefail
+
+readonly BIN="../bin"
+readonly TESTDATA="${srcdir}/testdata"
+readonly TEST_TMPDIR="${TEST_TMPDIR:-$(mktemp -d)}"
+
+compile_test_fst() {
+  fstcompile \
+    --isymbols="${TESTDATA}/${1}.sym" \
+    --osymbols="${TESTDATA}/${1}.sym" \
+    --keep_isymbols \
+    --keep_osymbols \
+    --keep_state_numbering \
+    "${TESTDATA}/${1}.txt" \
+    "${TEST_TMPDIR}/${1}.ref"
+}
+
+compile_test_fst earnest.cnts
+"${BIN}/ngramcontext" \
+  --contexts=4 \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.contexts"
+
+"${BIN}/ngramsplit" \
+  --contexts="${TEST_TMPDIR}/earnest.contexts" \
+  "${TEST_TMPDIR}/earnest.cnts.ref" \
+  "${TEST_TMPDIR}/earnest.split."
+
+# Transfers from the first split to all others, one at a time and
+# concurrently.
+"${BIN}/ngramtransfer" \
+  --contexts="${TEST_TMPDIR}/earnest.contexts" \
+  --index=0 \
+  --ofile="${TEST_TMPDIR}/earnest.transfer." \
+  "${TEST_TMPDIR}/earnest.split."*
+
+"${BIN}/ngramtransfer" \
+  --contexts="${TEST_TMPDIR}/earnest.contexts" \
+  --index=0 \
+  --threads=3 \
+  --ofile="${TEST_TMPDIR}/earnest.threads.transfer." \
+  "${TEST_TMPDIR}/earnest.split."*
+
+for TRANSFER in "${TEST_TMPDIR}/earnest.transfer."*; do
+  fstequal \
+    "${TRANSFER}" \
+    "${TEST_TMPDIR}/earnest.threads.transfer.${TRANSFER##*.}"
+done